@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+
+# Auto-generate src/tld-hash.h from src/tld.h.
+# Builds a minimal perfect hash (hash and displace)
+# over the lowercased ICANN TLDs plus the pseudo-TLDs
+# we refuse to resolve. The hash must match
+# hsk_tld_hash in src/tld-lookup.c.
+#
+# Usage example:
+# ./scripts/tld-hash.py > src/tld-hash.h
+
+import re
+import sys
+
+BLACKLIST = [
+  'bit',   # Namecoin
+  'eth',   # ENS
+  'exit',  # Tor
+  'gnu',   # GNUnet (GNS)
+  'i2p',   # Invisible Internet Project
+  'onion', # Tor
+  'tor',   # OnioNS
+  'zkey'   # GNS
+]
+
+MASK = 0xffffffff
+
+def fnv64(name):
+  h = 0xcbf29ce484222325
+  for c in name.lower().encode():
+    h ^= c
+    h = (h * 0x100000001b3) & 0xffffffffffffffff
+  return h
+
+def mix(f, d):
+  x = (f ^ (d * 0x9e3779b9)) & MASK
+  x ^= x >> 16
+  x = (x * 0x85ebca6b) & MASK
+  x ^= x >> 13
+  x = (x * 0xc2b2ae35) & MASK
+  x ^= x >> 16
+  return x
+
+def read_names(path):
+  with open(path) as f:
+    text = f.read()
+  body = text.split('HSK_TLD_NAMES[] = {', 1)[1].split('};', 1)[0]
+  return re.findall(r'"([^"]*)"', body)
+
+def build(keys):
+  size = len(keys)
+  count = (size + 3) // 4
+  buckets = [[] for _ in range(count)]
+
+  for i, key in enumerate(keys):
+    h = fnv64(key)
+    buckets[(h >> 32) % count].append((i, h & MASK))
+
+  order = sorted(range(count), key=lambda b: -len(buckets[b]))
+  disp = [0] * count
+  slots = [None] * size
+
+  for b in order:
+    items = buckets[b]
+
+    if not items:
+      continue
+
+    for d in range(0x10000):
+      pos = [mix(f, d) % size for _, f in items]
+
+      if len(set(pos)) != len(pos):
+        continue
+
+      if any(slots[p] is not None for p in pos):
+        continue
+
+      for (i, _), p in zip(items, pos):
+        slots[p] = i
+
+      disp[b] = d
+      break
+    else:
+      raise Exception('no displacement for bucket %d' % b)
+
+  return disp, slots
+
+def emit_array(ctype, name, values, per_line):
+  out = 'static const %s %s[%d] = {\n' % (ctype, name, len(values))
+  for i in range(0, len(values), per_line):
+    row = ', '.join(str(v) for v in values[i:i + per_line])
+    comma = ',' if i + per_line < len(values) else ''
+    out += '  ' + row + comma + '\n'
+  out += '};\n'
+  return out
+
+def main():
+  names = read_names('src/tld.h')
+  lower = [n.lower() for n in names]
+  extra = [n for n in BLACKLIST if n not in lower]
+  keys = lower + extra
+
+  disp, slots = build(keys)
+
+  bitmap = [0] * ((len(keys) + 7) // 8)
+
+  for p, i in enumerate(slots):
+    if keys[i] in BLACKLIST:
+      bitmap[p >> 3] |= 1 << (p & 7)
+
+  out = '#ifndef _HSK_TLD_HASH_H\n'
+  out += '#define _HSK_TLD_HASH_H\n'
+  out += '\n'
+  out += '/* Autogenerated by scripts/tld-hash.py, do not edit. */\n'
+  out += '\n'
+  out += '#include <stdint.h>\n'
+  out += '\n'
+  out += '#define HSK_TLD_HASH_SIZE %d\n' % len(keys)
+  out += '#define HSK_TLD_HASH_BUCKETS %d\n' % len(disp)
+  out += '\n'
+  out += '// Pseudo-TLDs missing from HSK_TLD_NAMES,\n'
+  out += '// indexed from HSK_TLD_SIZE.\n'
+  out += 'static const char *HSK_TLD_EXTRA[] = {\n'
+  out += ',\n'.join('  "%s"' % n for n in extra) + '\n'
+  out += '};\n'
+  out += '\n'
+  out += emit_array('uint16_t', 'HSK_TLD_HASH_DISP', disp, 12)
+  out += '\n'
+  out += emit_array('uint16_t', 'HSK_TLD_HASH_SLOTS', slots, 12)
+  out += '\n'
+  out += '// Slots of blacklisted pseudo-TLDs.\n'
+  out += emit_array('uint8_t', 'HSK_TLD_HASH_BLACKLIST', bitmap, 16)
+  out += '\n'
+  out += '#endif\n'
+
+  sys.stdout.write(out)
+
+main()
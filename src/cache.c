@@ -7,7 +7,9 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "bio.h"
 #include "cache.h"
+#include "constants.h"
 #include "dns.h"
 #include "error.h"
 #include "map.h"
@@ -18,16 +20,44 @@
 void
 hsk_cache_init(hsk_cache_t *c) {
   assert(c);
-  hsk_map_init_map(&c->map,
-    hsk_cache_key_hash,
-    hsk_cache_key_equal,
-    (hsk_map_free_func)hsk_cache_item_free);
+
+  int i;
+  for (i = 0; i < HSK_CACHE_SHARDS; i++) {
+    hsk_cache_shard_t *shard = &c->shards[i];
+
+    int rc = uv_rwlock_init(&shard->lock);
+    assert(rc == 0);
+
+    hsk_map_init_map(&shard->map,
+      hsk_cache_key_hash,
+      hsk_cache_key_equal,
+      (hsk_map_free_func)hsk_cache_item_free);
+  }
+
+  int rc = uv_rwlock_init(&c->root_lock);
+  assert(rc == 0);
+  memset(c->root, 0x00, 32);
+  c->max_stale = HSK_CACHE_MAX_STALE;
+  c->writing = NULL;
 }
 
 void
 hsk_cache_uninit(hsk_cache_t *c) {
   assert(c);
-  hsk_map_uninit(&c->map);
+
+  int i;
+  for (i = 0; i < HSK_CACHE_SHARDS; i++) {
+    hsk_map_uninit(&c->shards[i].map);
+    uv_rwlock_destroy(&c->shards[i].lock);
+  }
+
+  uv_rwlock_destroy(&c->root_lock);
+
+  // Let an in-flight snapshot finish on its own.
+  if (c->writing) {
+    c->writing->cache = NULL;
+    c->writing = NULL;
+  }
 }
 
 hsk_cache_t *
@@ -47,7 +77,6 @@ hsk_cache_free(hsk_cache_t *c) {
 
 static void
 hsk_cache_log(const hsk_cache_t *c, const char *fmt, ...) {
-  assert(c);
   printf("cache: ");
 
   va_list args;
@@ -56,10 +85,182 @@ hsk_cache_log(const hsk_cache_t *c, const char *fmt, ...) {
   va_end(args);
 }
 
+static hsk_cache_shard_t *
+hsk_cache_shard(hsk_cache_t *c, const hsk_cache_key_t *ck) {
+  // The map buckets on the low bits, shard on the high ones.
+  uint32_t hash = hsk_cache_key_hash(ck);
+  return &c->shards[hash >> (32 - HSK_CACHE_SHARD_BITS)];
+}
+
 static void
-hsk_cache_prune(hsk_cache_t *c) {
-  assert(c);
-  hsk_map_clear(&c->map);
+hsk_cache_prune(hsk_cache_t *c, hsk_cache_shard_t *shard) {
+  assert(c && shard);
+
+  hsk_map_t *map = &shard->map;
+  hsk_map_iter_t i;
+  int64_t now = hsk_now();
+
+  // Drop answers that are too old to serve stale,
+  // and everything if that does not free up space.
+  for (i = hsk_map_begin(map); i != hsk_map_end(map); i++) {
+    if (!hsk_map_exists(map, i))
+      continue;
+
+    hsk_cache_item_t *item = (hsk_cache_item_t *)hsk_map_value(map, i);
+
+    if (now >= item->expires + c->max_stale) {
+      hsk_map_delete(map, i);
+      hsk_cache_item_free(item);
+    }
+  }
+
+  if (map->size >= HSK_CACHE_SHARD_LIMIT)
+    hsk_map_clear(map);
+}
+
+static bool
+hsk_cache_key_below(const hsk_cache_key_t *ck, const char *tld) {
+  // Key names are lowercase and fully qualified.
+  size_t len = strlen(tld);
+
+  if (ck->name_len < len + 1)
+    return false;
+
+  const uint8_t *label = &ck->name[ck->name_len - 1 - len];
+
+  if (ck->name[ck->name_len - 1] != '.')
+    return false;
+
+  if (memcmp(label, tld, len) != 0)
+    return false;
+
+  return label == ck->name || label[-1] == '.';
+}
+
+static bool
+hsk_cache_key_kept(
+  const hsk_cache_key_t *ck,
+  const char **keep,
+  int keep_len
+) {
+  int i;
+
+  for (i = 0; i < keep_len; i++) {
+    if (hsk_cache_key_below(ck, keep[i]))
+      return true;
+  }
+
+  return false;
+}
+
+void
+hsk_cache_set_root(
+  hsk_cache_t *c,
+  const uint8_t *root,
+  const char **keep,
+  int keep_len
+) {
+  assert(c && root);
+
+  uv_rwlock_rdlock(&c->root_lock);
+  bool same = memcmp(c->root, root, 32) == 0;
+  uv_rwlock_rdunlock(&c->root_lock);
+
+  if (same)
+    return;
+
+  uv_rwlock_wrlock(&c->root_lock);
+
+  if (memcmp(c->root, root, 32) == 0) {
+    uv_rwlock_wrunlock(&c->root_lock);
+    return;
+  }
+
+  memcpy(c->root, root, 32);
+
+  // Answers were built from the old tree. Those
+  // being refreshed keep serving (for a short
+  // grace period at most) until their new proof
+  // lands. The rest remain usable as stale answers.
+  int64_t now = hsk_now();
+  uint32_t expired = 0;
+  uint32_t kept = 0;
+  int s;
+
+  for (s = 0; s < HSK_CACHE_SHARDS; s++) {
+    hsk_cache_shard_t *shard = &c->shards[s];
+    hsk_map_t *map = &shard->map;
+    hsk_map_iter_t i;
+
+    uv_rwlock_wrlock(&shard->lock);
+
+    for (i = hsk_map_begin(map); i != hsk_map_end(map); i++) {
+      if (!hsk_map_exists(map, i))
+        continue;
+
+      hsk_cache_item_t *item = (hsk_cache_item_t *)hsk_map_value(map, i);
+
+      if (item->expires > now
+          && hsk_cache_key_kept(&item->key, keep, keep_len)) {
+        if (item->expires > now + HSK_CACHE_REFRESH_GRACE)
+          item->expires = now + HSK_CACHE_REFRESH_GRACE;
+
+        item->refresh = true;
+        kept += 1;
+        continue;
+      }
+
+      if (item->expires > now)
+        item->expires = now;
+
+      item->refresh = false;
+      expired += 1;
+    }
+
+    uv_rwlock_wrunlock(&shard->lock);
+  }
+
+  uv_rwlock_wrunlock(&c->root_lock);
+
+  if (expired > 0 || kept > 0) {
+    hsk_cache_log(c, "new tree root, expiring %u entries, keeping %u\n",
+                  expired, kept);
+  }
+}
+
+void
+hsk_cache_refreshed(hsk_cache_t *c, const char *tld) {
+  assert(c && tld);
+
+  int64_t now = hsk_now();
+  int s;
+
+  for (s = 0; s < HSK_CACHE_SHARDS; s++) {
+    hsk_cache_shard_t *shard = &c->shards[s];
+    hsk_map_t *map = &shard->map;
+    hsk_map_iter_t i;
+
+    uv_rwlock_wrlock(&shard->lock);
+
+    for (i = hsk_map_begin(map); i != hsk_map_end(map); i++) {
+      if (!hsk_map_exists(map, i))
+        continue;
+
+      hsk_cache_item_t *item = (hsk_cache_item_t *)hsk_map_value(map, i);
+
+      if (!item->refresh || !hsk_cache_key_below(&item->key, tld))
+        continue;
+
+      // The new proof is cached by the pool now,
+      // so the next query rebuilds cheaply.
+      if (item->expires > now)
+        item->expires = now;
+
+      item->refresh = false;
+    }
+
+    uv_rwlock_wrunlock(&shard->lock);
+  }
 }
 
 bool
@@ -78,35 +279,46 @@ hsk_cache_insert_data(
   if (!hsk_cache_key_set(&ck, name, type))
     return false;
 
-  hsk_cache_item_t *cache = hsk_map_get(&c->map, &ck);
+  hsk_cache_item_t *item = hsk_cache_item_alloc();
+
+  if (!item)
+    return false;
+
+  memcpy(&item->key, &ck, sizeof(hsk_cache_key_t));
+
+  item->msg = wire;
+  item->msg_len = wire_len;
+  item->time = hsk_now();
+  item->expires = item->time + HSK_CACHE_TTL;
+
+  hsk_cache_shard_t *shard = hsk_cache_shard(c, &ck);
+
+  uv_rwlock_wrlock(&shard->lock);
+
+  hsk_cache_item_t *cache = hsk_map_get(&shard->map, &ck);
 
   if (cache) {
-    if (hsk_now() < cache->time + 6 * 60 * 60) {
+    if (item->time < cache->expires) {
+      uv_rwlock_wrunlock(&shard->lock);
+      free(item);
       free(wire);
       return true;
     }
 
-    hsk_map_del(&c->map, &ck);
+    hsk_map_del(&shard->map, &ck);
     hsk_cache_item_free(cache);
 
     cache = NULL;
   }
 
-  if (c->map.size >= HSK_CACHE_LIMIT)
-    hsk_cache_prune(c);
-
-  hsk_cache_item_t *item = hsk_cache_item_alloc();
-
-  if (!item)
-    return false;
+  if (shard->map.size >= HSK_CACHE_SHARD_LIMIT)
+    hsk_cache_prune(c, shard);
 
-  memcpy(&item->key, &ck, sizeof(hsk_cache_key_t));
+  bool ok = hsk_map_set(&shard->map, &item->key, item);
 
-  item->msg = wire;
-  item->msg_len = wire_len;
-  item->time = hsk_now();
+  uv_rwlock_wrunlock(&shard->lock);
 
-  if (!hsk_map_set(&c->map, &item->key, item)) {
+  if (!ok) {
     // hsk_cache_insert will free msg on false
     item->msg = NULL;
     free(item);
@@ -139,58 +351,476 @@ hsk_cache_insert(
   return true;
 }
 
-bool
-hsk_cache_get_data(
+// Look up an entry and decode or copy it while
+// the shard is read-locked. Entries past the
+// stale window are removed under a write lock.
+static bool
+hsk_cache_read(
   hsk_cache_t *c,
   const char *name,
+  const hsk_dns_name_info_t *info,
   uint16_t type,
+  bool stale,
   uint8_t **wire,
-  size_t *wire_len
+  size_t *wire_len,
+  hsk_dns_msg_t **msg
 ) {
-  assert(c && name && wire);
-
   hsk_cache_key_t ck;
   hsk_cache_key_init(&ck);
 
-  if (!hsk_cache_key_set(&ck, name, type))
-    return false;
+  if (info) {
+    if (!hsk_cache_key_set2(&ck, name, info, type))
+      return false;
+  } else {
+    if (!hsk_cache_key_set(&ck, name, type))
+      return false;
+  }
 
-  hsk_cache_item_t *cache = hsk_map_get(&c->map, &ck);
+  hsk_cache_shard_t *shard = hsk_cache_shard(c, &ck);
+  int64_t now = hsk_now();
+  bool dead = false;
+  bool ok = false;
 
-  if (!cache)
-    return false;
+  uv_rwlock_rdlock(&shard->lock);
 
-  if (hsk_now() >= cache->time + 6 * 60 * 60) {
-    hsk_map_del(&c->map, &ck);
-    hsk_cache_item_free(cache);
-    return false;
+  hsk_cache_item_t *cache = hsk_map_get(&shard->map, &ck);
+
+  if (cache) {
+    if (now >= cache->expires + c->max_stale) {
+      dead = true;
+    } else if (stale || now < cache->expires) {
+      if (msg) {
+        ok = hsk_dns_msg_decode(cache->msg, cache->msg_len, msg);
+
+        if (!ok)
+          hsk_cache_log(c, "could not deserialize cached item\n");
+      } else if (wire) {
+        *wire = malloc(cache->msg_len);
+
+        if (*wire) {
+          memcpy(*wire, cache->msg, cache->msg_len);
+          *wire_len = cache->msg_len;
+          ok = true;
+        }
+      } else {
+        ok = true;
+      }
+    }
   }
 
-  *wire = cache->msg;
-  *wire_len = cache->msg_len;
+  uv_rwlock_rdunlock(&shard->lock);
 
-  return true;
+  if (dead) {
+    uv_rwlock_wrlock(&shard->lock);
+
+    cache = hsk_map_get(&shard->map, &ck);
+
+    if (cache && now >= cache->expires + c->max_stale) {
+      hsk_map_del(&shard->map, &ck);
+      hsk_cache_item_free(cache);
+    }
+
+    uv_rwlock_wrunlock(&shard->lock);
+  }
+
+  return ok;
+}
+
+bool
+hsk_cache_get_data(
+  hsk_cache_t *c,
+  const char *name,
+  uint16_t type,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(c && name && wire && wire_len);
+  return hsk_cache_read(c, name, NULL, type, false, wire, wire_len, NULL);
 }
 
 hsk_dns_msg_t *
 hsk_cache_get(hsk_cache_t *c, const hsk_dns_req_t *req) {
-  uint8_t *data;
-  size_t data_len;
   hsk_dns_msg_t *msg;
 
-  if (!hsk_cache_get_data(c, req->name, req->type, &data, &data_len))
+  if (!hsk_cache_read(c, req->name, &req->info, req->type,
+                      false, NULL, NULL, &msg)) {
     return NULL;
+  }
 
   hsk_cache_log(c, "cache hit for: %s\n", req->name);
 
-  if (!hsk_dns_msg_decode(data, data_len, &msg)) {
-    hsk_cache_log(c, "could not deserialize cached item\n");
+  return msg;
+}
+
+bool
+hsk_cache_has_stale(hsk_cache_t *c, const hsk_dns_req_t *req) {
+  assert(c && req);
+  return hsk_cache_read(c, req->name, &req->info, req->type,
+                        true, NULL, NULL, NULL);
+}
+
+static void
+hsk_cache_cap_ttl(hsk_dns_rrs_t *rrs) {
+  size_t i;
+
+  for (i = 0; i < rrs->size; i++) {
+    hsk_dns_rr_t *rr = rrs->items[i];
+
+    if (rr->ttl > HSK_CACHE_STALE_TTL)
+      rr->ttl = HSK_CACHE_STALE_TTL;
+  }
+}
+
+hsk_dns_msg_t *
+hsk_cache_get_stale(hsk_cache_t *c, const hsk_dns_req_t *req) {
+  hsk_dns_msg_t *msg;
+
+  assert(c && req);
+
+  if (!hsk_cache_read(c, req->name, &req->info, req->type,
+                      true, NULL, NULL, &msg)) {
     return NULL;
   }
 
+  hsk_cache_log(c, "serving stale data for: %s\n", req->name);
+
+  hsk_cache_cap_ttl(&msg->an);
+  hsk_cache_cap_ttl(&msg->ns);
+  hsk_cache_cap_ttl(&msg->ar);
+
   return msg;
 }
 
+static size_t
+hsk_cache_item_size(const hsk_cache_item_t *item) {
+  return 1 + item->key.name_len + 2 + 1 + 8 + 8 + 2 + item->msg_len;
+}
+
+static bool
+hsk_cache_item_write(const hsk_cache_item_t *item, uint8_t **data) {
+  const hsk_cache_key_t *ck = &item->key;
+
+  if (ck->name_len > HSK_DNS_MAX_NAME || item->msg_len > 0xffff)
+    return false;
+
+  write_u8(data, (uint8_t)ck->name_len);
+  write_bytes(data, ck->name, ck->name_len);
+  write_u16be(data, ck->type);
+  write_u8(data, ck->ref ? 1 : 0);
+  write_i64be(data, item->time);
+  write_i64be(data, item->expires);
+  write_u16be(data, (uint16_t)item->msg_len);
+  write_bytes(data, item->msg, item->msg_len);
+
+  return true;
+}
+
+static bool
+hsk_cache_item_read(uint8_t **data, size_t *len, hsk_cache_item_t *item) {
+  hsk_cache_key_t *ck = &item->key;
+  uint8_t name_len, ref;
+  uint16_t msg_len;
+
+  if (!read_u8(data, len, &name_len))
+    return false;
+
+  if (name_len > HSK_DNS_MAX_NAME)
+    return false;
+
+  if (!read_bytes(data, len, ck->name, name_len))
+    return false;
+
+  ck->name[name_len] = 0x00;
+  ck->name_len = name_len;
+
+  if (!read_u16be(data, len, &ck->type))
+    return false;
+
+  if (!read_u8(data, len, &ref))
+    return false;
+
+  ck->ref = ref != 0;
+
+  if (!read_i64be(data, len, &item->time))
+    return false;
+
+  if (!read_i64be(data, len, &item->expires))
+    return false;
+
+  if (!read_u16be(data, len, &msg_len))
+    return false;
+
+  if (*len < msg_len)
+    return false;
+
+  item->msg = malloc(msg_len);
+
+  if (!item->msg)
+    return false;
+
+  if (!read_bytes(data, len, item->msg, msg_len)) {
+    free(item->msg);
+    item->msg = NULL;
+    return false;
+  }
+
+  item->msg_len = msg_len;
+
+  return true;
+}
+
+static bool
+hsk_cache_serialize(
+  hsk_cache_t *c,
+  uint8_t **out,
+  size_t *out_len,
+  uint32_t *out_count
+) {
+  uint8_t *buf = NULL;
+  size_t size = 4 + 1 + 32 + 4;
+  uint32_t count = 0;
+  int64_t now = hsk_now();
+  int s;
+
+  // Lock every shard so the snapshot is consistent
+  // with the root it is tagged with.
+  uv_rwlock_rdlock(&c->root_lock);
+
+  for (s = 0; s < HSK_CACHE_SHARDS; s++)
+    uv_rwlock_rdlock(&c->shards[s].lock);
+
+  for (s = 0; s < HSK_CACHE_SHARDS; s++) {
+    hsk_map_t *map = &c->shards[s].map;
+    hsk_map_iter_t i;
+
+    for (i = hsk_map_begin(map); i != hsk_map_end(map); i++) {
+      if (!hsk_map_exists(map, i))
+        continue;
+
+      hsk_cache_item_t *item = (hsk_cache_item_t *)hsk_map_value(map, i);
+
+      if (now >= item->expires + c->max_stale)
+        continue;
+
+      size += hsk_cache_item_size(item);
+    }
+  }
+
+  buf = malloc(size);
+
+  if (buf) {
+    uint8_t *data = buf;
+
+    write_u32be(&data, HSK_MAGIC);
+    write_u8(&data, HSK_CACHE_FILE_VERSION);
+    write_bytes(&data, c->root, 32);
+
+    uint8_t *count_pos = data;
+    write_u32be(&data, 0);
+
+    for (s = 0; s < HSK_CACHE_SHARDS; s++) {
+      hsk_map_t *map = &c->shards[s].map;
+      hsk_map_iter_t i;
+
+      for (i = hsk_map_begin(map); i != hsk_map_end(map); i++) {
+        if (!hsk_map_exists(map, i))
+          continue;
+
+        hsk_cache_item_t *item = (hsk_cache_item_t *)hsk_map_value(map, i);
+
+        if (now >= item->expires + c->max_stale)
+          continue;
+
+        if (hsk_cache_item_write(item, &data))
+          count += 1;
+      }
+    }
+
+    write_u32be(&count_pos, count);
+    size = data - buf;
+  }
+
+  for (s = 0; s < HSK_CACHE_SHARDS; s++)
+    uv_rwlock_rdunlock(&c->shards[s].lock);
+
+  uv_rwlock_rdunlock(&c->root_lock);
+
+  if (!buf)
+    return false;
+
+  *out = buf;
+  *out_len = size;
+  *out_count = count;
+
+  return true;
+}
+
+static void
+hsk_cache_after_write(hsk_store_file_t *file, const char *step, int status) {
+  hsk_cache_write_t *w = (hsk_cache_write_t *)file->arg;
+
+  if (status < 0) {
+    hsk_cache_log(w->cache, "could not %s cache file: %s (%s)\n",
+                  step, w->tmp, uv_strerror(status));
+  } else {
+    hsk_cache_log(w->cache, "wrote %u entries to: %s\n", w->count, w->path);
+  }
+
+  if (w->cache)
+    w->cache->writing = NULL;
+
+  free(w->data);
+  free(w);
+}
+
+bool
+hsk_cache_write_file(hsk_cache_t *c, uv_loop_t *loop, const char *path) {
+  assert(c && loop && path);
+
+  if (c->writing) {
+    hsk_cache_log(c, "cache write still in progress, skipping\n");
+    return false;
+  }
+
+  if (strlen(path) >= HSK_STORE_PATH_MAX)
+    return false;
+
+  hsk_cache_write_t *w = malloc(sizeof(hsk_cache_write_t));
+
+  if (!w)
+    return false;
+
+  size_t size;
+
+  if (!hsk_cache_serialize(c, &w->data, &size, &w->count)) {
+    free(w);
+    return false;
+  }
+
+  w->cache = c;
+  strcpy(w->path, path);
+  sprintf(w->tmp, "%s~", path);
+
+  int rc = hsk_store_file_write(loop, &w->file, w->data, size,
+                                w->tmp, w->path,
+                                hsk_cache_after_write, (void *)w);
+
+  if (rc != 0) {
+    hsk_cache_log(c, "could not open cache file: %s (%s)\n",
+                  w->tmp, uv_strerror(rc));
+    free(w->data);
+    free(w);
+    return false;
+  }
+
+  c->writing = w;
+
+  return true;
+}
+
+bool
+hsk_cache_read_file(hsk_cache_t *c, const char *path) {
+  assert(c && path);
+
+  FILE *file = fopen(path, "rb");
+
+  if (!file)
+    return false;
+
+  uint8_t *buf = NULL;
+  long size = -1;
+
+  if (fseek(file, 0, SEEK_END) == 0)
+    size = ftell(file);
+
+  if (size < 0 || size > HSK_CACHE_FILE_MAX || fseek(file, 0, SEEK_SET) != 0) {
+    fclose(file);
+    return false;
+  }
+
+  buf = malloc(size);
+
+  if (!buf || fread(buf, 1, size, file) != (size_t)size) {
+    hsk_cache_log(c, "could not read cache file: %s\n", path);
+    fclose(file);
+    free(buf);
+    return false;
+  }
+
+  fclose(file);
+
+  uint8_t *data = buf;
+  size_t len = (size_t)size;
+  uint32_t magic, count;
+  uint8_t version;
+  uint8_t root[32];
+
+  if (!read_u32be(&data, &len, &magic)
+      || magic != HSK_MAGIC
+      || !read_u8(&data, &len, &version)
+      || version != HSK_CACHE_FILE_VERSION
+      || !read_bytes(&data, &len, root, 32)
+      || !read_u32be(&data, &len, &count)) {
+    hsk_cache_log(c, "invalid cache file: %s\n", path);
+    free(buf);
+    return false;
+  }
+
+  int64_t now = hsk_now();
+  uint32_t loaded = 0;
+  uint32_t i;
+
+  // Entries stay fresh only if the tree root is
+  // unchanged once the chain is synced again, see
+  // hsk_cache_set_root.
+  uv_rwlock_wrlock(&c->root_lock);
+  memcpy(c->root, root, 32);
+  uv_rwlock_wrunlock(&c->root_lock);
+
+  for (i = 0; i < count; i++) {
+    hsk_cache_item_t *item = hsk_cache_item_alloc();
+
+    if (!item)
+      break;
+
+    if (!hsk_cache_item_read(&data, &len, item)) {
+      hsk_cache_log(c, "truncated cache file: %s\n", path);
+      hsk_cache_item_free(item);
+      break;
+    }
+
+    if (now >= item->expires + c->max_stale) {
+      hsk_cache_item_free(item);
+      continue;
+    }
+
+    hsk_cache_shard_t *shard = hsk_cache_shard(c, &item->key);
+    bool ok = false;
+
+    uv_rwlock_wrlock(&shard->lock);
+
+    if (shard->map.size < HSK_CACHE_SHARD_LIMIT
+        && !hsk_map_has(&shard->map, &item->key)) {
+      ok = hsk_map_set(&shard->map, &item->key, item);
+    }
+
+    uv_rwlock_wrunlock(&shard->lock);
+
+    if (!ok) {
+      hsk_cache_item_free(item);
+      continue;
+    }
+
+    loaded += 1;
+  }
+
+  free(buf);
+
+  hsk_cache_log(c, "loaded %u entries from: %s\n", loaded, path);
+
+  return true;
+}
+
 void
 hsk_cache_key_init(hsk_cache_key_t *ck) {
   assert(ck);
@@ -259,13 +889,28 @@ bool
 hsk_cache_key_set(hsk_cache_key_t *ck, const char *name, uint16_t type) {
   assert(ck);
 
-  if (!hsk_dns_name_verify(name))
+  hsk_dns_name_info_t info;
+  hsk_dns_name_analyze(name, &info);
+
+  return hsk_cache_key_set2(ck, name, &info, type);
+}
+
+bool
+hsk_cache_key_set2(
+  hsk_cache_key_t *ck,
+  const char *name,
+  const hsk_dns_name_info_t *info,
+  uint16_t type
+) {
+  assert(ck && info);
+
+  if (!info->valid)
     return false;
 
-  if (hsk_dns_name_dirty(name))
+  if (info->last_dirty != -1)
     return false;
 
-  int labels = hsk_dns_label_count(name);
+  int labels = info->count;
   bool ref = false;
 
   switch (labels) {
@@ -279,19 +924,20 @@ hsk_cache_key_set(hsk_cache_key_t *ck, const char *name, uint16_t type) {
     case 3:
       switch (type) {
         case HSK_DNS_SRV: {
-          ref = !hsk_dns_label_is_srv(name);
+          ref = !hsk_dns_label_is_srv2(name, info->labels, info->count);
           break;
         }
         case HSK_DNS_TLSA: {
-          ref = !hsk_dns_label_is_tlsa(name);
+          ref = !hsk_dns_label_is_tlsa2(name, info->labels, info->count);
           break;
         }
         case HSK_DNS_SMIMEA: {
-          ref = !hsk_dns_label_is_smimea(name);
+          ref = !hsk_dns_label_is_smimea2(name, info->labels, info->count);
           break;
         }
         case HSK_DNS_OPENPGPKEY: {
-          ref = !hsk_dns_label_is_openpgpkey(name);
+          ref = !hsk_dns_label_is_openpgpkey2(name, info->labels,
+                                              info->count);
           break;
         }
         default: {
@@ -308,8 +954,8 @@ hsk_cache_key_set(hsk_cache_key_t *ck, const char *name, uint16_t type) {
   if (ref)
     labels = 1;
 
-  ck->name_len = hsk_dns_label_from(name, -labels, (char *)ck->name);
-  hsk_to_lower((char *)ck->name);
+  ck->name_len = hsk_dns_label_from2(info->lower, info->labels, info->count,
+                                     -labels, (char *)ck->name);
   ck->ref = ref;
   ck->type = type;
 
@@ -323,6 +969,8 @@ hsk_cache_item_init(hsk_cache_item_t *ci) {
   ci->msg = NULL;
   ci->msg_len = 0;
   ci->time = 0;
+  ci->expires = 0;
+  ci->refresh = false;
 }
 
 void
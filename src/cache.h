@@ -8,11 +8,69 @@
 #include "dns.h"
 #include "map.h"
 #include "req.h"
+#include "store.h"
+#include "uv.h"
 
 #define HSK_CACHE_LIMIT 2000
 
-typedef struct hsk_cache_s {
+// Entries are spread over shards with their own
+// lock, so resolver threads only contend when they
+// touch the same slice of the key space.
+#define HSK_CACHE_SHARD_BITS 4
+#define HSK_CACHE_SHARDS (1 << HSK_CACHE_SHARD_BITS)
+#define HSK_CACHE_SHARD_LIMIT (HSK_CACHE_LIMIT / HSK_CACHE_SHARDS)
+#define HSK_CACHE_TTL (6 * 60 * 60)
+
+// Serve-stale (RFC 8767): expired answers are
+// kept for up to max-stale seconds and handed
+// out with a short TTL when resolution fails.
+#define HSK_CACHE_MAX_STALE (24 * 60 * 60)
+#define HSK_CACHE_STALE_TTL 30
+
+// Seconds answers for refreshed TLDs stay fresh
+// after a root change while their proofs land.
+#define HSK_CACHE_REFRESH_GRACE 60
+
+// Version 0 cache file serialization:
+// Size    Data
+//  4       network magic
+//  1       version (0)
+//  32      tree root the entries were built from
+//  4       entry count
+// Then per entry:
+//  1       name length
+//  n       name
+//  2       type
+//  1       referral flag
+//  8       insert time
+//  8       expiry time
+//  2       wire length
+//  n       wire message
+
+#define HSK_CACHE_FILE_VERSION 0
+#define HSK_CACHE_FILE_MAX (16 << 20)
+
+typedef struct hsk_cache_shard_s {
+  uv_rwlock_t lock;
   hsk_map_t map;
+} hsk_cache_shard_t;
+
+// In-flight asynchronous snapshot write.
+typedef struct hsk_cache_write_s {
+  hsk_store_file_t file;
+  struct hsk_cache_s *cache;
+  uint8_t *data;
+  uint32_t count;
+  char tmp[HSK_STORE_PATH_MAX + 1];
+  char path[HSK_STORE_PATH_MAX];
+} hsk_cache_write_t;
+
+typedef struct hsk_cache_s {
+  hsk_cache_shard_t shards[HSK_CACHE_SHARDS];
+  uv_rwlock_t root_lock;
+  uint8_t root[32];
+  int64_t max_stale;
+  hsk_cache_write_t *writing;
 } hsk_cache_t;
 
 typedef struct hsk_cache_key_s {
@@ -27,6 +85,8 @@ typedef struct hsk_cache_item_s {
   uint8_t *msg;
   size_t msg_len;
   int64_t time;
+  int64_t expires;
+  bool refresh;
 } hsk_cache_item_t;
 
 void
@@ -41,6 +101,19 @@ hsk_cache_alloc(void);
 void
 hsk_cache_free(hsk_cache_t *c);
 
+// Answers below the `keep` TLDs stay fresh until
+// hsk_cache_refreshed is called for them.
+void
+hsk_cache_set_root(
+  hsk_cache_t *c,
+  const uint8_t *root,
+  const char **keep,
+  int keep_len
+);
+
+void
+hsk_cache_refreshed(hsk_cache_t *c, const char *tld);
+
 bool
 hsk_cache_insert_data(
   hsk_cache_t *c,
@@ -57,6 +130,7 @@ hsk_cache_insert(
   const hsk_dns_msg_t *msg
 );
 
+// Copies the cached wire, caller frees.
 bool
 hsk_cache_get_data(
   hsk_cache_t *c,
@@ -69,6 +143,21 @@ hsk_cache_get_data(
 hsk_dns_msg_t *
 hsk_cache_get(hsk_cache_t *c, const hsk_dns_req_t *req);
 
+bool
+hsk_cache_has_stale(hsk_cache_t *c, const hsk_dns_req_t *req);
+
+hsk_dns_msg_t *
+hsk_cache_get_stale(hsk_cache_t *c, const hsk_dns_req_t *req);
+
+// Snapshots the cache and writes it out on the
+// loop's thread pool. Skipped while a previous
+// snapshot is still being written.
+bool
+hsk_cache_write_file(hsk_cache_t *c, uv_loop_t *loop, const char *path);
+
+bool
+hsk_cache_read_file(hsk_cache_t *c, const char *path);
+
 void
 hsk_cache_key_init(hsk_cache_key_t *ck);
 
@@ -90,6 +179,14 @@ hsk_cache_key_equal(const void *a, const void *b);
 bool
 hsk_cache_key_set(hsk_cache_key_t *ck, const char *name, uint16_t type);
 
+bool
+hsk_cache_key_set2(
+  hsk_cache_key_t *ck,
+  const char *name,
+  const hsk_dns_name_info_t *info,
+  uint16_t type
+);
+
 void
 hsk_cache_item_init(hsk_cache_item_t *ci);
 
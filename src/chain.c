@@ -17,6 +17,7 @@
 #include "msg.h"
 #include "store.h"
 #include "timedata.h"
+#include "u256.h"
 #include "utils.h"
 
 /*
@@ -39,6 +40,12 @@ hsk_chain_maybe_sync(hsk_chain_t *chain);
 static void
 hsk_chain_checkpoint_flush(hsk_chain_t *chain);
 
+static void
+hsk_chain_mtp_reset(hsk_chain_t *chain, hsk_header_t *hdr);
+
+static void
+hsk_chain_mtp_push(hsk_chain_t *chain, hsk_header_t *hdr);
+
 /*
  * Helpers
  */
@@ -83,12 +90,20 @@ hsk_chain_init(hsk_chain_t *chain, const hsk_timedata_t *td) {
   chain->synced = false;
   chain->td = (hsk_timedata_t *)td;
   chain->prefix = NULL;
+  chain->log = NULL;
+  chain->loop = NULL;
+  chain->checkpoint = NULL;
+  memset(chain->safe_root, 0x00, 32);
+  chain->root_cb = NULL;
+  chain->root_arg = NULL;
 
   hsk_map_init_hash_map(&chain->hashes, free);
   hsk_map_init_int_map(&chain->heights, NULL);
   hsk_map_init_hash_map(&chain->orphans, free);
   hsk_map_init_hash_map(&chain->prevs, NULL);
 
+  memset(chain->targets, 0, sizeof(chain->targets));
+
   return hsk_chain_init_genesis(chain);
 }
 
@@ -123,6 +138,8 @@ hsk_chain_init_genesis(hsk_chain_t *chain) {
   chain->tip = tip;
   chain->genesis = tip;
 
+  hsk_chain_mtp_reset(chain, tip);
+
   hsk_chain_maybe_sync(chain);
 
   return HSK_SUCCESS;
@@ -133,6 +150,12 @@ hsk_chain_uninit(hsk_chain_t *chain) {
   if (!chain)
     return;
 
+  if (chain->log)
+    hsk_store_log_close(chain);
+
+  if (chain->checkpoint)
+    hsk_store_write_detach(chain);
+
   hsk_map_uninit(&chain->heights);
   hsk_map_uninit(&chain->hashes);
   hsk_map_uninit(&chain->prevs);
@@ -166,6 +189,42 @@ hsk_chain_get_by_height(const hsk_chain_t *chain, uint32_t height) {
   return hsk_map_get(&chain->heights, &height);
 }
 
+bool
+hsk_chain_read_by_height(
+  const hsk_chain_t *chain,
+  uint32_t height,
+  hsk_header_t *hdr
+) {
+  hsk_header_t *entry = hsk_map_get(&chain->heights, &height);
+
+  if (entry) {
+    memcpy(hdr, entry, sizeof(hsk_header_t));
+    hdr->next = NULL;
+    return true;
+  }
+
+  // Old headers may only exist in the header log.
+  if (chain->log)
+    return hsk_store_log_read(chain->log, height, hdr);
+
+  return false;
+}
+
+bool
+hsk_chain_evict(hsk_chain_t *chain, uint32_t height) {
+  hsk_header_t *hdr = hsk_map_get(&chain->heights, &height);
+
+  if (!hdr || hdr == chain->genesis || hdr == chain->tip)
+    return false;
+
+  hsk_map_del(&chain->heights, &height);
+  hsk_map_del(&chain->hashes, hdr->hash);
+
+  free(hdr);
+
+  return true;
+}
+
 bool
 hsk_chain_has_orphan(const hsk_chain_t *chain, const uint8_t *hash) {
   return hsk_map_has(&chain->orphans, hash);
@@ -317,20 +376,84 @@ hsk_chain_get_locator(const hsk_chain_t *chain, hsk_getheaders_msg_t *msg) {
     if (i == sizeof(msg->hashes) - 1)
       height = 0;
 
-    hsk_header_t *hdr = hsk_chain_get_by_height(chain, (uint32_t)height);
+    hsk_header_t hdr;
 
     // Due to checkpoint initialization
     // we may not have any headers from here
     // down to genesis
-    if (!hdr)
+    if (!hsk_chain_read_by_height(chain, (uint32_t)height, &hdr))
       continue;
 
-    hsk_header_hash(hdr, msg->hashes[i++]);
+    hsk_header_hash(&hdr, msg->hashes[i++]);
   }
 
   msg->hash_count = i;
 }
 
+static void
+hsk_chain_mtp_push(hsk_chain_t *chain, hsk_header_t *hdr) {
+  assert(chain && hdr);
+
+  hsk_chain_mtp_t *mtp = &chain->mtp;
+  int64_t time = (int64_t)hdr->time;
+  size_t i;
+
+  // Window is full: drop the oldest timestamp
+  // from the sorted array before overwriting it.
+  if (mtp->size == HSK_CHAIN_MTP_SPAN) {
+    int64_t old = mtp->times[mtp->pos];
+
+    for (i = 0; i < mtp->size; i++) {
+      if (mtp->sorted[i] == old)
+        break;
+    }
+
+    assert(i < mtp->size);
+
+    memmove(&mtp->sorted[i], &mtp->sorted[i + 1],
+            (mtp->size - i - 1) * sizeof(int64_t));
+
+    mtp->size -= 1;
+  }
+
+  mtp->times[mtp->pos] = time;
+  mtp->pos = (mtp->pos + 1) % HSK_CHAIN_MTP_SPAN;
+
+  // Insertion into the small sorted array.
+  i = mtp->size;
+
+  while (i > 0 && mtp->sorted[i - 1] > time) {
+    mtp->sorted[i] = mtp->sorted[i - 1];
+    i -= 1;
+  }
+
+  mtp->sorted[i] = time;
+  mtp->size += 1;
+
+  memcpy(mtp->hash, hsk_header_cache(hdr), 32);
+}
+
+static void
+hsk_chain_mtp_reset(hsk_chain_t *chain, hsk_header_t *hdr) {
+  assert(chain && hdr);
+
+  hsk_header_t *window[HSK_CHAIN_MTP_SPAN];
+  int size = 0;
+
+  // Headers below a checkpoint are not stored,
+  // so the window may be shorter than the span.
+  while (hdr && size < HSK_CHAIN_MTP_SPAN) {
+    window[size++] = hdr;
+    hdr = hsk_map_get(&chain->hashes, hdr->prev_block);
+  }
+
+  chain->mtp.pos = 0;
+  chain->mtp.size = 0;
+
+  while (size > 0)
+    hsk_chain_mtp_push(chain, window[--size]);
+}
+
 static int64_t
 hsk_chain_get_mtp(const hsk_chain_t *chain, const hsk_header_t *prev) {
   assert(chain);
@@ -338,8 +461,15 @@ hsk_chain_get_mtp(const hsk_chain_t *chain, const hsk_header_t *prev) {
   if (!prev)
     return 0;
 
-  int timespan = 11;
-  int64_t median[11];
+  // Fast path: extending the main chain.
+  if (chain->mtp.size > 0
+      && prev->cache
+      && memcmp(prev->hash, chain->mtp.hash, 32) == 0) {
+    return chain->mtp.sorted[chain->mtp.size >> 1];
+  }
+
+  int timespan = HSK_CHAIN_MTP_SPAN;
+  int64_t median[HSK_CHAIN_MTP_SPAN];
   size_t size = 0;
   int i;
 
@@ -384,12 +514,13 @@ hsk_chain_suitable_block(const hsk_chain_t *chain, const hsk_header_t *prev) {
   return y;
 }
 
-static uint32_t
-hsk_chain_retarget(const hsk_chain_t *chain,
-                   const hsk_header_t *first,
-                   const hsk_header_t *last) {
-  assert(chain && first && last);
-  assert(last->height >= first->height);
+uint32_t
+hsk_chain_retarget_work_bn(
+  const uint8_t *first_work,
+  const uint8_t *last_work,
+  int64_t actual
+) {
+  assert(first_work && last_work);
 
   uint8_t *limit = (uint8_t *)HSK_LIMIT;
 
@@ -403,16 +534,14 @@ hsk_chain_retarget(const hsk_chain_t *chain,
   uint8_t target[32];
   uint32_t cmpct;
 
-  hsk_bn_from_array(&target_bn, first->work, 32);
-  hsk_bn_from_array(&last_bn, last->work, 32);
+  hsk_bn_from_array(&target_bn, first_work, 32);
+  hsk_bn_from_array(&last_bn, last_work, 32);
 
   hsk_bn_from_int(&spacing_bn, (uint64_t)HSK_TARGET_SPACING);
 
   hsk_bn_sub(&last_bn, &target_bn, &target_bn);
   hsk_bn_mul(&target_bn, &spacing_bn, &target_bn);
 
-  int64_t actual = last->time - first->time;
-
   if (actual < HSK_MIN_ACTUAL)
     actual = HSK_MIN_ACTUAL;
 
@@ -447,9 +576,94 @@ hsk_chain_retarget(const hsk_chain_t *chain,
   return cmpct;
 }
 
+uint32_t
+hsk_chain_retarget_work(
+  const uint8_t *first_work,
+  const uint8_t *last_work,
+  int64_t actual
+) {
+  assert(first_work && last_work);
+
+  hsk_u256_t target;
+  hsk_u256_t last;
+  hsk_u256_t limit;
+
+  uint8_t raw[32];
+  uint32_t cmpct;
+
+  hsk_u256_from_array(&target, first_work);
+  hsk_u256_from_array(&last, last_work);
+
+  hsk_u256_sub(&last, &target, &target);
+
+  if (actual < HSK_MIN_ACTUAL)
+    actual = HSK_MIN_ACTUAL;
+
+  if (actual > HSK_MAX_ACTUAL)
+    actual = HSK_MAX_ACTUAL;
+
+  // (last - first) * spacing / actual
+  if (!hsk_u256_muldiv(&target,
+                       (uint32_t)HSK_TARGET_SPACING,
+                       (uint32_t)actual,
+                       &target)) {
+    return HSK_BITS;
+  }
+
+  if (hsk_u256_is_zero(&target))
+    return HSK_BITS;
+
+  // 2^256 / target - 1
+  if (!hsk_u256_inverse(&target, &target))
+    return HSK_BITS;
+
+  hsk_u256_from_array(&limit, HSK_LIMIT);
+
+  if (hsk_u256_cmp(&target, &limit) > 0)
+    return HSK_BITS;
+
+  hsk_u256_to_array(&target, raw);
+
+  assert(hsk_pow_to_bits(raw, &cmpct));
+
+  return cmpct;
+}
+
+static uint32_t
+hsk_chain_retarget(hsk_chain_t *chain,
+                   hsk_header_t *first,
+                   hsk_header_t *last) {
+  assert(chain && first && last);
+  assert(last->height >= first->height);
+
+  const uint8_t *first_hash = hsk_header_cache(first);
+  const uint8_t *last_hash = hsk_header_cache(last);
+
+  // Median-of-three selection often picks the same
+  // pair for consecutive heights and for competing
+  // branches, so remember recent results.
+  size_t index = (first_hash[0] ^ last_hash[0]) % HSK_CHAIN_TARGET_MEMO;
+  hsk_chain_target_t *memo = &chain->targets[index];
+
+  if (memo->bits != 0
+      && memcmp(memo->first, first_hash, 32) == 0
+      && memcmp(memo->last, last_hash, 32) == 0) {
+    return memo->bits;
+  }
+
+  int64_t actual = last->time - first->time;
+  uint32_t bits = hsk_chain_retarget_work(first->work, last->work, actual);
+
+  memcpy(memo->first, first_hash, 32);
+  memcpy(memo->last, last_hash, 32);
+  memo->bits = bits;
+
+  return bits;
+}
+
 static uint32_t
 hsk_chain_get_target(
-  const hsk_chain_t *chain,
+  hsk_chain_t *chain,
   int64_t time,
   const hsk_header_t *prev
 ) {
@@ -571,6 +785,19 @@ hsk_chain_reorganize(hsk_chain_t *chain, hsk_header_t *competitor) {
 
     assert(hsk_map_set(&chain->heights, &c->height, (void *)c));
   }
+
+  // Rebuild the timestamp window on the new
+  // branch, the competitor itself is pushed
+  // when it is saved as the new tip.
+  hsk_header_t *prev = hsk_map_get(&chain->hashes, competitor->prev_block);
+  assert(prev);
+
+  hsk_chain_mtp_reset(chain, prev);
+
+  // Drop the disconnected headers from the log,
+  // the new branch is appended with the tip.
+  if (chain->log)
+    hsk_store_log_truncate(chain, fork->height + 1);
 }
 
 int
@@ -724,7 +951,7 @@ hsk_chain_insert(
 }
 
 int
-hsk_chain_save(
+hsk_chain_restore(
   hsk_chain_t *chain,
   hsk_header_t *hdr
 ) {
@@ -741,14 +968,53 @@ hsk_chain_save(
     chain->height = hdr->height;
     chain->tip = hdr;
 
+    // Update the median-time-past window
+    if (chain->mtp.size > 0
+        && memcmp(hdr->prev_block, chain->mtp.hash, 32) == 0) {
+      hsk_chain_mtp_push(chain, hdr);
+    } else {
+      hsk_chain_mtp_reset(chain, hdr);
+    }
+
+    hsk_chain_maybe_sync(chain);
+
+    return HSK_SUCCESS;
+}
+
+int
+hsk_chain_save(
+  hsk_chain_t *chain,
+  hsk_header_t *hdr
+) {
+    int rc = hsk_chain_restore(chain, hdr);
+
+    if (rc != HSK_SUCCESS)
+      return rc;
+
     hsk_chain_log(chain, "  added to main chain\n");
     hsk_chain_log(chain, "  new height: %u\n", (uint32_t)chain->height);
 
-    hsk_chain_maybe_sync(chain);
+    // Append to the header log
+    if (chain->log)
+      hsk_store_log_append(chain, hdr);
 
     // Save batch of headers to disk
     if (chain->height % HSK_STORE_CHECKPOINT_WINDOW == 0)
       hsk_chain_checkpoint_flush(chain);
 
+    // Notify listeners of a new tree root
+    if (chain->synced) {
+      const uint8_t *root = hsk_chain_safe_root(chain);
+
+      if (memcmp(root, chain->safe_root, 32) != 0) {
+        memcpy(chain->safe_root, root, 32);
+
+        hsk_chain_log(chain, "  new safe root: %s\n", hsk_hex_encode32(root));
+
+        if (chain->root_cb)
+          chain->root_cb(chain->safe_root, chain->root_arg);
+      }
+    }
+
     return HSK_SUCCESS;
 }
@@ -8,11 +8,46 @@
 #include "map.h"
 #include "header.h"
 #include "timedata.h"
+#include "uv.h"
+
+/*
+ * Defs
+ */
+
+#define HSK_CHAIN_MTP_SPAN 11
+#define HSK_CHAIN_TARGET_MEMO 16
 
 /*
  * Types
  */
 
+// Rolling window of the last 11 main chain
+// timestamps, ending at the header `hash`.
+// `times` is a ring in chain order, `sorted`
+// is kept in ascending order for the median.
+typedef struct hsk_chain_mtp_s {
+  int64_t times[HSK_CHAIN_MTP_SPAN];
+  int64_t sorted[HSK_CHAIN_MTP_SPAN];
+  size_t pos;
+  size_t size;
+  uint8_t hash[32];
+} hsk_chain_mtp_t;
+
+// Retarget result for a (first, last) pair of
+// median blocks. A zero `bits` marks an empty slot.
+typedef struct hsk_chain_target_s {
+  uint8_t first[32];
+  uint8_t last[32];
+  uint32_t bits;
+} hsk_chain_target_t;
+
+struct hsk_store_log_s;
+struct hsk_store_write_s;
+
+// Called once the chain is synced whenever
+// the safe name tree root moves.
+typedef void (*hsk_chain_root_cb)(const uint8_t *root, void *arg);
+
 typedef struct hsk_chain_s {
   int64_t height;
   uint32_t init_height;
@@ -24,7 +59,15 @@ typedef struct hsk_chain_s {
   hsk_map_t heights;
   hsk_map_t orphans;
   hsk_map_t prevs;
+  hsk_chain_mtp_t mtp;
+  hsk_chain_target_t targets[HSK_CHAIN_TARGET_MEMO];
   char *prefix;
+  struct hsk_store_log_s *log;
+  uv_loop_t *loop;
+  struct hsk_store_write_s *checkpoint;
+  uint8_t safe_root[32];
+  hsk_chain_root_cb root_cb;
+  void *root_arg;
 } hsk_chain_t;
 
 /*
@@ -46,9 +89,22 @@ hsk_chain_has(const hsk_chain_t *chain, const uint8_t *hash);
 hsk_header_t *
 hsk_chain_get(const hsk_chain_t *chain, const uint8_t *hash);
 
+// Main chain headers kept in memory.
 hsk_header_t *
 hsk_chain_get_by_height(const hsk_chain_t *chain, uint32_t height);
 
+// Copies the main chain header at `height`, reading
+// it from the header log if it has been evicted.
+bool
+hsk_chain_read_by_height(
+  const hsk_chain_t *chain,
+  uint32_t height,
+  hsk_header_t *hdr
+);
+
+bool
+hsk_chain_evict(hsk_chain_t *chain, uint32_t height);
+
 bool
 hsk_chain_has_orphan(const hsk_chain_t *chain, const uint8_t *hash);
 
@@ -74,6 +130,26 @@ hsk_chain_synced(const hsk_chain_t *chain);
 int
 hsk_chain_add(hsk_chain_t *chain, const hsk_header_t *h);
 
+uint32_t
+hsk_chain_retarget_work(
+  const uint8_t *first_work,
+  const uint8_t *last_work,
+  int64_t actual
+);
+
+uint32_t
+hsk_chain_retarget_work_bn(
+  const uint8_t *first_work,
+  const uint8_t *last_work,
+  int64_t actual
+);
+
+int
+hsk_chain_restore(
+  hsk_chain_t *chain,
+  hsk_header_t *hdr
+);
+
 int
 hsk_chain_save(
   hsk_chain_t *chain,
@@ -18,6 +18,7 @@
 #define HSK_USER_AGENT "/"PACKAGE_NAME":"PACKAGE_VERSION"/"
 #define HSK_PROTO_VERSION 1
 #define HSK_SERVICES 0
+#define HSK_SERVICE_MULTIPROOF (1 << 8)
 #define HSK_MAX_DATA_SIZE 668
 #define HSK_MAX_VALUE_SIZE 512
 
@@ -40,6 +40,7 @@ typedef struct hsk_options_s {
   char *user_agent;
   bool checkpoint;
   char *prefix;
+  int64_t max_stale;
 } hsk_options_t;
 
 static void
@@ -59,6 +60,7 @@ hsk_options_init(hsk_options_t *opt) {
   opt->user_agent = NULL;
   opt->checkpoint = false;
   opt->prefix = NULL;
+  opt->max_stale = HSK_CACHE_MAX_STALE;
 }
 
 static void
@@ -193,6 +195,10 @@ help(int r) {
     "  -x, --prefix <directory name>\n"
     "    Write/read state to/from disk in given directory.\n"
     "\n"
+    "  -m, --max-stale <seconds>\n"
+    "    Serve expired root zone answers for this long when\n"
+    "    no proof can be obtained (default: 86400, 0 disables).\n"
+    "\n"
 #ifndef _WIN32
     "  -d, --daemon\n"
     "    Fork and background the process.\n"
@@ -208,7 +214,7 @@ help(int r) {
 
 static void
 parse_arg(int argc, char **argv, hsk_options_t *opt) {
-  const static char *optstring = "hvtc:n:r:i:u:p:k:s:l:h:a:x:"
+  const static char *optstring = "hvtc:n:r:i:u:p:k:s:l:h:a:x:m:"
 
 #ifndef _WIN32
     "d"
@@ -229,6 +235,7 @@ parse_arg(int argc, char **argv, hsk_options_t *opt) {
     { "user-agent", required_argument, NULL, 'a' },
     { "checkpoint", no_argument, NULL, 't' },
     { "prefix", required_argument, NULL, 'x' },
+    { "max-stale", required_argument, NULL, 'm' },
 #ifndef _WIN32
     { "daemon", no_argument, NULL, 'd' },
 #endif
@@ -393,6 +400,20 @@ parse_arg(int argc, char **argv, hsk_options_t *opt) {
         break;
       }
 
+      case 'm': {
+        if (!optarg || strlen(optarg) == 0)
+          return help(1);
+
+        int max_stale = atoi(optarg);
+
+        if (max_stale < 0)
+          return help(1);
+
+        opt->max_stale = max_stale;
+
+        break;
+      }
+
       case 't': {
 
         opt->checkpoint = true;
@@ -551,6 +572,12 @@ hsk_daemon_init(hsk_daemon_t *daemon, uv_loop_t *loop, hsk_options_t *opt) {
     }
   }
 
+  if (!hsk_ns_set_max_stale(daemon->ns, opt->max_stale)) {
+    fprintf(stderr, "failed setting max stale\n");
+    rc = HSK_EFAILURE;
+    goto fail;
+  }
+
   daemon->rs = hsk_rs_alloc(loop, opt->ns_host);
 
   if (!daemon->rs) {
@@ -635,6 +662,7 @@ hsk_daemon_open(hsk_daemon_t *daemon, hsk_options_t *opt) {
     }
 
     daemon->pool->chain.prefix = opt->prefix;
+    daemon->ns->prefix = opt->prefix;
 
     // Read the checkpoint from file
     uint8_t data[HSK_STORE_CHECKPOINT_SIZE];
@@ -650,6 +678,10 @@ hsk_daemon_open(hsk_daemon_t *daemon, hsk_options_t *opt) {
         return HSK_EBADARGS;
       }
     }
+
+    // Replay every header saved since the checkpoint
+    if (!hsk_store_log_open(&daemon->pool->chain))
+      fprintf(stderr, "unable to open header log, continuing without it\n");
   }
 
   rc = hsk_pool_open(daemon->pool);
@@ -26,6 +26,127 @@ raw_rr_cmp(const void *a, const void *b);
 static bool
 raw_rr_equal(const hsk_dns_raw_rr_t *a, const hsk_dns_raw_rr_t *b);
 
+static hsk_dns_rr_t *
+hsk_dns_rr_alloc_in(hsk_dns_arena_t *arena);
+
+static void *
+hsk_dns_rd_alloc_in(hsk_dns_arena_t *arena, uint16_t type);
+
+static bool
+hsk_dns_rd_read_in(
+  uint8_t **data,
+  size_t *data_len,
+  const hsk_dns_dmp_t *dmp,
+  void *rd,
+  uint16_t type,
+  hsk_dns_arena_t *arena
+);
+
+/*
+ * Arena
+ */
+
+// Keeps every allocation aligned for any field type.
+#define HSK_DNS_ALIGN(n) (((n) + 15) & ~((size_t)15))
+#define HSK_DNS_CHUNK_HEAD HSK_DNS_ALIGN(sizeof(hsk_dns_chunk_t))
+
+void
+hsk_dns_arena_init(hsk_dns_arena_t *arena) {
+  assert(arena);
+  arena->head = NULL;
+}
+
+void
+hsk_dns_arena_uninit(hsk_dns_arena_t *arena) {
+  assert(arena);
+
+  hsk_dns_chunk_t *chunk, *next;
+
+  for (chunk = arena->head; chunk; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+
+  arena->head = NULL;
+}
+
+void *
+hsk_dns_arena_alloc(hsk_dns_arena_t *arena, size_t size) {
+  if (!arena)
+    return malloc(size);
+
+  size = HSK_DNS_ALIGN(size);
+
+  hsk_dns_chunk_t *chunk = arena->head;
+
+  if (!chunk || chunk->size - chunk->pos < size) {
+    size_t cap = HSK_DNS_ARENA_SIZE;
+
+    if (size > cap)
+      cap = size;
+
+    chunk = malloc(HSK_DNS_CHUNK_HEAD + cap);
+
+    if (!chunk)
+      return NULL;
+
+    chunk->next = arena->head;
+    chunk->size = cap;
+    chunk->pos = 0;
+
+    arena->head = chunk;
+  }
+
+  uint8_t *ptr = (uint8_t *)chunk + HSK_DNS_CHUNK_HEAD + chunk->pos;
+
+  chunk->pos += size;
+
+  return ptr;
+}
+
+static void
+hsk_dns_arena_free(hsk_dns_arena_t *arena, void *ptr) {
+  // Arena memory goes away with the message.
+  if (!arena)
+    free(ptr);
+}
+
+static bool
+arena_bytes(
+  hsk_dns_arena_t *arena,
+  uint8_t **data,
+  size_t *len,
+  uint8_t **out,
+  size_t size
+) {
+  if (!arena)
+    return alloc_bytes(data, len, out, size);
+
+  if (*len < size)
+    return false;
+
+  uint8_t *o = hsk_dns_arena_alloc(arena, size);
+
+  if (o == NULL)
+    return false;
+
+  if (!read_bytes(data, len, o, size))
+    return false;
+
+  *out = o;
+
+  return true;
+}
+
+static void
+hsk_dns_msg_set_arena(hsk_dns_msg_t *msg, hsk_dns_arena_t *arena) {
+  msg->arena = arena;
+  msg->qd.arena = arena;
+  msg->an.arena = arena;
+  msg->ns.arena = arena;
+  msg->ar.arena = arena;
+}
+
 /*
  * Message
  */
@@ -48,6 +169,7 @@ hsk_dns_msg_init(hsk_dns_msg_t *msg) {
   msg->edns.code = 0;
   msg->edns.rd_len = 0;
   msg->edns.rd = NULL;
+  msg->arena = NULL;
 }
 
 void
@@ -64,6 +186,11 @@ hsk_dns_msg_uninit(hsk_dns_msg_t *msg) {
     msg->edns.rd_len = 0;
     msg->edns.rd = NULL;
   }
+
+  if (msg->arena) {
+    hsk_dns_arena_uninit(msg->arena);
+    hsk_dns_msg_set_arena(msg, NULL);
+  }
 }
 
 hsk_dns_msg_t *
@@ -74,6 +201,21 @@ hsk_dns_msg_alloc(void) {
   return msg;
 }
 
+// Records created in the message sections via
+// their arena are released with the message.
+hsk_dns_msg_t *
+hsk_dns_msg_alloc_arena(void) {
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+
+  if (!msg)
+    return NULL;
+
+  hsk_dns_arena_init(&msg->arena_);
+  hsk_dns_msg_set_arena(msg, &msg->arena_);
+
+  return msg;
+}
+
 void
 hsk_dns_msg_free(hsk_dns_msg_t *msg) {
   assert(msg);
@@ -83,7 +225,7 @@ hsk_dns_msg_free(hsk_dns_msg_t *msg) {
 
 bool
 hsk_dns_msg_decode(const uint8_t *data, size_t data_len, hsk_dns_msg_t **msg) {
-  hsk_dns_msg_t *m = hsk_dns_msg_alloc();
+  hsk_dns_msg_t *m = hsk_dns_msg_alloc_arena();
 
   if (!m)
     return false;
@@ -98,25 +240,63 @@ hsk_dns_msg_decode(const uint8_t *data, size_t data_len, hsk_dns_msg_t **msg) {
   return true;
 }
 
+static uint16_t
+hsk_dns_msg_flags(const hsk_dns_msg_t *msg) {
+  uint16_t flags = msg->flags;
+
+  flags &= ~(0x0f << 11);
+  flags &= ~0x0f;
+  flags |= ((uint16_t)(msg->opcode & 0x0f)) << 11;
+  flags |= msg->code & 0x0f;
+
+  return flags;
+}
+
+static bool
+hsk_dns_msg_opt(
+  const hsk_dns_msg_t *msg,
+  hsk_dns_rr_t *rr,
+  hsk_dns_opt_rd_t *rd
+) {
+  bool enabled = msg->edns.enabled;
+  uint16_t ecode = msg->edns.code;
+
+  if (msg->code > 0x0f) {
+    enabled = true;
+    ecode = msg->code >> 4;
+  }
+
+  if (!enabled)
+    return false;
+
+  rr->type = HSK_DNS_OPT;
+  rr->arena = NULL;
+  strcpy(rr->name, ".");
+  rr->ttl = 0;
+  rr->ttl |= ((uint32_t)ecode) << 24;
+  rr->ttl |= ((uint32_t)msg->edns.version) << 16;
+  rr->ttl |= (uint32_t)msg->edns.flags;
+  rr->class = msg->edns.size;
+  rr->rd = (void *)rd;
+  rd->rd_len = msg->edns.rd_len;
+  rd->rd = msg->edns.rd;
+
+  return true;
+}
+
 int
 hsk_dns_msg_write(const hsk_dns_msg_t *msg, uint8_t **data) {
   int size = 0;
-  uint16_t flags = msg->flags;
+  uint16_t flags = hsk_dns_msg_flags(msg);
 
   hsk_dns_cmp_t cmp_;
   hsk_dns_cmp_t *cmp = NULL;
 
   if (data) {
     cmp = &cmp_;
-    hsk_map_init_str_map(&cmp->map, NULL);
-    cmp->msg = *data;
+    hsk_dns_cmp_init(cmp, *data);
   }
 
-  flags &= ~(0x0f << 11);
-  flags &= ~0x0f;
-  flags |= ((uint16_t)(msg->opcode & 0x0f)) << 11;
-  flags |= msg->code & 0x0f;
-
   size += write_u16be(data, msg->id);
   size += write_u16be(data, flags);
   size += write_u16be(data, msg->qd.size);
@@ -138,185 +318,190 @@ hsk_dns_msg_write(const hsk_dns_msg_t *msg, uint8_t **data) {
   for (i = 0; i < msg->ar.size; i++)
     size += hsk_dns_rr_write(msg->ar.items[i], data, cmp);
 
-  bool enabled = msg->edns.enabled;
-  uint16_t ecode = msg->edns.code;
+  hsk_dns_rr_t rr;
+  hsk_dns_opt_rd_t rd;
 
-  if (msg->code > 0x0f) {
-    enabled = true;
-    ecode = msg->code >> 4;
-  }
-
-  if (enabled) {
-    hsk_dns_rr_t rr = { .type = HSK_DNS_OPT };
-    hsk_dns_opt_rd_t rd;
-    strcpy(rr.name, ".");
-    rr.ttl = 0;
-    rr.ttl |= ((uint32_t)ecode) << 24;
-    rr.ttl |= ((uint32_t)msg->edns.version) << 16;
-    rr.ttl |= (uint32_t)msg->edns.flags;
-    rr.class = msg->edns.size;
-    rr.rd = (void *)&rd;
-    rd.rd_len = msg->edns.rd_len;
-    rd.rd = msg->edns.rd;
+  if (hsk_dns_msg_opt(msg, &rr, &rd))
     size += hsk_dns_rr_write(&rr, data, cmp);
-  }
 
   if (cmp)
-    hsk_map_uninit(&cmp->map);
+    hsk_dns_cmp_uninit(cmp);
 
   return size;
 }
 
-int
-hsk_dns_msg_size(const hsk_dns_msg_t *msg) {
-  return hsk_dns_msg_write(msg, NULL);
-}
-
-bool
-hsk_dns_msg_encode(const hsk_dns_msg_t *msg, uint8_t **data, size_t *data_len) {
-  int size = hsk_dns_msg_size(msg);
-  uint8_t *buf = malloc(size);
-
-  if (!buf)
-    return false;
-
-  uint8_t *b = buf;
+// Writes a record only if it fits before `end`.
+// The uncompressed size is an upper bound, so
+// most records are written straight away. Near
+// the end, the record is first written into a
+// copy of the message, where pointers and the
+// suffixes the record adds itself resolve as
+// they would in place, and only copied over if
+// the compressed result fits.
+static bool
+hsk_dns_msg_put(
+  const hsk_dns_rr_t *rr,
+  bool question,
+  uint8_t **data,
+  const uint8_t *end,
+  hsk_dns_cmp_t *cmp
+) {
+  size_t left = end - *data;
+  size_t size;
 
-  // Will yield something less
-  // due to label compression.
-  size = hsk_dns_msg_write(msg, &b);
+  if (question)
+    size = hsk_dns_qs_write(rr, NULL, NULL);
+  else
+    size = hsk_dns_rr_write(rr, NULL, NULL);
 
-  *data = buf;
-  *data_len = size;
+  if (size <= left) {
+    if (question)
+      hsk_dns_qs_write(rr, data, cmp);
+    else
+      hsk_dns_rr_write(rr, data, cmp);
+    return true;
+  }
 
-  return true;
-}
+  uint8_t *msg = cmp->msg;
+  size_t off = *data - msg;
+  uint8_t *tmp = malloc(off + size);
 
-bool
-hsk_dns_msg_truncate(uint8_t *msg, size_t msg_len, size_t max, size_t *len) {
-  if (msg_len < 12)
+  if (!tmp)
     return false;
 
-  if (max < 12)
-    return false;
+  memcpy(tmp, msg, off);
 
-  if (msg_len <= max) {
-    *len = msg_len;
-    return true;
-  }
+  uint8_t *pos = &tmp[off];
 
-  uint8_t *data = msg;
-  size_t data_len = msg_len;
+  cmp->msg = tmp;
 
-  uint16_t flags = 0;
-  uint16_t qdcount = 0;
-  uint16_t ancount = 0;
-  uint16_t nscount = 0;
-  uint16_t arcount = 0;
+  if (question)
+    hsk_dns_qs_write(rr, &pos, cmp);
+  else
+    hsk_dns_rr_write(rr, &pos, cmp);
 
-  hsk_dns_dmp_t dmp;
-  dmp.msg = msg;
-  dmp.msg_len = msg_len;
+  cmp->msg = msg;
 
-  data += 2;
-  data_len -= 2;
+  size = pos - &tmp[off];
 
-  if (!read_u16be(&data, &data_len, &flags))
+  // Suffixes added past `end` stay in the table,
+  // but only the OPT record follows and its root
+  // owner is never compressed.
+  if (size > left) {
+    free(tmp);
     return false;
+  }
 
-  if (!read_u16be(&data, &data_len, &qdcount))
-    return false;
+  memcpy(*data, &tmp[off], size);
+  *data += size;
 
-  if (!read_u16be(&data, &data_len, &ancount))
-    return false;
+  free(tmp);
 
-  if (!read_u16be(&data, &data_len, &nscount))
-    return false;
+  return true;
+}
 
-  if (!read_u16be(&data, &data_len, &arcount))
+bool
+hsk_dns_msg_pack(
+  const hsk_dns_msg_t *msg,
+  uint8_t *data,
+  size_t max,
+  size_t *len
+) {
+  if (max < 12)
     return false;
 
-  uint8_t *end = msg + max;
-  uint8_t *last = data;
-  uint16_t rdlen;
+  hsk_dns_cmp_t cmp;
+  hsk_dns_cmp_init(&cmp, data);
 
-  uint16_t counts[4] = {
-    qdcount,
-    ancount,
-    nscount,
-    arcount
+  const hsk_dns_rrs_t *sections[4] = {
+    &msg->qd,
+    &msg->an,
+    &msg->ns,
+    &msg->ar
   };
 
-  int s;
-  for (s = 0; s < 4; s++) {
-    uint16_t count = counts[s];
-    int i = 0;
-    int j = 0;
+  uint16_t counts[4] = { 0, 0, 0, 0 };
+  uint16_t flags = hsk_dns_msg_flags(msg);
+  uint8_t *end = data + max;
+  uint8_t *pos = data + 12;
+  bool truncated = false;
+  int s, i;
+
+  hsk_dns_rr_t rr;
+  hsk_dns_opt_rd_t rd;
+  bool opt = hsk_dns_msg_opt(msg, &rr, &rd);
+  size_t opt_size = 0;
+
+  // Room for the OPT record is set aside so it
+  // survives truncation (RFC 6891, section 7).
+  if (opt) {
+    opt_size = hsk_dns_rr_write(&rr, NULL, NULL);
+
+    if (opt_size > max - 12)
+      opt = false;
+    else
+      end -= opt_size;
+  }
 
-    while (data <= end) {
-      last = data;
-      j = i;
+  for (s = 0; s < 4 && !truncated; s++) {
+    const hsk_dns_rrs_t *rrs = sections[s];
 
-      if (i == count)
+    for (i = 0; i < rrs->size; i++) {
+      if (!hsk_dns_msg_put(rrs->items[i], s == 0, &pos, end, &cmp)) {
+        truncated = true;
         break;
+      }
+      counts[s] += 1;
+    }
+  }
 
-      i += 1;
-
-      if (!hsk_dns_name_read(&data, &data_len, &dmp, NULL))
-        return false;
-
-      // Question.
-      if (s == 0) {
-        // QS header.
-        if (data_len < 4)
-          return false;
+  if (opt) {
+    hsk_dns_rr_write(&rr, &pos, &cmp);
+    counts[3] += 1;
+  }
 
-        // Type and class.
-        data += 4;
-        data_len -= 4;
+  hsk_dns_cmp_uninit(&cmp);
 
-        continue;
-      }
+  // We would normally set the truncate bit,
+  // but we don't support TCP yet.
+  // if (truncated)
+  //   flags |= HSK_DNS_TC;
 
-      // RR header.
-      if (data_len < 8)
-        return false;
+  uint8_t *hdr = data;
 
-      // Type, class, TTL.
-      data += 8;
-      data_len -= 8;
+  write_u16be(&hdr, msg->id);
+  write_u16be(&hdr, flags);
+  write_u16be(&hdr, counts[0]);
+  write_u16be(&hdr, counts[1]);
+  write_u16be(&hdr, counts[2]);
+  write_u16be(&hdr, counts[3]);
 
-      // RD len.
-      if (!read_u16be(&data, &data_len, &rdlen))
-        return false;
+  *len = pos - data;
 
-      if (data_len < rdlen)
-        return false;
+  return true;
+}
 
-      data += rdlen;
-      data_len -= rdlen;
-    }
+int
+hsk_dns_msg_size(const hsk_dns_msg_t *msg) {
+  return hsk_dns_msg_write(msg, NULL);
+}
 
-    counts[s] = j;
-  }
+bool
+hsk_dns_msg_encode(const hsk_dns_msg_t *msg, uint8_t **data, size_t *data_len) {
+  int size = hsk_dns_msg_size(msg);
+  uint8_t *buf = malloc(size);
 
-  flags |= HSK_DNS_TC;
+  if (!buf)
+    return false;
 
-  // We would normally set the truncate bit,
-  // but we don't support TCP yet.
-  // msg[2] = (flags >> 8) & 0xff;
-  // msg[3] = flags & 0xff;
+  uint8_t *b = buf;
 
-  msg[4] = (counts[0] >> 8) & 0xff;
-  msg[5] = counts[0] & 0xff;
-  msg[6] = (counts[1] >> 8) & 0xff;
-  msg[7] = counts[1] & 0xff;
-  msg[8] = (counts[2] >> 8) & 0xff;
-  msg[9] = counts[2] & 0xff;
-  msg[10] = (counts[3] >> 8) & 0xff;
-  msg[11] = counts[3] & 0xff;
+  // Will yield something less
+  // due to label compression.
+  size = hsk_dns_msg_write(msg, &b);
 
-  *len = last - msg;
+  *data = buf;
+  *data_len = size;
 
   return true;
 }
@@ -363,11 +548,14 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
     if (*data_len == 0)
       break;
 
-    hsk_dns_qs_t *qs = hsk_dns_qs_alloc();
+    hsk_dns_qs_t *qs = hsk_dns_arena_alloc(msg->arena, sizeof(hsk_dns_qs_t));
 
     if (!qs)
       goto fail;
 
+    hsk_dns_qs_init(qs);
+    qs->arena = msg->arena;
+
     if (!hsk_dns_qs_read(data, data_len, &dmp, qs))
       goto fail;
 
@@ -378,7 +566,7 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
     if (*data_len == 0)
       break;
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_alloc();
+    hsk_dns_rr_t *rr = hsk_dns_rr_alloc_in(msg->arena);
 
     if (!rr)
       goto fail;
@@ -393,7 +581,7 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
     if (*data_len == 0)
       break;
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_alloc();
+    hsk_dns_rr_t *rr = hsk_dns_rr_alloc_in(msg->arena);
 
     if (!rr)
       goto fail;
@@ -408,7 +596,7 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
     if (*data_len == 0)
       break;
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_alloc();
+    hsk_dns_rr_t *rr = hsk_dns_rr_alloc_in(msg->arena);
 
     if (!rr)
       goto fail;
@@ -431,6 +619,22 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
       msg->edns.rd = opt->rd;
       msg->code |= msg->edns.code << 4;
 
+      if (rr->arena) {
+        // EDNS data outlives the records.
+        msg->edns.rd = NULL;
+
+        if (opt->rd_len > 0) {
+          msg->edns.rd = malloc(opt->rd_len);
+
+          if (!msg->edns.rd)
+            goto fail;
+
+          memcpy(msg->edns.rd, opt->rd, opt->rd_len);
+        }
+
+        continue;
+      }
+
       free(rr->rd);
       free(rr);
 
@@ -442,12 +646,14 @@ hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg) {
 
   return true;
 
-fail:
+fail: ;
+  hsk_dns_arena_t *arena = msg->arena;
   hsk_dns_rrs_uninit(&msg->qd);
   hsk_dns_rrs_uninit(&msg->an);
   hsk_dns_rrs_uninit(&msg->ns);
   hsk_dns_rrs_uninit(&msg->ar);
   hsk_dns_msg_init(msg);
+  hsk_dns_msg_set_arena(msg, arena);
   return false;
 }
 
@@ -457,8 +663,41 @@ fail:
 
 void
 hsk_dns_rrs_init(hsk_dns_rrs_t *rrs) {
-  memset(rrs->items, 0, sizeof(hsk_dns_rr_t *) * 255);
+  memset(rrs->inline_, 0, sizeof(rrs->inline_));
   rrs->size = 0;
+  rrs->cap = HSK_DNS_RRS_INLINE;
+  rrs->items = &rrs->inline_[0];
+  rrs->arena = NULL;
+}
+
+static bool
+hsk_dns_rrs_grow(hsk_dns_rrs_t *rrs) {
+  if (rrs->size < rrs->cap)
+    return true;
+
+  if (rrs->cap == HSK_DNS_RRS_MAX)
+    return false;
+
+  size_t cap = rrs->cap * 2;
+
+  if (cap > HSK_DNS_RRS_MAX)
+    cap = HSK_DNS_RRS_MAX;
+
+  hsk_dns_rr_t **items = hsk_dns_arena_alloc(rrs->arena, cap * sizeof(*items));
+
+  if (!items)
+    return false;
+
+  memcpy(items, rrs->items, rrs->size * sizeof(*items));
+  memset(&items[rrs->size], 0, (cap - rrs->size) * sizeof(*items));
+
+  if (rrs->items != &rrs->inline_[0])
+    hsk_dns_arena_free(rrs->arena, rrs->items);
+
+  rrs->items = items;
+  rrs->cap = cap;
+
+  return true;
 }
 
 void
@@ -472,6 +711,12 @@ hsk_dns_rrs_uninit(hsk_dns_rrs_t *rrs) {
     rrs->items[i] = NULL;
   }
 
+  if (rrs->items != &rrs->inline_[0]) {
+    hsk_dns_arena_free(rrs->arena, rrs->items);
+    rrs->items = &rrs->inline_[0];
+    rrs->cap = HSK_DNS_RRS_INLINE;
+  }
+
   rrs->size = 0;
 }
 
@@ -492,10 +737,10 @@ hsk_dns_rrs_free(hsk_dns_rrs_t *rrs) {
 
 size_t
 hsk_dns_rrs_unshift(hsk_dns_rrs_t *rrs, hsk_dns_rr_t *rr) {
-  if (rrs->size == 255)
+  if (!hsk_dns_rrs_grow(rrs))
     return 0;
 
-  assert(rrs->size < 255);
+  assert(rrs->size < rrs->cap);
 
   int i;
   for (i = 1; i < rrs->size + 1; i++) {
@@ -531,10 +776,10 @@ hsk_dns_rrs_shift(hsk_dns_rrs_t *rrs) {
 
 size_t
 hsk_dns_rrs_push(hsk_dns_rrs_t *rrs, hsk_dns_rr_t *rr) {
-  if (rrs->size == 255)
+  if (!hsk_dns_rrs_grow(rrs))
     return 0;
 
-  assert(rrs->size < 255);
+  assert(rrs->size < rrs->cap);
 
   assert(!rrs->items[rrs->size]);
   rrs->items[rrs->size] = rr;
@@ -593,12 +838,12 @@ void
 hsk_dns_qs_init(hsk_dns_qs_t *qs) {
   assert(qs);
 
-  memset(qs->name, 0, sizeof(qs->name));
   strcpy(qs->name, ".");
   qs->type = HSK_DNS_UNKNOWN;
   qs->class = HSK_DNS_IN;
   qs->ttl = 0;
   qs->rd = NULL;
+  qs->arena = NULL;
 }
 
 void
@@ -617,7 +862,7 @@ hsk_dns_qs_alloc(void) {
 void
 hsk_dns_qs_free(hsk_dns_qs_t *qs) {
   assert(qs);
-  free(qs);
+  hsk_dns_arena_free(qs->arena, qs);
 }
 
 void
@@ -664,12 +909,14 @@ void
 hsk_dns_rr_init(hsk_dns_rr_t *rr) {
   assert(rr);
 
-  memset(rr->name, 0, sizeof(rr->name));
+  // Names are NUL-terminated, no need to
+  // clear the whole buffer.
   strcpy(rr->name, ".");
   rr->type = HSK_DNS_UNKNOWN;
   rr->class = HSK_DNS_IN;
   rr->ttl = 0;
   rr->rd = NULL;
+  rr->arena = NULL;
 }
 
 void
@@ -677,30 +924,45 @@ hsk_dns_rr_uninit(hsk_dns_rr_t *rr) {
   assert(rr);
 
   if (rr->rd) {
-    hsk_dns_rd_free(rr->rd, rr->type);
+    if (!rr->arena)
+      hsk_dns_rd_free(rr->rd, rr->type);
     rr->rd = NULL;
   }
 }
 
-hsk_dns_rr_t *
-hsk_dns_rr_alloc(void) {
-  hsk_dns_rr_t *rr = malloc(sizeof(hsk_dns_rr_t));
-  if (rr)
+static hsk_dns_rr_t *
+hsk_dns_rr_alloc_in(hsk_dns_arena_t *arena) {
+  hsk_dns_rr_t *rr = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_rr_t));
+  if (rr) {
     hsk_dns_rr_init(rr);
+    rr->arena = arena;
+  }
   return rr;
 }
 
+hsk_dns_rr_t *
+hsk_dns_rr_alloc(void) {
+  return hsk_dns_rr_alloc_in(NULL);
+}
+
 hsk_dns_rr_t *
 hsk_dns_rr_create(uint16_t type) {
-  hsk_dns_rr_t *rr = hsk_dns_rr_alloc();
+  return hsk_dns_rr_create_in(NULL, type);
+}
+
+// The record, its rdata and anything hanging
+// off the rdata all come from the same arena.
+hsk_dns_rr_t *
+hsk_dns_rr_create_in(hsk_dns_arena_t *arena, uint16_t type) {
+  hsk_dns_rr_t *rr = hsk_dns_rr_alloc_in(arena);
 
   if (!rr)
     return NULL;
 
-  void *rd = hsk_dns_rd_alloc(type);
+  void *rd = hsk_dns_rd_alloc_in(arena, type);
 
   if (!rd) {
-    free(rr);
+    hsk_dns_arena_free(arena, rr);
     return NULL;
   }
 
@@ -711,11 +973,17 @@ hsk_dns_rr_create(uint16_t type) {
   return rr;
 }
 
+void *
+hsk_dns_rr_alloc_data(hsk_dns_rr_t *rr, size_t size) {
+  assert(rr);
+  return hsk_dns_arena_alloc(rr->arena, size);
+}
+
 void
 hsk_dns_rr_free(hsk_dns_rr_t *rr) {
   assert(rr);
   hsk_dns_rr_uninit(rr);
-  free(rr);
+  hsk_dns_arena_free(rr->arena, rr);
 }
 
 bool
@@ -803,7 +1071,7 @@ hsk_dns_rr_read(
   if (*data_len < len)
     return false;
 
-  void *rd = hsk_dns_rd_alloc(rr->type);
+  void *rd = hsk_dns_rd_alloc_in(rr->arena, rr->type);
 
   if (!rd)
     return false;
@@ -811,8 +1079,8 @@ hsk_dns_rr_read(
   uint8_t *rdata = *data;
   size_t rdlen = (size_t)len;
 
-  if (!hsk_dns_rd_read(&rdata, &rdlen, dmp, rd, rr->type)) {
-    free(rd);
+  if (!hsk_dns_rd_read_in(&rdata, &rdlen, dmp, rd, rr->type, rr->arena)) {
+    hsk_dns_arena_free(rr->arena, rd);
     return false;
   }
 
@@ -1190,98 +1458,98 @@ hsk_dns_rd_uninit(void *rd, uint16_t type) {
   }
 }
 
-void *
-hsk_dns_rd_alloc(uint16_t type) {
+static void *
+hsk_dns_rd_alloc_in(hsk_dns_arena_t *arena, uint16_t type) {
   void *rd;
 
   switch (type) {
     case HSK_DNS_SOA: {
-      rd = malloc(sizeof(hsk_dns_soa_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_soa_rd_t));
       break;
     }
     case HSK_DNS_A: {
-      rd = malloc(sizeof(hsk_dns_a_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_a_rd_t));
       break;
     }
     case HSK_DNS_AAAA: {
-      rd = malloc(sizeof(hsk_dns_aaaa_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_aaaa_rd_t));
       break;
     }
     case HSK_DNS_LOC: {
-      rd = malloc(sizeof(hsk_dns_loc_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_loc_rd_t));
       break;
     }
     case HSK_DNS_CNAME: {
-      rd = malloc(sizeof(hsk_dns_cname_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_cname_rd_t));
       break;
     }
     case HSK_DNS_DNAME: {
-      rd = malloc(sizeof(hsk_dns_dname_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_dname_rd_t));
       break;
     }
     case HSK_DNS_NS: {
-      rd = malloc(sizeof(hsk_dns_ns_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_ns_rd_t));
       break;
     }
     case HSK_DNS_MX: {
-      rd = malloc(sizeof(hsk_dns_mx_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_mx_rd_t));
       break;
     }
     case HSK_DNS_PTR: {
-      rd = malloc(sizeof(hsk_dns_ptr_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_ptr_rd_t));
       break;
     }
     case HSK_DNS_SRV: {
-      rd = malloc(sizeof(hsk_dns_srv_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_srv_rd_t));
       break;
     }
     case HSK_DNS_TXT: {
-      rd = malloc(sizeof(hsk_dns_txt_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_txt_rd_t));
       break;
     }
     case HSK_DNS_DS: {
-      rd = malloc(sizeof(hsk_dns_ds_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_ds_rd_t));
       break;
     }
     case HSK_DNS_SMIMEA:
     case HSK_DNS_TLSA: {
-      rd = malloc(sizeof(hsk_dns_tlsa_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_tlsa_rd_t));
       break;
     }
     case HSK_DNS_SSHFP: {
-      rd = malloc(sizeof(hsk_dns_sshfp_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_sshfp_rd_t));
       break;
     }
     case HSK_DNS_OPENPGPKEY: {
-      rd = malloc(sizeof(hsk_dns_openpgpkey_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_openpgpkey_rd_t));
       break;
     }
     case HSK_DNS_OPT: {
-      rd = malloc(sizeof(hsk_dns_opt_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_opt_rd_t));
       break;
     }
     case HSK_DNS_DNSKEY: {
-      rd = malloc(sizeof(hsk_dns_dnskey_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_dnskey_rd_t));
       break;
     }
     case HSK_DNS_RRSIG: {
-      rd = malloc(sizeof(hsk_dns_rrsig_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_rrsig_rd_t));
       break;
     }
     case HSK_DNS_URI: {
-      rd = malloc(sizeof(hsk_dns_uri_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_uri_rd_t));
       break;
     }
     case HSK_DNS_RP: {
-      rd = malloc(sizeof(hsk_dns_rp_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_rp_rd_t));
       break;
     }
     case HSK_DNS_NSEC: {
-      rd = malloc(sizeof(hsk_dns_nsec_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_nsec_rd_t));
       break;
     }
     default: {
-      rd = malloc(sizeof(hsk_dns_unknown_rd_t));
+      rd = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_unknown_rd_t));
       break;
     }
   }
@@ -1292,6 +1560,11 @@ hsk_dns_rd_alloc(uint16_t type) {
   return rd;
 }
 
+void *
+hsk_dns_rd_alloc(uint16_t type) {
+  return hsk_dns_rd_alloc_in(NULL, type);
+}
+
 void
 hsk_dns_rd_free(void *rd, uint16_t type) {
   assert(rd);
@@ -1520,13 +1793,14 @@ hsk_dns_rd_size(const void *rd, uint16_t type) {
   return hsk_dns_rd_write(rd, type, NULL, NULL);
 }
 
-bool
-hsk_dns_rd_read(
+static bool
+hsk_dns_rd_read_in(
   uint8_t **data,
   size_t *data_len,
   const hsk_dns_dmp_t *dmp,
   void *rd,
-  uint16_t type
+  uint16_t type,
+  hsk_dns_arena_t *arena
 ) {
   switch (type) {
     case HSK_DNS_SOA: {
@@ -1661,18 +1935,20 @@ hsk_dns_rd_read(
       hsk_dns_txt_rd_t *r = (hsk_dns_txt_rd_t *)rd;
 
       while (*data_len > 0) {
-        hsk_dns_txt_t *txt = hsk_dns_txt_alloc();
+        hsk_dns_txt_t *txt = hsk_dns_arena_alloc(arena, sizeof(hsk_dns_txt_t));
 
         if (!txt)
           goto fail_txt;
 
+        hsk_dns_txt_init(txt);
+
         if (!read_u8(data, data_len, &txt->data_len)) {
-          hsk_dns_txt_free(txt);
+          hsk_dns_arena_free(arena, txt);
           goto fail_txt;
         }
 
         if (!read_bytes(data, data_len, txt->data, txt->data_len)) {
-          hsk_dns_txt_free(txt);
+          hsk_dns_arena_free(arena, txt);
           goto fail_txt;
         }
 
@@ -1682,7 +1958,8 @@ hsk_dns_rd_read(
       break;
 
 fail_txt:
-      hsk_dns_txts_uninit(&r->txts);
+      if (!arena)
+        hsk_dns_txts_uninit(&r->txts);
       return false;
     }
     case HSK_DNS_DS: {
@@ -1699,7 +1976,7 @@ fail_txt:
 
       r->digest_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->digest, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->digest, *data_len))
         return false;
 
       break;
@@ -1719,7 +1996,7 @@ fail_txt:
 
       r->certificate_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->certificate, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->certificate, *data_len))
         return false;
 
       break;
@@ -1735,7 +2012,7 @@ fail_txt:
 
       r->fingerprint_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->fingerprint, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->fingerprint, *data_len))
         return false;
 
       break;
@@ -1745,7 +2022,7 @@ fail_txt:
 
       r->pubkey_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->pubkey, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->pubkey, *data_len))
         return false;
 
       break;
@@ -1755,7 +2032,7 @@ fail_txt:
 
       r->rd_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->rd, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->rd, *data_len))
         return false;
 
       break;
@@ -1774,7 +2051,7 @@ fail_txt:
 
       r->pubkey_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->pubkey, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->pubkey, *data_len))
         return false;
 
       break;
@@ -1808,7 +2085,7 @@ fail_txt:
 
       r->signature_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->signature, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->signature, *data_len))
         return false;
 
       break;
@@ -1849,7 +2126,7 @@ fail_txt:
 
       r->type_map_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->type_map, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->type_map, *data_len))
         return false;
 
       break;
@@ -1859,7 +2136,7 @@ fail_txt:
 
       r->rd_len = *data_len;
 
-      if (!alloc_bytes(data, data_len, &r->rd, *data_len))
+      if (!arena_bytes(arena, data, data_len, &r->rd, *data_len))
         return false;
 
       break;
@@ -1869,6 +2146,17 @@ fail_txt:
   return true;
 }
 
+bool
+hsk_dns_rd_read(
+  uint8_t **data,
+  size_t *data_len,
+  const hsk_dns_dmp_t *dmp,
+  void *rd,
+  uint16_t type
+) {
+  return hsk_dns_rd_read_in(data, data_len, dmp, rd, type, NULL);
+}
+
 bool
 hsk_dns_rd_encode(
   const void *rd,
@@ -2209,6 +2497,166 @@ hsk_dns_name_parse(
   return noff;
 }
 
+static uint32_t
+hsk_dns_cmp_hash(const char *name) {
+  uint32_t hash = 2166136261;
+
+  for (; *name; name++) {
+    hash ^= (uint8_t)*name;
+    hash *= 16777619;
+  }
+
+  return hash;
+}
+
+static bool
+hsk_dns_cmp_match(const hsk_dns_cmp_t *cmp, size_t off, const char *name) {
+  const uint8_t *msg = cmp->msg;
+  const char *s = name;
+
+  for (;;) {
+    uint8_t c = msg[off];
+
+    if ((c & 0xc0) == 0xc0) {
+      size_t p = ((c & 0x3f) << 8) | msg[off + 1];
+
+      // We only ever write backward pointers.
+      if (p >= off)
+        return false;
+
+      off = p;
+      continue;
+    }
+
+    if (*s == '\0')
+      return c == 0;
+
+    const char *e = strchr(s, '.');
+
+    if (!e || e - s != c)
+      return false;
+
+    off += 1;
+
+    int j;
+    for (j = 0; j < c; j++) {
+      char ch = s[j];
+
+      if (ch == -1)
+        ch = '\0';
+
+      if (ch == -2)
+        ch = '.';
+
+      if (msg[off + j] != (uint8_t)ch)
+        return false;
+    }
+
+    off += c;
+    s = e + 1;
+  }
+}
+
+void
+hsk_dns_cmp_init(hsk_dns_cmp_t *cmp, uint8_t *msg) {
+  assert(cmp);
+  cmp->msg = msg;
+  cmp->count = 0;
+  cmp->size = HSK_DNS_CMP_SIZE;
+  cmp->entries = cmp->slots;
+  memset(cmp->slots, 0x00, sizeof(cmp->slots));
+  cmp->ptrs = NULL;
+  cmp->ptrs_size = 0;
+  cmp->ptrs_count = 0;
+}
+
+void
+hsk_dns_cmp_uninit(hsk_dns_cmp_t *cmp) {
+  assert(cmp);
+
+  if (cmp->entries != cmp->slots)
+    free(cmp->entries);
+
+  cmp->entries = cmp->slots;
+  cmp->size = HSK_DNS_CMP_SIZE;
+  cmp->count = 0;
+}
+
+// Offset 0 is the header, so it marks a free slot.
+static int
+hsk_dns_cmp_get(const hsk_dns_cmp_t *cmp, const char *name, uint32_t hash) {
+  int mask = cmp->size - 1;
+  int i;
+
+  for (i = hash & mask; cmp->entries[i].off != 0; i = (i + 1) & mask) {
+    const hsk_dns_cmp_entry_t *entry = &cmp->entries[i];
+
+    if (entry->hash != hash)
+      continue;
+
+    if (hsk_dns_cmp_match(cmp, entry->off, name))
+      return entry->off;
+  }
+
+  return -1;
+}
+
+static void
+hsk_dns_cmp_put(
+  hsk_dns_cmp_entry_t *entries,
+  int size,
+  const hsk_dns_cmp_entry_t *entry
+) {
+  int mask = size - 1;
+  int i;
+
+  for (i = entry->hash & mask; entries[i].off != 0; i = (i + 1) & mask);
+
+  entries[i] = *entry;
+}
+
+static bool
+hsk_dns_cmp_grow(hsk_dns_cmp_t *cmp) {
+  int size = cmp->size * 2;
+  hsk_dns_cmp_entry_t *entries = calloc(size, sizeof(hsk_dns_cmp_entry_t));
+  int i;
+
+  if (!entries)
+    return false;
+
+  for (i = 0; i < cmp->size; i++) {
+    if (cmp->entries[i].off != 0)
+      hsk_dns_cmp_put(entries, size, &cmp->entries[i]);
+  }
+
+  if (cmp->entries != cmp->slots)
+    free(cmp->entries);
+
+  cmp->entries = entries;
+  cmp->size = size;
+
+  return true;
+}
+
+static void
+hsk_dns_cmp_add(
+  hsk_dns_cmp_t *cmp,
+  const hsk_dns_cmp_entry_t *entries,
+  int count
+) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    // Keep the load at one half. Without memory
+    // the remaining suffixes go uncompressed.
+    if ((cmp->count + 1) * 2 > cmp->size && !hsk_dns_cmp_grow(cmp))
+      return;
+
+    hsk_dns_cmp_put(cmp->entries, cmp->size, &entries[i]);
+    cmp->count += 1;
+  }
+}
+
 static bool
 hsk_dns_name_serialize(
   const char *name,
@@ -2225,6 +2673,11 @@ hsk_dns_name_serialize(
   int i;
   char *s;
 
+  // Suffixes of this name are only added to the
+  // table once the whole name has been written.
+  hsk_dns_cmp_entry_t added[HSK_DNS_MAX_LABELS];
+  int added_count = 0;
+
   for (s = (char *)name, i = 0; *s; s++, i++) {
     if (name[i] == '.') {
       if (i > 0 && name[i - 1] == '.') {
@@ -2248,20 +2701,22 @@ hsk_dns_name_serialize(
       }
 
       if (cmp) {
-        char *sub = (char *)&name[begin];
+        const char *sub = &name[begin];
         if (strcmp(sub, ".") != 0) {
-          size_t p = (size_t)hsk_map_get(&cmp->map, sub);
-          if (p == 0) {
-            size_t o = (size_t)(&data[off] - cmp->msg);
-            if (o < (2 << 13))
-              hsk_map_set(&cmp->map, sub, (void *)o);
-          } else {
-            if (ptr == -1) {
-              ptr = p;
-              pos = off;
-              i += strlen(s);
-              break;
+          uint32_t hash = hsk_dns_cmp_hash(sub);
+          int p = hsk_dns_cmp_get(cmp, sub, hash);
+          if (p == -1) {
+            size_t o = data ? (size_t)(&data[off] - cmp->msg) : (2 << 13);
+            if (o < (2 << 13) && added_count < HSK_DNS_MAX_LABELS) {
+              added[added_count].hash = hash;
+              added[added_count].off = o;
+              added_count += 1;
             }
+          } else {
+            ptr = p;
+            pos = off;
+            i += strlen(s);
+            break;
           }
         }
       }
@@ -2315,11 +2770,17 @@ hsk_dns_name_serialize(
       ptr ^= 0xc000;
       data[off] = (ptr >> 8) & 0xff;
       data[off + 1] = ptr & 0xff;
+
+      if (cmp->ptrs && cmp->ptrs_count < cmp->ptrs_size)
+        cmp->ptrs[cmp->ptrs_count++] = &data[off] - cmp->msg;
     }
 
     off += 2;
     *len = off;
 
+    if (cmp)
+      hsk_dns_cmp_add(cmp, added, added_count);
+
     return true;
   }
 
@@ -2335,6 +2796,9 @@ hsk_dns_name_serialize(
 
   *len = off;
 
+  if (cmp)
+    hsk_dns_cmp_add(cmp, added, added_count);
+
   return true;
 }
 
@@ -2429,6 +2893,95 @@ hsk_dns_name_dirty(const char *name) {
   return false;
 }
 
+// Byte classes for hsk_dns_name_analyze: bytes
+// hsk_dns_name_dirty rejects, uppercase and dots.
+#define HSK_DNS_CH_DIRTY 1
+#define HSK_DNS_CH_UPPER 2
+#define HSK_DNS_CH_DOT 4
+
+static const uint8_t hsk_dns_name_table[256] = {
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 0, 1, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 4, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0,
+  1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 1, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+void
+hsk_dns_name_analyze(const char *name, hsk_dns_name_info_t *info) {
+  assert(name && info);
+
+  const uint8_t *s = (const uint8_t *)name;
+  bool dot = true;
+  bool empty = false;
+  size_t size = 0;
+  size_t max = 0;
+  size_t i;
+
+  info->count = 0;
+  info->last_dirty = -1;
+
+  for (i = 0; s[i]; i++) {
+    uint8_t c = s[i];
+    uint8_t cls = hsk_dns_name_table[c];
+
+    if (i < HSK_DNS_MAX_NAME)
+      info->lower[i] = (cls & HSK_DNS_CH_UPPER) ? (c | 0x20) : c;
+
+    if (cls & HSK_DNS_CH_DIRTY)
+      info->last_dirty = i;
+
+    if (cls & HSK_DNS_CH_DOT) {
+      if (i > 0 && s[i - 1] == '.')
+        empty = true;
+
+      if (size > max)
+        max = size;
+
+      size = 0;
+      dot = true;
+
+      continue;
+    }
+
+    size += 1;
+
+    if (dot) {
+      if (info->count < HSK_DNS_MAX_LABELS)
+        info->labels[info->count++] = i;
+      dot = false;
+    }
+  }
+
+  if (size > max)
+    max = size;
+
+  info->len = i;
+  info->lower[i < HSK_DNS_MAX_NAME ? i : HSK_DNS_MAX_NAME] = '\0';
+
+  // Same rules as hsk_dns_name_verify, which
+  // appends a missing final dot.
+  size_t len = i;
+
+  if (len == 0 || s[len - 1] != '.')
+    len += 1;
+
+  info->valid = len <= HSK_DNS_MAX_NAME
+             && !empty
+             && max <= HSK_DNS_MAX_LABEL;
+}
+
 void
 hsk_dns_name_sanitize(const char *name, char *out) {
   char *s = (char *)name;
@@ -2605,7 +3158,7 @@ hsk_dns_label_count(const char *name) {
 int
 hsk_dns_label_from2(
   const char *name,
-  uint8_t *labels,
+  const uint8_t *labels,
   int count,
   int index,
   char *ret
@@ -2653,7 +3206,7 @@ hsk_dns_label_from(const char *name, int index, char *ret) {
 int
 hsk_dns_label_get2(
   const char *name,
-  uint8_t *labels,
+  const uint8_t *labels,
   int count,
   int index,
   char *ret
@@ -2707,17 +3260,17 @@ hsk_dns_label_get(const char *name, int index, char *ret) {
   return hsk_dns_label_get2(name, labels, count, index, ret);
 }
 
-bool
-hsk_dns_label_decode_srv(const char *name, char *protocol, char *service) {
-  int count = hsk_dns_label_count(name);
-
+static bool
+hsk_dns_label_decode_srv2(
+  const char *name,
+  const uint8_t *labels,
+  int count,
+  char *protocol,
+  char *service
+) {
   if (count < 3)
     return false;
 
-  uint8_t labels[count];
-
-  assert(hsk_dns_label_split(name, labels, count) == count);
-
   char label[HSK_DNS_MAX_LABEL + 1];
   int len;
 
@@ -2751,12 +3304,7 @@ hsk_dns_label_decode_srv(const char *name, char *protocol, char *service) {
 }
 
 bool
-hsk_dns_label_is_srv(const char *name) {
-  return hsk_dns_label_decode_srv(name, NULL, NULL);
-}
-
-bool
-hsk_dns_label_decode_tlsa(const char *name, char *protocol, uint16_t *port) {
+hsk_dns_label_decode_srv(const char *name, char *protocol, char *service) {
   int count = hsk_dns_label_count(name);
 
   if (count < 3)
@@ -2766,6 +3314,30 @@ hsk_dns_label_decode_tlsa(const char *name, char *protocol, uint16_t *port) {
 
   assert(hsk_dns_label_split(name, labels, count) == count);
 
+  return hsk_dns_label_decode_srv2(name, labels, count, protocol, service);
+}
+
+bool
+hsk_dns_label_is_srv(const char *name) {
+  return hsk_dns_label_decode_srv(name, NULL, NULL);
+}
+
+bool
+hsk_dns_label_is_srv2(const char *name, const uint8_t *labels, int count) {
+  return hsk_dns_label_decode_srv2(name, labels, count, NULL, NULL);
+}
+
+static bool
+hsk_dns_label_decode_tlsa2(
+  const char *name,
+  const uint8_t *labels,
+  int count,
+  char *protocol,
+  uint16_t *port
+) {
+  if (count < 3)
+    return false;
+
   char label[HSK_DNS_MAX_LABEL + 1];
   int len;
 
@@ -2815,12 +3387,7 @@ hsk_dns_label_decode_tlsa(const char *name, char *protocol, uint16_t *port) {
 }
 
 bool
-hsk_dns_label_is_tlsa(const char *name) {
-  return hsk_dns_label_decode_tlsa(name, NULL, NULL);
-}
-
-static bool
-hsk_dns_label_decode_dane(const char *tag, const char *name, uint8_t *hash) {
+hsk_dns_label_decode_tlsa(const char *name, char *protocol, uint16_t *port) {
   int count = hsk_dns_label_count(name);
 
   if (count < 3)
@@ -2830,6 +3397,30 @@ hsk_dns_label_decode_dane(const char *tag, const char *name, uint8_t *hash) {
 
   assert(hsk_dns_label_split(name, labels, count) == count);
 
+  return hsk_dns_label_decode_tlsa2(name, labels, count, protocol, port);
+}
+
+bool
+hsk_dns_label_is_tlsa(const char *name) {
+  return hsk_dns_label_decode_tlsa(name, NULL, NULL);
+}
+
+bool
+hsk_dns_label_is_tlsa2(const char *name, const uint8_t *labels, int count) {
+  return hsk_dns_label_decode_tlsa2(name, labels, count, NULL, NULL);
+}
+
+static bool
+hsk_dns_label_decode_dane2(
+  const char *tag,
+  const char *name,
+  const uint8_t *labels,
+  int count,
+  uint8_t *hash
+) {
+  if (count < 3)
+    return false;
+
   char label[HSK_DNS_MAX_LABEL + 1];
   int len;
 
@@ -2852,6 +3443,20 @@ hsk_dns_label_decode_dane(const char *tag, const char *name, uint8_t *hash) {
   return true;
 }
 
+static bool
+hsk_dns_label_decode_dane(const char *tag, const char *name, uint8_t *hash) {
+  int count = hsk_dns_label_count(name);
+
+  if (count < 3)
+    return false;
+
+  uint8_t labels[count];
+
+  assert(hsk_dns_label_split(name, labels, count) == count);
+
+  return hsk_dns_label_decode_dane2(tag, name, labels, count, hash);
+}
+
 static bool
 hsk_dns_label_is_dane(const char *tag, const char *name) {
   return hsk_dns_label_decode_dane(tag, name, NULL);
@@ -2867,6 +3472,11 @@ hsk_dns_label_is_smimea(const char *name) {
   return hsk_dns_label_is_dane("_smimecert", name);
 }
 
+bool
+hsk_dns_label_is_smimea2(const char *name, const uint8_t *labels, int count) {
+  return hsk_dns_label_decode_dane2("_smimecert", name, labels, count, NULL);
+}
+
 bool
 hsk_dns_label_decode_openpgpkey(const char *name, uint8_t *hash) {
   return hsk_dns_label_decode_dane("_openpgpkey", name, hash);
@@ -2877,6 +3487,15 @@ hsk_dns_label_is_openpgpkey(const char *name) {
   return hsk_dns_label_is_dane("_openpgpkey", name);
 }
 
+bool
+hsk_dns_label_is_openpgpkey2(
+  const char *name,
+  const uint8_t *labels,
+  int count
+) {
+  return hsk_dns_label_decode_dane2("_openpgpkey", name, labels, count, NULL);
+}
+
 /*
  * DNSSEC
  */
@@ -3036,7 +3655,7 @@ hsk_dns_sign_type(
   const hsk_dns_rr_t *key,
   const uint8_t *priv
 ) {
-  if (!rrs || rrs->size >= 255 || !key || !priv)
+  if (!rrs || rrs->size >= HSK_DNS_RRS_MAX || !key || !priv)
     return false;
 
   hsk_dns_rrs_t *rrset = hsk_dns_rrs_alloc();
@@ -3044,6 +3663,9 @@ hsk_dns_sign_type(
   if (!rrset)
     return false;
 
+  // The signature lives with the records it covers.
+  rrset->arena = rrs->arena;
+
   int i;
   for (i = 0; i < rrs->size; i++) {
     hsk_dns_rr_t *rr = rrs->items[i];
@@ -3053,7 +3675,9 @@ hsk_dns_sign_type(
 
   hsk_dns_rr_t *sig = hsk_dns_sign_rrset(rrset, key, priv);
 
-  free(rrset);
+  // The records belong to `rrs`.
+  rrset->size = 0;
+  hsk_dns_rrs_free(rrset);
 
   if (!sig)
     return false;
@@ -3080,7 +3704,7 @@ hsk_dns_sign_rrset(
 
   hsk_dns_dnskey_rd_t *dnskey = (hsk_dns_dnskey_rd_t *)key->rd;
 
-  hsk_dns_rr_t *sig = hsk_dns_rr_create(HSK_DNS_RRSIG);
+  hsk_dns_rr_t *sig = hsk_dns_rr_create_in(rrset->arena, HSK_DNS_RRSIG);
 
   if (!sig)
     return NULL;
@@ -3144,14 +3768,14 @@ hsk_dns_sign_rrsig(
   if (!hsk_dns_sighash(rrset, sig, hash))
     return false;
 
-  uint8_t *sigbuf = malloc(64);
+  uint8_t *sigbuf = hsk_dns_rr_alloc_data(sig, 64);
 
   if (!sigbuf)
     return false;
 
   // Sign with secp256r1.
   if (!hsk_ecc_sign(priv, hash, sigbuf)) {
-    free(sigbuf);
+    hsk_dns_arena_free(sig->arena, sigbuf);
     return false;
   }
 
@@ -3304,12 +3928,8 @@ hsk_dns_rrs_clean(hsk_dns_rrs_t *rrs, uint16_t type) {
   if (!rrs)
     return false;
 
-  hsk_dns_rrs_t *tmp = hsk_dns_rrs_alloc();
-
-  if (!tmp)
-    return false;
-
-  int i;
+  // Compact in place, the set keeps its storage.
+  size_t i, j = 0;
   for (i = 0; i < rrs->size; i++) {
     hsk_dns_rr_t *rr = rrs->items[i];
 
@@ -3324,24 +3944,19 @@ hsk_dns_rrs_clean(hsk_dns_rrs_t *rrs, uint16_t type) {
       case HSK_DNS_NSEC3PARAM:
         if (type != rr->type) {
           hsk_dns_rr_free(rr);
-          rrs->items[i] = NULL;
           break;
         }
         // fall through
       default:
-        assert(hsk_dns_rrs_push(tmp, rr));
+        rrs->items[j++] = rr;
         break;
     }
   }
 
-  hsk_dns_rrs_init(rrs);
-
-  for (i = 0; i < tmp->size; i++) {
-    hsk_dns_rr_t *rr = tmp->items[i];
-    assert(hsk_dns_rrs_push(rrs, rr));
-  }
+  for (i = j; i < rrs->size; i++)
+    rrs->items[i] = NULL;
 
-  free(tmp);
+  rrs->size = j;
 
   return true;
 }
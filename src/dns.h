@@ -6,19 +6,44 @@
 #include <stdlib.h>
 #include "map.h"
 
+// Bump allocator owning every record of a
+// message. Records allocated from it are never
+// freed one by one, the chunks go all at once.
+typedef struct hsk_dns_chunk_s {
+  struct hsk_dns_chunk_s *next;
+  size_t size;
+  size_t pos;
+} hsk_dns_chunk_t;
+
+typedef struct hsk_dns_arena_s {
+  hsk_dns_chunk_t *head;
+} hsk_dns_arena_t;
+
+// Fixed fields first, so encoding a record
+// touches one cache line before the name.
 typedef struct hsk_dns_rr_s {
-  char name[256];
   uint16_t type;
   uint16_t class;
   uint32_t ttl;
   void *rd;
+  hsk_dns_arena_t *arena;
+  char name[256];
 } hsk_dns_rr_t;
 
 typedef hsk_dns_rr_t hsk_dns_qs_t;
 
+#define HSK_DNS_RRS_INLINE 8
+#define HSK_DNS_RRS_MAX 255
+
+// Most sections hold a few records: those live
+// inline, larger sets spill to the heap (or the
+// message arena) and grow up to RRS_MAX.
 typedef struct hsk_dns_rrs_s {
   size_t size;
-  hsk_dns_rr_t *items[255];
+  size_t cap;
+  hsk_dns_rr_t **items;
+  hsk_dns_rr_t *inline_[HSK_DNS_RRS_INLINE];
+  hsk_dns_arena_t *arena;
 } hsk_dns_rrs_t;
 
 typedef struct hsk_dns_msg_s {
@@ -39,6 +64,8 @@ typedef struct hsk_dns_msg_s {
     size_t rd_len;
     uint8_t *rd;
   } edns;
+  hsk_dns_arena_t *arena;
+  hsk_dns_arena_t arena_;
 } hsk_dns_msg_t;
 
 typedef struct hsk_dns_txt_s {
@@ -190,9 +217,31 @@ typedef struct {
   uint8_t *type_map;
 } hsk_dns_nsec_rd_t;
 
+// Inline slots, enough for typical responses.
+// Larger ones move the table to the heap.
+#define HSK_DNS_CMP_SIZE 64
+
+typedef struct {
+  uint32_t hash;
+  uint16_t off;
+} hsk_dns_cmp_entry_t;
+
+// Compression table: an open-addressed set of
+// written name suffixes and their offsets, grown
+// as needed so every suffix below offset 16384
+// stays reachable. Hits are confirmed against the
+// wire bytes already in the message. When `ptrs`
+// is set, the offset of every pointer written is
+// recorded there (up to `ptrs_size`).
 typedef struct {
-  hsk_map_t map;
   uint8_t *msg;
+  int count;
+  int size;
+  hsk_dns_cmp_entry_t *entries;
+  hsk_dns_cmp_entry_t slots[HSK_DNS_CMP_SIZE];
+  uint16_t *ptrs;
+  size_t ptrs_size;
+  size_t ptrs_count;
 } hsk_dns_cmp_t;
 
 typedef struct {
@@ -200,6 +249,17 @@ typedef struct {
   size_t msg_len;
 } hsk_dns_dmp_t;
 
+// Result of a single pass over a name, see
+// hsk_dns_name_analyze.
+typedef struct {
+  size_t len;
+  int count;
+  uint8_t labels[128];
+  bool valid;
+  int last_dirty;
+  char lower[256];
+} hsk_dns_name_info_t;
+
 // Constants
 #define HSK_DNS_MAX_NAME 255
 #define HSK_DNS_MAX_LABEL 63
@@ -209,6 +269,7 @@ typedef struct {
 #define HSK_DNS_STD_EDNS 1280
 #define HSK_DNS_MAX_EDNS 4096
 #define HSK_DNS_MAX_TCP 65535
+#define HSK_DNS_ARENA_SIZE 4096
 
 // Opcodes
 #define HSK_DNS_QUERY 0
@@ -371,6 +432,15 @@ typedef struct {
 #define HSK_DNS_OPT_LOCALSTART 65001 // Beginning of local/experimental use
 #define HSK_DNS_OPT_LOCALEND 65534 // End of local/experimental use
 
+void
+hsk_dns_arena_init(hsk_dns_arena_t *arena);
+
+void
+hsk_dns_arena_uninit(hsk_dns_arena_t *arena);
+
+void *
+hsk_dns_arena_alloc(hsk_dns_arena_t *arena, size_t size);
+
 void
 hsk_dns_msg_init(hsk_dns_msg_t *msg);
 
@@ -380,6 +450,9 @@ hsk_dns_msg_uninit(hsk_dns_msg_t *msg);
 hsk_dns_msg_t *
 hsk_dns_msg_alloc(void);
 
+hsk_dns_msg_t *
+hsk_dns_msg_alloc_arena(void);
+
 void
 hsk_dns_msg_free(hsk_dns_msg_t *msg);
 
@@ -396,7 +469,12 @@ bool
 hsk_dns_msg_encode(const hsk_dns_msg_t *msg, uint8_t **data, size_t *data_len);
 
 bool
-hsk_dns_msg_truncate(uint8_t *msg, size_t msg_len, size_t max, size_t *len);
+hsk_dns_msg_pack(
+  const hsk_dns_msg_t *msg,
+  uint8_t *data,
+  size_t max,
+  size_t *len
+);
 
 bool
 hsk_dns_msg_read(uint8_t **data, size_t *data_len, hsk_dns_msg_t *msg);
@@ -469,6 +547,12 @@ hsk_dns_rr_alloc(void);
 hsk_dns_rr_t *
 hsk_dns_rr_create(uint16_t type);
 
+hsk_dns_rr_t *
+hsk_dns_rr_create_in(hsk_dns_arena_t *arena, uint16_t type);
+
+void *
+hsk_dns_rr_alloc_data(hsk_dns_rr_t *rr, size_t size);
+
 void
 hsk_dns_rr_free(hsk_dns_rr_t *rr);
 
@@ -599,6 +683,12 @@ hsk_dns_name_parse(
 int
 hsk_dns_name_pack(const char *name, uint8_t *data);
 
+void
+hsk_dns_cmp_init(hsk_dns_cmp_t *cmp, uint8_t *msg);
+
+void
+hsk_dns_cmp_uninit(hsk_dns_cmp_t *cmp);
+
 int
 hsk_dns_name_write(const char *name, uint8_t **data, hsk_dns_cmp_t *cmp);
 
@@ -628,6 +718,17 @@ hsk_dns_name_alloc(
 bool
 hsk_dns_name_dirty(const char *name);
 
+/**
+ * Splits, validates and lowercases a name in one pass.
+ * In:      name:   pointer to string containing full domain name
+ * Out:     info:   labels as hsk_dns_label_split would find them,
+ *                  `valid` as hsk_dns_name_verify, the offset of the
+ *                  last byte hsk_dns_name_dirty rejects (or -1), and
+ *                  a lowercased copy of names up to 255 bytes
+ */
+void
+hsk_dns_name_analyze(const char *name, hsk_dns_name_info_t *info);
+
 void
 hsk_dns_name_sanitize(const char *name, char *out);
 
@@ -670,7 +771,7 @@ hsk_dns_label_count(const char *name);
 int
 hsk_dns_label_from2(
   const char *name,
-  uint8_t *labels,
+  const uint8_t *labels,
   int count,
   int index,
   char *ret
@@ -698,7 +799,7 @@ hsk_dns_label_from(const char *name, int index, char *ret);
 int
 hsk_dns_label_get2(
   const char *name,
-  uint8_t *labels,
+  const uint8_t *labels,
   int count,
   int index,
   char *ret
@@ -719,24 +820,40 @@ hsk_dns_label_decode_srv(const char *name, char *protocol, char *service);
 bool
 hsk_dns_label_is_srv(const char *name);
 
+bool
+hsk_dns_label_is_srv2(const char *name, const uint8_t *labels, int count);
+
 bool
 hsk_dns_label_decode_tlsa(const char *name, char *protocol, uint16_t *port);
 
 bool
 hsk_dns_label_is_tlsa(const char *name);
 
+bool
+hsk_dns_label_is_tlsa2(const char *name, const uint8_t *labels, int count);
+
 bool
 hsk_dns_label_decode_smimea(const char *name, uint8_t *hash);
 
 bool
 hsk_dns_label_is_smimea(const char *name);
 
+bool
+hsk_dns_label_is_smimea2(const char *name, const uint8_t *labels, int count);
+
 bool
 hsk_dns_label_decode_openpgpkey(const char *name, uint8_t *hash);
 
 bool
 hsk_dns_label_is_openpgpkey(const char *name);
 
+bool
+hsk_dns_label_is_openpgpkey2(
+  const char *name,
+  const uint8_t *labels,
+  int count
+);
+
 /*
  * DNSSEC
  */
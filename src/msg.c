@@ -318,6 +318,98 @@ hsk_proof_msg_write(const hsk_proof_msg_t *msg, uint8_t **data) {
   return s;
 }
 
+bool
+hsk_getproofs_msg_read(
+  uint8_t **data,
+  size_t *data_len,
+  hsk_getproofs_msg_t *msg
+) {
+  if (!read_bytes(data, data_len, msg->root, 32))
+    return false;
+
+  uint16_t count;
+
+  if (!read_u16(data, data_len, &count))
+    return false;
+
+  if (count > HSK_MSG_MAX_PROOFS)
+    return false;
+
+  int i;
+  for (i = 0; i < count; i++) {
+    if (!read_bytes(data, data_len, msg->keys[i], 32))
+      return false;
+  }
+
+  msg->key_count = count;
+
+  return true;
+}
+
+int
+hsk_getproofs_msg_write(const hsk_getproofs_msg_t *msg, uint8_t **data) {
+  int s = 0;
+  s += write_bytes(data, msg->root, 32);
+  s += write_u16(data, msg->key_count);
+  int i;
+  for (i = 0; i < msg->key_count; i++)
+    s += write_bytes(data, msg->keys[i], 32);
+  return s;
+}
+
+bool
+hsk_proofs_msg_read(uint8_t **data, size_t *data_len, hsk_proofs_msg_t *msg) {
+  if (!read_bytes(data, data_len, msg->root, 32))
+    return false;
+
+  uint16_t node_count;
+
+  if (!read_u16(data, data_len, &node_count))
+    return false;
+
+  if (node_count > HSK_MSG_MAX_PROOF_NODES)
+    return false;
+
+  // Proofs point into the node table.
+  const uint8_t *table = *data;
+
+  if (!hsk_proof_read_nodes(data, data_len, table, msg->nodes, node_count))
+    return false;
+
+  msg->node_count = node_count;
+
+  uint16_t proof_count;
+
+  if (!read_u16(data, data_len, &proof_count))
+    return false;
+
+  if (proof_count > HSK_MSG_MAX_PROOFS)
+    return false;
+
+  int i;
+  for (i = 0; i < proof_count; i++) {
+    hsk_proof_t *proof = &msg->proofs[i];
+
+    if (!read_bytes(data, data_len, msg->keys[i], 32))
+      return false;
+
+    if (!hsk_proof_read_shared(data, data_len, table,
+                               msg->nodes, node_count, proof)) {
+      return false;
+    }
+
+    msg->proof_count += 1;
+  }
+
+  return true;
+}
+
+int
+hsk_proofs_msg_write(const hsk_proofs_msg_t *msg, uint8_t **data) {
+  // Only ever received.
+  return -1;
+}
+
 uint8_t
 hsk_msg_cmd(const char *cmd) {
   if (strcmp(cmd, "version") == 0)
@@ -353,6 +445,12 @@ hsk_msg_cmd(const char *cmd) {
   if (strcmp(cmd, "proof") == 0)
     return HSK_MSG_PROOF;
 
+  if (strcmp(cmd, "getproofs") == 0)
+    return HSK_MSG_GETPROOFS;
+
+  if (strcmp(cmd, "proofs") == 0)
+    return HSK_MSG_PROOFS;
+
   return HSK_MSG_UNKNOWN;
 }
 
@@ -392,6 +490,12 @@ hsk_msg_str(uint8_t cmd) {
     case HSK_MSG_PROOF: {
       return "proof";
     }
+    case HSK_MSG_GETPROOFS: {
+      return "getproofs";
+    }
+    case HSK_MSG_PROOFS: {
+      return "proofs";
+    }
     default: {
       return "unknown";
     }
@@ -484,6 +588,24 @@ hsk_msg_init(hsk_msg_t *msg) {
       hsk_proof_init(&m->proof);
       break;
     }
+    case HSK_MSG_GETPROOFS: {
+      hsk_getproofs_msg_t *m = (hsk_getproofs_msg_t *)msg;
+      m->cmd = HSK_MSG_GETPROOFS;
+      memset(m->root, 0, 32);
+      m->key_count = 0;
+      break;
+    }
+    case HSK_MSG_PROOFS: {
+      hsk_proofs_msg_t *m = (hsk_proofs_msg_t *)msg;
+      m->cmd = HSK_MSG_PROOFS;
+      memset(m->root, 0, 32);
+      m->node_count = 0;
+      m->proof_count = 0;
+      int i;
+      for (i = 0; i < HSK_MSG_MAX_PROOFS; i++)
+        hsk_proof_init(&m->proofs[i]);
+      break;
+    }
   }
 }
 
@@ -536,6 +658,14 @@ hsk_msg_alloc(uint8_t cmd) {
       msg = (hsk_msg_t *)malloc(sizeof(hsk_proof_msg_t));
       break;
     }
+    case HSK_MSG_GETPROOFS: {
+      msg = (hsk_msg_t *)malloc(sizeof(hsk_getproofs_msg_t));
+      break;
+    }
+    case HSK_MSG_PROOFS: {
+      msg = (hsk_msg_t *)malloc(sizeof(hsk_proofs_msg_t));
+      break;
+    }
   }
 
   if (msg)
@@ -613,6 +743,16 @@ hsk_msg_free(hsk_msg_t *msg) {
       free(m);
       break;
     }
+    case HSK_MSG_GETPROOFS: {
+      hsk_getproofs_msg_t *m = (hsk_getproofs_msg_t *)msg;
+      free(m);
+      break;
+    }
+    case HSK_MSG_PROOFS: {
+      hsk_proofs_msg_t *m = (hsk_proofs_msg_t *)msg;
+      free(m);
+      break;
+    }
   }
 }
 
@@ -652,6 +792,12 @@ hsk_msg_read(uint8_t **data, size_t *data_len, hsk_msg_t *msg) {
     case HSK_MSG_PROOF: {
       return hsk_proof_msg_read(data, data_len, (hsk_proof_msg_t *)msg);
     }
+    case HSK_MSG_GETPROOFS: {
+      return hsk_getproofs_msg_read(data, data_len, (hsk_getproofs_msg_t *)msg);
+    }
+    case HSK_MSG_PROOFS: {
+      return hsk_proofs_msg_read(data, data_len, (hsk_proofs_msg_t *)msg);
+    }
     default: {
       return false;
     }
@@ -694,6 +840,12 @@ hsk_msg_write(const hsk_msg_t *msg, uint8_t **data) {
     case HSK_MSG_PROOF: {
       return hsk_proof_msg_write((hsk_proof_msg_t *)msg, data);
     }
+    case HSK_MSG_GETPROOFS: {
+      return hsk_getproofs_msg_write((hsk_getproofs_msg_t *)msg, data);
+    }
+    case HSK_MSG_PROOFS: {
+      return hsk_proofs_msg_write((hsk_proofs_msg_t *)msg, data);
+    }
     default: {
       return -1;
     }
@@ -21,8 +21,20 @@
 #define HSK_MSG_SENDHEADERS 12
 #define HSK_MSG_GETPROOF 26
 #define HSK_MSG_PROOF 27
+
+// Not hsd packets: hsd's types run up to 29 and
+// use 30 for UNKNOWN, so these stay well clear.
+#define HSK_MSG_GETPROOFS 200
+#define HSK_MSG_PROOFS 201
 #define HSK_MSG_UNKNOWN 255
 
+#define HSK_MSG_MAX_PROOFS 64
+
+// Node offsets are 16 bits. A node takes at most
+// 66 bytes (bit length, 32 byte prefix and hash)
+// plus a bitmap bit: 960 of them fit in 63480.
+#define HSK_MSG_MAX_PROOF_NODES 960
+
 typedef struct {
   uint8_t cmd;
 } hsk_msg_t;
@@ -93,6 +105,26 @@ typedef struct {
   hsk_proof_t proof;
 } hsk_proof_msg_t;
 
+// Batched proofs, only sent to peers advertising
+// HSK_SERVICE_MULTIPROOF. The response carries
+// the internal nodes once for all of the keys.
+typedef struct {
+  uint8_t cmd;
+  uint8_t root[32];
+  size_t key_count;
+  uint8_t keys[HSK_MSG_MAX_PROOFS][32];
+} hsk_getproofs_msg_t;
+
+typedef struct {
+  uint8_t cmd;
+  uint8_t root[32];
+  size_t node_count;
+  hsk_proof_node_t nodes[HSK_MSG_MAX_PROOF_NODES];
+  size_t proof_count;
+  uint8_t keys[HSK_MSG_MAX_PROOFS][32];
+  hsk_proof_t proofs[HSK_MSG_MAX_PROOFS];
+} hsk_proofs_msg_t;
+
 uint8_t
 hsk_msg_cmd(const char *cmd);
 
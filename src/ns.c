@@ -19,7 +19,8 @@
 #include "ns.h"
 #include "pool.h"
 #include "req.h"
-#include "tld.h"
+#include "store.h"
+#include "tld-lookup.h"
 #include "platform-net.h"
 #include "utils.h"
 #include "uv.h"
@@ -90,11 +91,17 @@ after_recv(
 static void
 after_close(uv_handle_t *handle);
 
-static int
-hsk_tld_index(const char *name);
+static void
+after_stale_timer(uv_timer_t *timer);
+
+static void
+after_cache_timer(uv_timer_t *timer);
 
-static const uint8_t *
-hsk_icann_lookup(const char *name);
+static hsk_ns_icann_t *
+hsk_ns_icann(hsk_ns_t *ns, const char *name);
+
+static void
+hsk_ns_on_root(const uint8_t *root, void *arg);
 
 /*
  * Root Nameserver
@@ -106,6 +113,7 @@ hsk_ns_init(hsk_ns_t *ns, const uv_loop_t *loop, const hsk_pool_t *pool) {
     return HSK_EBADARGS;
 
   hsk_ec_t *ec = hsk_ec_alloc();
+  int i;
 
   if (!ec)
     return HSK_ENOMEM;
@@ -117,17 +125,33 @@ hsk_ns_init(hsk_ns_t *ns, const uv_loop_t *loop, const hsk_pool_t *pool) {
   ns->socket = NULL;
   ns->ec = ec;
   hsk_cache_init(&ns->cache);
+  hsk_dns_tmpl_init(&ns->nx);
+  for (i = 0; i < HSK_NS_ROOT_TMPLS; i++)
+    hsk_dns_tmpl_init(&ns->root[i]);
+  hsk_dns_tmpl_init(&ns->synth);
+  hsk_dns_tmpl_init(&ns->synth_empty);
+  hsk_dns_tmpl_init(&ns->synth_a);
+  hsk_dns_tmpl_init(&ns->synth_aaaa);
+  ns->icann = NULL;
+  hsk_map_init_str_map(&ns->hot, free);
+  ns->prefix = NULL;
+  ns->timer = NULL;
   memset(ns->key_, 0x00, sizeof(ns->key_));
   ns->key = NULL;
   memset(ns->pubkey, 0x00, sizeof(ns->pubkey));
   memset(ns->read_buffer, 0x00, sizeof(ns->read_buffer));
   ns->receiving = false;
 
+  ns->pool->root_cb = hsk_ns_on_root;
+  ns->pool->root_arg = (void *)ns;
+
   return HSK_SUCCESS;
 }
 
 void
 hsk_ns_uninit(hsk_ns_t *ns) {
+  int i;
+
   if (!ns)
     return;
 
@@ -137,12 +161,44 @@ hsk_ns_uninit(hsk_ns_t *ns) {
   }
 
   hsk_cache_uninit(&ns->cache);
+  hsk_map_uninit(&ns->hot);
+
+  hsk_dns_tmpl_uninit(&ns->nx);
+  for (i = 0; i < HSK_NS_ROOT_TMPLS; i++)
+    hsk_dns_tmpl_uninit(&ns->root[i]);
+  hsk_dns_tmpl_uninit(&ns->synth);
+  hsk_dns_tmpl_uninit(&ns->synth_empty);
+  hsk_dns_tmpl_uninit(&ns->synth_a);
+  hsk_dns_tmpl_uninit(&ns->synth_aaaa);
+
+  if (ns->icann) {
+    for (i = 0; i < hsk_tld_count(); i++) {
+      hsk_ns_icann_t *icann = &ns->icann[i];
+
+      if (icann->res)
+        hsk_resource_free(icann->res);
+
+      hsk_dns_tmpl_uninit(&icann->referral);
+
+      if (icann->wire)
+        free(icann->wire);
+    }
+
+    free(ns->icann);
+    ns->icann = NULL;
+  }
 }
 
 bool
 hsk_ns_set_ip(hsk_ns_t *ns, const struct sockaddr *addr) {
+  int i;
+
   assert(ns);
 
+  // Root answers carry our address as glue.
+  for (i = 0; i < HSK_NS_ROOT_TMPLS; i++)
+    hsk_dns_tmpl_uninit(&ns->root[i]);
+
   if (!addr) {
     hsk_addr_init(&ns->ip_);
     ns->ip = NULL;
@@ -180,11 +236,52 @@ hsk_ns_set_key(hsk_ns_t *ns, const uint8_t *key) {
   return true;
 }
 
+bool
+hsk_ns_set_max_stale(hsk_ns_t *ns, int64_t max_stale) {
+  assert(ns);
+
+  if (max_stale < 0)
+    return false;
+
+  ns->cache.max_stale = max_stale;
+
+  return true;
+}
+
+static void
+hsk_ns_write_cache(hsk_ns_t *ns) {
+  char path[HSK_STORE_PATH_MAX];
+  hsk_store_cache_filename(ns->prefix, path);
+  hsk_cache_write_file(&ns->cache, ns->loop, path);
+}
+
 int
 hsk_ns_open(hsk_ns_t *ns, const struct sockaddr *addr) {
   if (!ns || !addr)
     return HSK_EBADARGS;
 
+  // Start warm from the last snapshot.
+  if (ns->prefix) {
+    char path[HSK_STORE_PATH_MAX];
+    hsk_store_cache_filename(ns->prefix, path);
+    hsk_cache_read_file(&ns->cache, path);
+
+    ns->timer = malloc(sizeof(uv_timer_t));
+
+    if (!ns->timer)
+      return HSK_ENOMEM;
+
+    if (uv_timer_init(ns->loop, ns->timer) != 0)
+      return HSK_EFAILURE;
+
+    ns->timer->data = (void *)ns;
+
+    if (uv_timer_start(ns->timer, after_cache_timer,
+                       HSK_NS_CACHE_INTERVAL, HSK_NS_CACHE_INTERVAL) != 0) {
+      return HSK_EFAILURE;
+    }
+  }
+
   ns->socket = malloc(sizeof(uv_udp_t));
   if (!ns->socket)
     return HSK_ENOMEM;
@@ -238,6 +335,16 @@ hsk_ns_close(hsk_ns_t *ns) {
     ns->socket = NULL;
   }
 
+  if (ns->timer) {
+    uv_timer_stop(ns->timer);
+    hsk_uv_close_free((uv_handle_t *)ns->timer);
+    ns->timer->data = NULL;
+    ns->timer = NULL;
+  }
+
+  if (ns->prefix)
+    hsk_ns_write_cache(ns);
+
   return HSK_SUCCESS;
 }
 
@@ -290,6 +397,311 @@ hsk_ns_log(hsk_ns_t *ns, const char *fmt, ...) {
   va_end(args);
 }
 
+static bool
+hsk_ns_tmpl_fresh(const hsk_dns_tmpl_t *tmpl) {
+  return tmpl->time != 0 && hsk_now() < tmpl->time + HSK_CACHE_TTL;
+}
+
+static bool
+hsk_ns_send_tmpl(
+  hsk_ns_t *ns,
+  const hsk_dns_tmpl_t *tmpl,
+  const hsk_dns_req_t *req,
+  const uint8_t *var,
+  size_t var_len
+) {
+  uint8_t *wire = NULL;
+  size_t wire_len = 0;
+
+  if (!hsk_dns_tmpl_write(tmpl, req, ns->ec, ns->key,
+                          var, var_len, &wire, &wire_len)) {
+    return false;
+  }
+
+  hsk_ns_send(ns, wire, wire_len, req->addr, true);
+
+  return true;
+}
+
+static bool
+hsk_ns_send_nx(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  // The NX proof does not depend on the name, so one
+  // signed answer is shared by every non-existent
+  // name instead of filling the cache with copies.
+  if (!hsk_ns_tmpl_fresh(&ns->nx)) {
+    hsk_dns_msg_t *msg = hsk_resource_to_nx();
+
+    if (!msg)
+      return false;
+
+    if (!hsk_dns_tmpl_compile(&ns->nx, &msg, HSK_DNS_UNKNOWN, NULL, true))
+      return false;
+  }
+
+  return hsk_ns_send_tmpl(ns, &ns->nx, req, NULL, 0);
+}
+
+static bool
+hsk_ns_send_root(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  static const uint16_t types[HSK_NS_ROOT_TMPLS] = {
+    HSK_DNS_ANY,
+    HSK_DNS_NS,
+    HSK_DNS_SOA,
+    HSK_DNS_DNSKEY,
+    HSK_DNS_DS,
+    HSK_DNS_UNKNOWN
+  };
+
+  int i;
+
+  for (i = 0; i < HSK_NS_ROOT_TMPLS - 1; i++) {
+    if (types[i] == req->type)
+      break;
+  }
+
+  hsk_dns_tmpl_t *tmpl = &ns->root[i];
+
+  if (!hsk_ns_tmpl_fresh(tmpl)) {
+    hsk_dns_msg_t *msg = hsk_resource_root(types[i], ns->ip);
+
+    if (!msg)
+      return false;
+
+    if (!hsk_dns_tmpl_compile(tmpl, &msg, types[i], NULL, true))
+      return false;
+  }
+
+  return hsk_ns_send_tmpl(ns, tmpl, req, NULL, 0);
+}
+
+// Synthesized answers only vary by owner name and
+// address. Answers for DO queries carry a signature
+// over the owner name and are built per request.
+static bool
+hsk_ns_send_synth(hsk_ns_t *ns, const hsk_dns_req_t *req) {
+  hsk_dns_tmpl_t *tmpl = &ns->synth;
+  hsk_dns_msg_t *msg = NULL;
+
+  if (req->labels == 1) {
+    if (!hsk_ns_tmpl_fresh(tmpl)) {
+      msg = hsk_dns_msg_alloc_arena();
+
+      if (!msg)
+        return false;
+
+      hsk_resource_to_empty("_synth", NULL, 0, &msg->ns);
+      hsk_dnssec_sign_zsk(&msg->ns, HSK_DNS_NSEC);
+      hsk_resource_root_to_soa(&msg->ns);
+      hsk_dnssec_sign_zsk(&msg->ns, HSK_DNS_SOA);
+
+      if (!hsk_dns_tmpl_compile(tmpl, &msg, HSK_DNS_UNKNOWN, NULL, true))
+        return false;
+    }
+
+    return hsk_ns_send_tmpl(ns, tmpl, req, NULL, 0);
+  }
+
+  if (req->dnssec)
+    return false;
+
+  uint8_t ip[16];
+  uint16_t family;
+  char synth[HSK_DNS_MAX_LABEL + 1];
+
+  hsk_dns_label_from2(req->name, req->info.labels, req->info.count,
+                      -2, synth);
+
+  if (!pointer_to_ip(synth, ip, &family))
+    return false;
+
+  bool match = req->type == HSK_DNS_ANY || req->type == family;
+
+  if (!match) {
+    // Without DO the empty proof is only the SOA.
+    tmpl = &ns->synth_empty;
+
+    if (!hsk_ns_tmpl_fresh(tmpl)) {
+      msg = hsk_dns_msg_alloc_arena();
+
+      if (!msg)
+        return false;
+
+      hsk_resource_root_to_soa(&msg->ns);
+
+      if (!hsk_dns_tmpl_compile(tmpl, &msg, HSK_DNS_UNKNOWN, NULL, false))
+        return false;
+    }
+
+    return hsk_ns_send_tmpl(ns, tmpl, req, NULL, 0);
+  }
+
+  tmpl = family == HSK_DNS_A ? &ns->synth_a : &ns->synth_aaaa;
+
+  if (!hsk_ns_tmpl_fresh(tmpl)) {
+    msg = hsk_dns_msg_alloc_arena();
+
+    if (!msg)
+      return false;
+
+    msg->flags |= HSK_DNS_AA;
+
+    hsk_dns_rr_t *rr = hsk_dns_rr_create_in(msg->an.arena, family);
+
+    if (!rr) {
+      hsk_dns_msg_free(msg);
+      return false;
+    }
+
+    rr->ttl = HSK_DEFAULT_TTL;
+    hsk_dns_rr_set_name(rr, "_synth.");
+    hsk_dns_rrs_push(&msg->an, rr);
+
+    if (!hsk_dns_tmpl_compile(tmpl, &msg, family, "_synth.", false))
+      return false;
+  }
+
+  return hsk_ns_send_tmpl(ns, tmpl, req, ip, family == HSK_DNS_A ? 4 : 16);
+}
+
+static bool
+hsk_ns_send_stale(hsk_ns_t *ns, hsk_dns_req_t *req) {
+  hsk_dns_msg_t *msg = hsk_cache_get_stale(&ns->cache, req);
+  uint8_t *wire = NULL;
+  size_t wire_len = 0;
+
+  if (!msg)
+    return false;
+
+  if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
+    hsk_ns_log(ns, "could not finalize stale msg\n");
+    return false;
+  }
+
+  hsk_ns_log(ns, "sending stale msg (%u): %u\n", req->id, wire_len);
+
+  hsk_ns_send(ns, wire, wire_len, req->addr, true);
+
+  req->answered = true;
+
+  return true;
+}
+
+static void
+hsk_ns_stop_timer(hsk_dns_req_t *req) {
+  if (!req->timer)
+    return;
+
+  uv_timer_t *timer = (uv_timer_t *)req->timer;
+
+  uv_timer_stop(timer);
+  hsk_uv_close_free((uv_handle_t *)timer);
+
+  req->timer = NULL;
+}
+
+static void
+hsk_ns_hit(hsk_ns_t *ns, const char *tld) {
+  hsk_ns_hot_t *hot = hsk_map_get(&ns->hot, tld);
+
+  if (hot) {
+    if (hot->hits < UINT32_MAX)
+      hot->hits += 1;
+    return;
+  }
+
+  // Full until the next root change decays it.
+  if (ns->hot.size >= HSK_NS_HOT_LIMIT)
+    return;
+
+  hot = malloc(sizeof(hsk_ns_hot_t));
+
+  if (!hot)
+    return;
+
+  strcpy(hot->name, tld);
+  hot->hits = 1;
+
+  if (!hsk_map_set(&ns->hot, hot->name, (void *)hot))
+    free(hot);
+}
+
+static void
+hsk_ns_after_refresh(
+  const char *name,
+  int status,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len,
+  const void *arg
+) {
+  hsk_ns_t *ns = (hsk_ns_t *)arg;
+
+  if (status != HSK_SUCCESS)
+    return;
+
+  hsk_cache_refreshed(&ns->cache, name);
+}
+
+static void
+hsk_ns_on_root(const uint8_t *root, void *arg) {
+  hsk_ns_t *ns = (hsk_ns_t *)arg;
+  hsk_ns_hot_t *top[HSK_NS_REFRESH_SIZE];
+  const char *names[HSK_NS_REFRESH_SIZE];
+  int count = 0;
+  int i;
+
+  // Pick the most queried TLDs, then halve
+  // every count so old favourites fade out.
+  hsk_map_t *map = &ns->hot;
+  hsk_map_iter_t it;
+
+  for (it = hsk_map_begin(map); it != hsk_map_end(map); it++) {
+    if (!hsk_map_exists(map, it))
+      continue;
+
+    hsk_ns_hot_t *hot = (hsk_ns_hot_t *)hsk_map_value(map, it);
+
+    if (count == HSK_NS_REFRESH_SIZE) {
+      if (hot->hits <= top[count - 1]->hits)
+        continue;
+      count -= 1;
+    }
+
+    for (i = count; i > 0 && top[i - 1]->hits < hot->hits; i--)
+      top[i] = top[i - 1];
+
+    top[i] = hot;
+    count += 1;
+  }
+
+  for (i = 0; i < count; i++)
+    names[i] = top[i]->name;
+
+  // Answers for these stay in use until
+  // their refreshed proofs land.
+  hsk_cache_set_root(&ns->cache, root, names, count);
+
+  if (count > 0) {
+    hsk_ns_log(ns, "refreshing %d names for new root\n", count);
+    hsk_pool_resolve_batch(ns->pool, names, count,
+                           hsk_ns_after_refresh, (void *)ns);
+  }
+
+  for (it = hsk_map_begin(map); it != hsk_map_end(map); it++) {
+    if (!hsk_map_exists(map, it))
+      continue;
+
+    hsk_ns_hot_t *hot = (hsk_ns_hot_t *)hsk_map_value(map, it);
+
+    hot->hits >>= 1;
+
+    if (hot->hits == 0) {
+      hsk_map_delete(map, it);
+      free(hot);
+    }
+  }
+}
+
 static void
 hsk_ns_onrecv(
   hsk_ns_t *ns,
@@ -311,6 +723,18 @@ hsk_ns_onrecv(
   size_t wire_len = 0;
   hsk_dns_msg_t *msg = NULL;
 
+  if (hsk_chain_synced(&ns->pool->chain))
+    hsk_cache_set_root(&ns->cache, hsk_chain_safe_root(&ns->pool->chain),
+                       NULL, 0);
+
+  // Count demand for proof-backed names, cached
+  // or not, so the hot ones get refreshed first.
+  if (req->labels > 0 && req->class != HSK_DNS_HS
+      && strcmp(req->tld, "_synth") != 0
+      && !hsk_tld_blacklisted(req->tld)) {
+    hsk_ns_hit(ns, req->tld);
+  }
+
   // Hit cache first.
   msg = hsk_cache_get(&ns->cache, req);
 
@@ -364,7 +788,12 @@ hsk_ns_onrecv(
   // The synth name then resolves to an A/AAAA record that is derived
   // by decoding the name itself (it does not have to be looked up).
   if (strcmp(req->tld, "_synth") == 0 && req->labels <= 2) {
-    msg = hsk_dns_msg_alloc();
+    if (hsk_ns_send_synth(ns, req)) {
+      hsk_ns_log(ns, "sending synthesized msg (%u)\n", req->id);
+      goto done;
+    }
+
+    msg = hsk_dns_msg_alloc_arena();
     should_cache = false;
 
     if (!msg)
@@ -390,7 +819,8 @@ hsk_ns_onrecv(
     char synth[HSK_DNS_MAX_LABEL + 1];
     // Will buffer overflow if req->name doesn't
     // have at least 2 labels.
-    hsk_dns_label_from(req->name, -2, synth);
+    hsk_dns_label_from2(req->name, req->info.labels, req->info.count,
+                        -2, synth);
 
     if (pointer_to_ip(synth, ip, &family)) {
       bool match = false;
@@ -434,7 +864,7 @@ hsk_ns_onrecv(
 
         msg->flags |= HSK_DNS_AA;
 
-        hsk_dns_rr_t *rr = hsk_dns_rr_create(rrtype);
+        hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, rrtype);
 
         if (!rr) {
           hsk_dns_msg_free(msg);
@@ -474,19 +904,29 @@ finalize:
 
   // Requesting a lookup.
   if (req->labels > 0) {
-    // Check blacklist.
-    if (strcmp(req->tld, "bit") == 0 // Namecoin
-        || strcmp(req->tld, "eth") == 0 // ENS
-        || strcmp(req->tld, "exit") == 0 // Tor
-        || strcmp(req->tld, "gnu") == 0 // GNUnet (GNS)
-        || strcmp(req->tld, "i2p") == 0 // Invisible Internet Project
-        || strcmp(req->tld, "onion") == 0 // Tor
-        || strcmp(req->tld, "tor") == 0 // OnioNS
-        || strcmp(req->tld, "zkey") == 0) { // GNS
+    // Check blacklist (see scripts/tld-hash.py).
+    if (hsk_tld_blacklisted(req->tld)) {
+      if (hsk_ns_send_nx(ns, req))
+        goto done;
+
       msg = hsk_resource_to_nx();
+      should_cache = false;
     } else {
       req->ns = (void *)ns;
 
+      // Give the proof a short while before
+      // falling back to a stale answer.
+      if (hsk_cache_has_stale(&ns->cache, req)) {
+        uv_timer_t *timer = malloc(sizeof(uv_timer_t));
+
+        if (timer) {
+          timer->data = (void *)req;
+          uv_timer_init(ns->loop, timer);
+          uv_timer_start(timer, after_stale_timer, HSK_NS_STALE_TIMEOUT, 0);
+          req->timer = (void *)timer;
+        }
+      }
+
       int rc = hsk_pool_resolve(
         ns->pool,
         req->tld,
@@ -496,6 +936,12 @@ finalize:
 
       if (rc != HSK_SUCCESS) {
         hsk_ns_log(ns, "pool resolve error: %s\n", hsk_strerror(rc));
+
+        hsk_ns_stop_timer(req);
+
+        if (hsk_ns_send_stale(ns, req))
+          goto done;
+
         goto fail;
       }
 
@@ -503,6 +949,9 @@ finalize:
     }
   } else {
     // Querying the root zone.
+    if (hsk_ns_send_root(ns, req))
+      goto done;
+
     msg = hsk_resource_root(req->type, ns->ip);
   }
 
@@ -547,10 +996,72 @@ done:
     hsk_dns_req_free(req);
 }
 
+// Referrals from the ICANN fallback are the same for
+// every name below the TLD. The cache still gets its
+// own copy so later queries skip the proof lookup.
+static bool
+hsk_ns_send_referral(
+  hsk_ns_t *ns,
+  hsk_dns_req_t *req,
+  hsk_ns_icann_t *icann
+) {
+  hsk_dns_tmpl_t *tmpl = &icann->referral;
+
+  if (!hsk_ns_tmpl_fresh(tmpl)) {
+    char tld[HSK_DNS_MAX_LABEL + 2];
+    size_t len = strlen(req->tld);
+
+    if (len > HSK_DNS_MAX_LABEL)
+      return false;
+
+    memcpy(tld, req->tld, len);
+    tld[len] = '.';
+    tld[len + 1] = '\0';
+
+    hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
+
+    if (!msg)
+      return false;
+
+    hsk_resource_to_referral(icann->res, tld, msg);
+
+    if (icann->wire) {
+      free(icann->wire);
+      icann->wire = NULL;
+      icann->wire_len = 0;
+    }
+
+    if (!hsk_dns_msg_encode(msg, &icann->wire, &icann->wire_len)) {
+      hsk_dns_msg_free(msg);
+      return false;
+    }
+
+    if (!hsk_dns_tmpl_compile(tmpl, &msg, HSK_DNS_UNKNOWN, NULL, true))
+      return false;
+  }
+
+  uint8_t *data = malloc(icann->wire_len);
+
+  if (data) {
+    memcpy(data, icann->wire, icann->wire_len);
+
+    if (!hsk_cache_insert_data(&ns->cache, req->name, req->type,
+                               data, icann->wire_len)) {
+      free(data);
+    }
+  }
+
+  // Already answered with stale data.
+  if (req->answered)
+    return true;
+
+  return hsk_ns_send_tmpl(ns, tmpl, req, NULL, 0);
+}
+
 static void
 hsk_ns_respond(
   hsk_ns_t *ns,
-  const hsk_dns_req_t *req,
+  hsk_dns_req_t *req,
   int status,
   const hsk_resource_t *res
 ) {
@@ -561,6 +1072,9 @@ hsk_ns_respond(
   if (status != HSK_SUCCESS) {
     // Pool resolve error.
     hsk_ns_log(ns, "resolve response error: %s\n", hsk_strerror(status));
+
+    if (req->answered || hsk_ns_send_stale(ns, req))
+      return;
   } else if (!res) {
     // Doesn't exist.
     //
@@ -576,6 +1090,11 @@ hsk_ns_respond(
     //
     // Instead, we give a phony proof, which
     // makes the root zone look empty.
+    if (!req->answered && hsk_ns_send_nx(ns, req)) {
+      hsk_ns_log(ns, "sending nxdomain (%u)\n", req->id);
+      return;
+    }
+
     msg = hsk_resource_to_nx();
 
     if (!msg)
@@ -593,7 +1112,16 @@ hsk_ns_respond(
   }
 
   if (msg) {
-    hsk_cache_insert(&ns->cache, req, msg);
+    // Negative answers are cached by the pool.
+    if (res)
+      hsk_cache_insert(&ns->cache, req, msg);
+
+    // Already answered with stale data,
+    // this was a background refresh.
+    if (req->answered) {
+      hsk_dns_msg_free(msg);
+      return;
+    }
 
     if (!hsk_dns_msg_finalize(&msg, req, ns->ec, ns->key, &wire, &wire_len)) {
       assert(!msg && !wire);
@@ -605,6 +1133,9 @@ hsk_ns_respond(
     // Send SERVFAIL in case of error.
     assert(!msg);
 
+    if (req->answered)
+      return;
+
     msg = hsk_resource_to_servfail();
 
     if (!msg) {
@@ -773,19 +1304,25 @@ after_resolve(
   hsk_dns_req_t *req = (hsk_dns_req_t *)arg;
   hsk_ns_t *ns = (hsk_ns_t *)req->ns;
   hsk_resource_t *res = NULL;
+  bool shared = false;
+
+  hsk_ns_stop_timer(req);
 
   if (status == HSK_SUCCESS) {
     if (!exists || data_len == 0) {
-      const uint8_t *item = hsk_icann_lookup(name);
+      hsk_ns_icann_t *icann = hsk_ns_icann(ns, name);
 
-      if (item) {
-        const uint8_t *raw = &item[2];
-        size_t raw_len = (((size_t)item[1]) << 8) | ((size_t)item[0]);
-
-        if (!hsk_resource_decode(raw, raw_len, &res)) {
+      if (icann) {
+        if (!icann->res) {
           hsk_ns_log(ns, "could not decode root resource for: %s\n", name);
           status = HSK_EFAILURE;
-          res = NULL;
+        } else if (req->labels > 1 && hsk_ns_send_referral(ns, req, icann)) {
+          hsk_ns_log(ns, "sending referral (%u)\n", req->id);
+          hsk_dns_req_free(req);
+          return;
+        } else {
+          res = icann->res;
+          shared = true;
         }
       }
     } else {
@@ -799,39 +1336,71 @@ after_resolve(
 
   hsk_ns_respond(ns, req, status, res);
 
-  if (res)
+  if (res && !shared)
     hsk_resource_free(res);
 
   hsk_dns_req_free(req);
 }
 
-static int
-hsk_tld_index(const char *name) {
-  int start = 0;
-  int end = HSK_TLD_SIZE - 1;
+static void
+after_cache_timer(uv_timer_t *timer) {
+  hsk_ns_t *ns = (hsk_ns_t *)timer->data;
+
+  if (!ns)
+    return;
 
-  while (start <= end) {
-    int pos = (start + end) >> 1;
-    int cmp = strcasecmp(HSK_TLD_NAMES[pos], name);
+  hsk_ns_write_cache(ns);
+}
 
-    if (cmp == 0)
-      return pos;
+static void
+after_stale_timer(uv_timer_t *timer) {
+  hsk_dns_req_t *req = (hsk_dns_req_t *)timer->data;
+  hsk_ns_t *ns = (hsk_ns_t *)req->ns;
 
-    if (cmp < 0)
-      start = pos + 1;
-    else
-      end = pos - 1;
-  }
+  hsk_ns_stop_timer(req);
 
-  return -1;
+  // The proof request stays in flight
+  // and refreshes the cache when done.
+  hsk_ns_send_stale(ns, req);
 }
 
-static const uint8_t *
-hsk_icann_lookup(const char *name) {
+static hsk_ns_icann_t *
+hsk_ns_icann(hsk_ns_t *ns, const char *name) {
   int index = hsk_tld_index(name);
 
   if (index == -1)
     return NULL;
 
-  return (const uint8_t *)HSK_TLD_DATA[index];
+  if (!ns->icann) {
+    int i;
+
+    ns->icann = malloc(hsk_tld_count() * sizeof(hsk_ns_icann_t));
+
+    if (!ns->icann)
+      return NULL;
+
+    for (i = 0; i < hsk_tld_count(); i++) {
+      hsk_ns_icann_t *icann = &ns->icann[i];
+      icann->loaded = false;
+      icann->res = NULL;
+      hsk_dns_tmpl_init(&icann->referral);
+      icann->wire = NULL;
+      icann->wire_len = 0;
+    }
+  }
+
+  hsk_ns_icann_t *icann = &ns->icann[index];
+
+  if (!icann->loaded) {
+    const uint8_t *item = hsk_tld_data(index);
+    const uint8_t *raw = &item[2];
+    size_t raw_len = (((size_t)item[1]) << 8) | ((size_t)item[0]);
+
+    if (!hsk_resource_decode(raw, raw_len, &icann->res))
+      icann->res = NULL;
+
+    icann->loaded = true;
+  }
+
+  return icann;
 }
@@ -9,6 +9,8 @@
 #include "cache.h"
 #include "ec.h"
 #include "pool.h"
+#include "req.h"
+#include "resource.h"
 
 /*
  * Defs
@@ -16,10 +18,44 @@
 
 #define HSK_UDP_BUFFER 4096
 
+// Milliseconds to wait on a proof before
+// answering with stale data (RFC 8767).
+#define HSK_NS_STALE_TIMEOUT 1800
+
+// Milliseconds between cache snapshots
+// when running with a prefix.
+#define HSK_NS_CACHE_INTERVAL (10 * 60 * 1000)
+
+// Root zone answers pre-encoded per query type:
+// ANY, NS, SOA, DNSKEY, DS and everything else.
+#define HSK_NS_ROOT_TMPLS 6
+
+// TLDs re-proven ahead of queries when the tree
+// root changes, picked by recent query count.
+#define HSK_NS_REFRESH_SIZE 100
+#define HSK_NS_HOT_LIMIT 4096
+
 /*
  * Types
  */
 
+// ICANN fallback entries are decoded on first use
+// and kept. Referrals only depend on the TLD, so
+// they are kept pre-encoded alongside.
+typedef struct hsk_ns_icann_s {
+  bool loaded;
+  hsk_resource_t *res;
+  hsk_dns_tmpl_t referral;
+  uint8_t *wire;
+  size_t wire_len;
+} hsk_ns_icann_t;
+
+// Queries seen per TLD, halved every root change.
+typedef struct hsk_ns_hot_s {
+  char name[HSK_DNS_MAX_LABEL + 1];
+  uint32_t hits;
+} hsk_ns_hot_t;
+
 typedef struct {
   uv_loop_t *loop;
   hsk_pool_t *pool;
@@ -28,6 +64,16 @@ typedef struct {
   uv_udp_t *socket;
   hsk_ec_t *ec;
   hsk_cache_t cache;
+  hsk_dns_tmpl_t nx;
+  hsk_dns_tmpl_t root[HSK_NS_ROOT_TMPLS];
+  hsk_dns_tmpl_t synth;
+  hsk_dns_tmpl_t synth_empty;
+  hsk_dns_tmpl_t synth_a;
+  hsk_dns_tmpl_t synth_aaaa;
+  hsk_ns_icann_t *icann;
+  hsk_map_t hot;
+  char *prefix;
+  uv_timer_t *timer;
   uint8_t key_[32];
   uint8_t *key;
   uint8_t pubkey[33];
@@ -51,6 +97,9 @@ hsk_ns_set_ip(hsk_ns_t *ns, const struct sockaddr *addr);
 bool
 hsk_ns_set_key(hsk_ns_t *ns, const uint8_t *key);
 
+bool
+hsk_ns_set_max_stale(hsk_ns_t *ns, int64_t max_stale);
+
 int
 hsk_ns_open(hsk_ns_t *ns, const struct sockaddr *addr);
 
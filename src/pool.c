@@ -64,6 +64,12 @@ hsk_pool_log(hsk_pool_t *pool, const char *fmt, ...);
 static int
 hsk_pool_refill(hsk_pool_t *pool);
 
+static void
+hsk_proof_item_free(hsk_proof_item_t *item);
+
+static void
+hsk_pool_on_root(const uint8_t *root, void *arg);
+
 static void
 hsk_peer_push(hsk_peer_t *peer);
 
@@ -101,6 +107,19 @@ hsk_peer_send_getproof(
   const uint8_t *root
 );
 
+static int
+hsk_peer_queue_getproof(
+  hsk_peer_t *peer,
+  const uint8_t *name_hash,
+  const uint8_t *root
+);
+
+static int
+hsk_peer_flush_getproofs(hsk_peer_t *peer);
+
+static void
+hsk_pool_flush_getproofs(hsk_pool_t *pool);
+
 static void
 on_connect(uv_connect_t *conn, int status);
 
@@ -161,6 +180,9 @@ hsk_pool_init(hsk_pool_t *pool, const uv_loop_t *loop) {
   pool->key = &pool->key_[0];
   hsk_timedata_init(&pool->td);
   hsk_chain_init(&pool->chain, &pool->td);
+  pool->chain.loop = pool->loop;
+  pool->chain.root_cb = hsk_pool_on_root;
+  pool->chain.root_arg = (void *)pool;
   hsk_addrman_init(&pool->am, &pool->td);
   pool->timer = NULL;
   pool->peer_id = 0;
@@ -171,11 +193,25 @@ hsk_pool_init(hsk_pool_t *pool, const uv_loop_t *loop) {
   pool->max_size = HSK_POOL_SIZE;
   pool->pending = NULL;
   pool->pending_count = 0;
+  hsk_map_init_hash_map(&pool->proofs,
+    (hsk_map_free_func)hsk_proof_item_free);
+  hsk_map_init_hash_map(&pool->absent.map, NULL);
+  pool->verifying = NULL;
+  pool->verified = hsk_proof_cache_alloc();
+  pool->batching = false;
+  pool->root_cb = NULL;
+  pool->root_arg = NULL;
+  pool->absent.hashes = malloc(HSK_POOL_ABSENT_LIMIT * 32);
+  pool->absent.pos = 0;
+  memset(pool->proof_root, 0x00, 32);
   pool->block_time = 0;
   pool->getheaders_time = 0;
   pool->user_agent = (char *)malloc(256);
   strcpy(pool->user_agent, HSK_USER_AGENT);
 
+  if (!pool->absent.hashes || !pool->verified)
+    return HSK_ENOMEM;
+
   return HSK_SUCCESS;
 }
 
@@ -204,6 +240,26 @@ hsk_pool_uninit(hsk_pool_t *pool) {
   pool->pending = NULL;
   pool->pending_count = 0;
 
+  // Proofs still on the threadpool are
+  // freed when they come back.
+  hsk_proof_work_t *work;
+  for (work = pool->verifying; work; work = work->next)
+    work->pool = NULL;
+
+  pool->verifying = NULL;
+
+  if (pool->verified) {
+    hsk_proof_cache_unref(pool->verified);
+    pool->verified = NULL;
+  }
+
+  hsk_map_uninit(&pool->proofs);
+  hsk_map_uninit(&pool->absent.map);
+
+  if (pool->absent.hashes) {
+    free(pool->absent.hashes);
+    pool->absent.hashes = NULL;
+  }
   hsk_map_uninit(&pool->peers);
   hsk_chain_uninit(&pool->chain);
   hsk_addrman_uninit(&pool->am);
@@ -504,6 +560,117 @@ hsk_pool_pick_prover(hsk_pool_t *pool, const uint8_t *name_hash) {
   return deterministic;
 }
 
+static void
+hsk_proof_item_free(hsk_proof_item_t *item) {
+  if (!item)
+    return;
+
+  if (item->data)
+    free(item->data);
+
+  free(item);
+}
+
+static void
+hsk_pool_clear_proofs(hsk_pool_t *pool, const uint8_t *root) {
+  hsk_map_clear(&pool->proofs);
+  hsk_map_reset(&pool->absent.map);
+  pool->absent.pos = 0;
+  memcpy(pool->proof_root, root, 32);
+}
+
+static void
+hsk_pool_add_absent(hsk_pool_t *pool, const uint8_t *name_hash) {
+  hsk_absent_t *absent = &pool->absent;
+
+  if (hsk_map_has(&absent->map, name_hash))
+    return;
+
+  uint8_t *slot = absent->hashes[absent->pos];
+
+  // Ring is full: forget the oldest name.
+  if (absent->map.size >= HSK_POOL_ABSENT_LIMIT)
+    hsk_map_del(&absent->map, slot);
+
+  memcpy(slot, name_hash, 32);
+
+  if (!hsk_map_set(&absent->map, slot, (void *)slot))
+    return;
+
+  absent->pos = (absent->pos + 1) % HSK_POOL_ABSENT_LIMIT;
+}
+
+static hsk_proof_item_t *
+hsk_pool_get_proof(
+  hsk_pool_t *pool,
+  const uint8_t *name_hash,
+  const uint8_t *root
+) {
+  // Resource data can only change when the tree root does.
+  if (memcmp(pool->proof_root, root, 32) != 0) {
+    hsk_pool_clear_proofs(pool, root);
+    return NULL;
+  }
+
+  return hsk_map_get(&pool->proofs, name_hash);
+}
+
+static void
+hsk_pool_add_proof(
+  hsk_pool_t *pool,
+  const char *name,
+  const uint8_t *name_hash,
+  const uint8_t *root,
+  bool exists,
+  const uint8_t *data,
+  size_t data_len
+) {
+  if (!hsk_chain_synced(&pool->chain))
+    return;
+
+  // Proofs against an older root are still valid
+  // answers, but not worth keeping around.
+  if (memcmp(root, hsk_chain_safe_root(&pool->chain), 32) != 0)
+    return;
+
+  if (hsk_pool_get_proof(pool, name_hash, root))
+    return;
+
+  if (!exists) {
+    hsk_pool_add_absent(pool, name_hash);
+    return;
+  }
+
+  if (pool->proofs.size >= HSK_POOL_PROOF_LIMIT)
+    hsk_map_clear(&pool->proofs);
+
+  hsk_proof_item_t *item = malloc(sizeof(hsk_proof_item_t));
+
+  if (!item)
+    return;
+
+  strcpy(item->name, name);
+  memcpy(item->hash, name_hash, 32);
+  item->exists = exists;
+  item->data = NULL;
+  item->data_len = 0;
+
+  if (data_len > 0) {
+    item->data = malloc(data_len);
+
+    if (!item->data) {
+      free(item);
+      return;
+    }
+
+    memcpy(item->data, data, data_len);
+    item->data_len = data_len;
+  }
+
+  if (!hsk_map_set(&pool->proofs, item->hash, (void *)item))
+    hsk_proof_item_free(item);
+}
+
 int
 hsk_pool_resolve(
   hsk_pool_t *pool,
@@ -511,14 +678,32 @@ hsk_pool_resolve(
   hsk_resolve_cb callback,
   const void *arg
 ) {
-  hsk_pool_log(pool, "sending proof request for: %s.\n", name);
-
   if (!hsk_chain_synced(&pool->chain)) {
     hsk_pool_log(pool, "cannot send proof request: chain not synced.\n");
     return HSK_ETIMEOUT;
   }
 
   const uint8_t *root = hsk_chain_safe_root(&pool->chain);
+
+  uint8_t hash[32];
+  hsk_hash_name(name, hash);
+
+  hsk_proof_item_t *item = hsk_pool_get_proof(pool, hash, root);
+
+  if (item) {
+    hsk_pool_log(pool, "using cached proof for: %s.\n", name);
+    callback(name, HSK_SUCCESS, item->exists, item->data, item->data_len, arg);
+    return HSK_SUCCESS;
+  }
+
+  if (hsk_map_has(&pool->absent.map, hash)) {
+    hsk_pool_log(pool, "using cached non-existence for: %s.\n", name);
+    callback(name, HSK_SUCCESS, false, NULL, 0, arg);
+    return HSK_SUCCESS;
+  }
+
+  hsk_pool_log(pool, "sending proof request for: %s.\n", name);
+
   hsk_name_req_t *req = malloc(sizeof(hsk_name_req_t));
 
   if (!req)
@@ -526,7 +711,7 @@ hsk_pool_resolve(
 
   strcpy(req->name, name);
 
-  hsk_hash_name(name, req->hash);
+  memcpy(req->hash, hash, 32);
 
   memcpy(req->root, root, 32);
 
@@ -562,7 +747,51 @@ hsk_pool_resolve(
 
   hsk_peer_log(peer, "sending proof request for: %s.\n", name);
 
-  return hsk_peer_send_getproof(peer, req->hash, root);
+  int rc = hsk_peer_queue_getproof(peer, req->hash, root);
+
+  if (rc != HSK_SUCCESS || pool->batching)
+    return rc;
+
+  return hsk_peer_flush_getproofs(peer);
+}
+
+int
+hsk_pool_resolve_batch(
+  hsk_pool_t *pool,
+  const char **names,
+  int count,
+  hsk_resolve_cb callback,
+  const void *arg
+) {
+  int rc = HSK_SUCCESS;
+  int i;
+
+  // Queue everything, then send one
+  // getproofs per peer.
+  pool->batching = true;
+
+  for (i = 0; i < count; i++) {
+    rc = hsk_pool_resolve(pool, names[i], callback, arg);
+
+    if (rc != HSK_SUCCESS)
+      break;
+  }
+
+  pool->batching = false;
+
+  hsk_pool_flush_getproofs(pool);
+
+  return rc;
+}
+
+static void
+hsk_pool_on_root(const uint8_t *root, void *arg) {
+  hsk_pool_t *pool = (hsk_pool_t *)arg;
+
+  hsk_pool_clear_proofs(pool, root);
+
+  if (pool->root_cb)
+    pool->root_cb(root, pool->root_arg);
 }
 
 static void
@@ -609,8 +838,10 @@ hsk_pool_resend(hsk_pool_t *pool) {
       continue;
     }
 
-    hsk_peer_send_getproof(peer, req->hash, root);
+    hsk_peer_queue_getproof(peer, req->hash, root);
   }
+
+  hsk_pool_flush_getproofs(pool);
 }
 
 static void
@@ -856,6 +1087,9 @@ hsk_peer_init(hsk_peer_t *peer, hsk_pool_t *pool, bool encrypted) {
   peer->proofs = 0;
   peer->height = 0;
   hsk_map_init_hash_map(&peer->names, free);
+  peer->services = 0;
+  memset(peer->batch_root, 0, 32);
+  peer->batch_count = 0;
   peer->getheaders_time = 0;
   peer->version_time = 0;
   peer->last_ping = 0;
@@ -1316,6 +1550,70 @@ hsk_peer_send_getproof(
   return hsk_peer_send(peer, (hsk_msg_t *)&msg);
 }
 
+static int
+hsk_peer_flush_getproofs(hsk_peer_t *peer) {
+  if (peer->batch_count == 0)
+    return HSK_SUCCESS;
+
+  if (peer->batch_count == 1) {
+    peer->batch_count = 0;
+    return hsk_peer_send_getproof(peer, peer->batch[0], peer->batch_root);
+  }
+
+  hsk_getproofs_msg_t msg = { .cmd = HSK_MSG_GETPROOFS };
+  hsk_msg_init((hsk_msg_t *)&msg);
+
+  memcpy(msg.root, peer->batch_root, 32);
+  memcpy(msg.keys, peer->batch, peer->batch_count * 32);
+  msg.key_count = peer->batch_count;
+
+  hsk_peer_log(peer, "sending batched proof request (%zu names)\n",
+    peer->batch_count);
+
+  peer->batch_count = 0;
+
+  return hsk_peer_send(peer, (hsk_msg_t *)&msg);
+}
+
+// Peers without batch support get one getproof
+// per name right away, others collect the names
+// until flushed or full.
+static int
+hsk_peer_queue_getproof(
+  hsk_peer_t *peer,
+  const uint8_t *name_hash,
+  const uint8_t *root
+) {
+  if (!(peer->services & HSK_SERVICE_MULTIPROOF))
+    return hsk_peer_send_getproof(peer, name_hash, root);
+
+  int rc = HSK_SUCCESS;
+
+  if (peer->batch_count > 0 && memcmp(peer->batch_root, root, 32) != 0)
+    rc = hsk_peer_flush_getproofs(peer);
+
+  if (peer->batch_count == HSK_MSG_MAX_PROOFS)
+    rc = hsk_peer_flush_getproofs(peer);
+
+  memcpy(peer->batch_root, root, 32);
+  memcpy(peer->batch[peer->batch_count], name_hash, 32);
+  peer->batch_count += 1;
+
+  return rc;
+}
+
+static void
+hsk_pool_flush_getproofs(hsk_pool_t *pool) {
+  hsk_peer_t *peer;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      continue;
+
+    hsk_peer_flush_getproofs(peer);
+  }
+}
+
 static int
 hsk_peer_handle_version(hsk_peer_t *peer, const hsk_version_msg_t *msg) {
   hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
@@ -1326,6 +1624,7 @@ hsk_peer_handle_version(hsk_peer_t *peer, const hsk_version_msg_t *msg) {
 
   hsk_timedata_add(&pool->td, &peer->addr, msg->time);
   hsk_addrman_mark_ack(&pool->am, &peer->addr, msg->services);
+  peer->services = msg->services;
 
   hsk_peer_send_verack(peer);
 
@@ -1524,68 +1823,257 @@ hsk_peer_handle_headers(hsk_peer_t *peer, const hsk_headers_msg_t *msg) {
   return HSK_SUCCESS;
 }
 
+static hsk_proof_slab_t *
+hsk_proof_slab_take(hsk_peer_t *peer) {
+  hsk_proof_slab_t *slab = malloc(sizeof(hsk_proof_slab_t));
+
+  if (!slab)
+    return NULL;
+
+  // The peer allocates a fresh buffer for
+  // the next message.
+  slab->data = peer->msg;
+  slab->refs = 1;
+  peer->msg = NULL;
+
+  return slab;
+}
+
+static void
+hsk_proof_slab_unref(hsk_proof_slab_t *slab) {
+  assert(slab && slab->refs > 0);
+
+  slab->refs -= 1;
+
+  if (slab->refs > 0)
+    return;
+
+  free(slab->data);
+  free(slab);
+}
+
+static void
+hsk_pool_verify_work(uv_work_t *req) {
+  hsk_proof_work_t *work = (hsk_proof_work_t *)req->data;
+
+  work->status = hsk_proof_verify(
+    work->root,
+    work->key,
+    &work->proof,
+    work->cache,
+    &work->exists,
+    &work->data,
+    &work->data_len
+  );
+}
+
+static hsk_peer_t *
+hsk_pool_get_peer(hsk_pool_t *pool, uint64_t id) {
+  hsk_peer_t *peer;
+
+  for (peer = pool->head; peer; peer = peer->next) {
+    if (peer->id == id)
+      return peer;
+  }
+
+  return NULL;
+}
+
+static void
+hsk_pool_after_verify(uv_work_t *req, int status) {
+  hsk_proof_work_t *work = (hsk_proof_work_t *)req->data;
+  hsk_pool_t *pool = work->pool;
+
+  if (status != 0)
+    work->status = HSK_EFAILURE;
+
+  if (!pool)
+    goto done;
+
+  hsk_proof_work_t **link = &pool->verifying;
+
+  while (*link != work)
+    link = &(*link)->next;
+
+  *link = work->next;
+
+  // The peer may have disconnected meanwhile. Closing
+  // it failed its requests with HSK_ETIMEOUT, so only
+  // the proof itself is kept below.
+  hsk_peer_t *peer = hsk_pool_get_peer(pool, work->peer_id);
+
+  if (peer && peer->state != HSK_STATE_HANDSHAKE)
+    peer = NULL;
+
+  if (work->status != HSK_SUCCESS) {
+    if (peer) {
+      hsk_peer_log(peer, "invalid proof: %s\n", hsk_strerror(work->status));
+      hsk_peer_destroy(peer);
+    }
+    goto done;
+  }
+
+  hsk_pool_add_proof(
+    pool,
+    work->name,
+    work->key,
+    work->root,
+    work->exists,
+    work->data,
+    work->data_len
+  );
+
+  if (!peer)
+    goto done;
+
+  hsk_name_req_t *reqs = hsk_map_get(&peer->names, work->key);
+
+  // Requests timed out, or were answered by a duplicate.
+  if (!reqs || memcmp(reqs->root, work->root, 32) != 0)
+    goto done;
+
+  hsk_map_del(&peer->names, work->key);
+
+  hsk_name_req_t *r, *next;
+
+  for (r = reqs; r; r = next) {
+    next = r->next;
+
+    r->callback(
+      r->name,
+      HSK_SUCCESS,
+      work->exists,
+      work->data,
+      work->data_len,
+      r->arg
+    );
+
+    free(r);
+  }
+
+  peer->proofs += 1;
+
+done:
+  hsk_proof_cache_unref(work->cache);
+  hsk_proof_uninit(&work->proof);
+  hsk_proof_slab_unref(work->slab);
+  free(work);
+}
+
 static int
-hsk_peer_handle_proof(hsk_peer_t *peer, const hsk_proof_msg_t *msg) {
-  hsk_peer_log(peer, "received proof: %s\n", hsk_hex_encode32(msg->key));
+hsk_peer_verify_proof(
+  hsk_peer_t *peer,
+  const uint8_t *root,
+  const uint8_t *key,
+  const hsk_proof_t *proof,
+  hsk_proof_slab_t *slab
+) {
+  hsk_pool_t *pool = (hsk_pool_t *)peer->pool;
 
-  hsk_name_req_t *reqs = hsk_map_get(&peer->names, msg->key);
+  hsk_peer_log(peer, "received proof: %s\n", hsk_hex_encode32(key));
+
+  hsk_name_req_t *reqs = hsk_map_get(&peer->names, key);
 
   if (!reqs) {
     hsk_peer_log(peer,
       "received unsolicited proof: %s\n",
-      hsk_hex_encode32(msg->key));
+      hsk_hex_encode32(key));
     return HSK_EBADARGS;
   }
 
   hsk_peer_log(peer, "received proof for: %s\n", reqs->name);
 
-  if (memcmp(msg->root, reqs->root, 32) != 0) {
+  if (memcmp(root, reqs->root, 32) != 0) {
     hsk_peer_log(peer, "proof hash mismatch (why?)\n");
     return HSK_EHASHMISMATCH;
   }
 
-  bool exists;
-  uint8_t *data;
-  size_t data_len;
+  hsk_proof_work_t *work = malloc(sizeof(hsk_proof_work_t));
 
-  int rc = hsk_proof_verify(
-    msg->root,
-    msg->key,
-    &msg->proof,
-    &exists,
-    &data,
-    &data_len
-  );
+  if (!work)
+    return HSK_ENOMEM;
 
-  if (rc != HSK_SUCCESS) {
-    hsk_peer_log(peer, "invalid proof: %s\n", hsk_strerror(rc));
-    return rc;
+  work->req.data = (void *)work;
+  work->pool = pool;
+  work->peer_id = peer->id;
+  strcpy(work->name, reqs->name);
+  memcpy(work->key, key, 32);
+  memcpy(work->root, root, 32);
+  work->status = HSK_SUCCESS;
+  work->exists = false;
+  work->data = NULL;
+  work->data_len = 0;
+  work->cache = pool->verified;
+  work->slab = slab;
+  work->proof = *proof;
+
+  hsk_proof_cache_ref(work->cache);
+  slab->refs += 1;
+
+  work->next = pool->verifying;
+  pool->verifying = work;
+
+  // Hashing up to 256 nodes per proof is kept off
+  // the event loop so cache hits stay responsive.
+  if (uv_queue_work(pool->loop, &work->req,
+                    hsk_pool_verify_work, hsk_pool_after_verify) != 0) {
+    hsk_pool_verify_work(&work->req);
+    hsk_pool_after_verify(&work->req, 0);
   }
 
-  hsk_map_del(&peer->names, msg->key);
+  return HSK_SUCCESS;
+}
 
-  hsk_name_req_t *req, *next;
+static int
+hsk_peer_handle_proof(hsk_peer_t *peer, const hsk_proof_msg_t *msg) {
+  hsk_proof_slab_t *slab = hsk_proof_slab_take(peer);
 
-  for (req = reqs; req; req = next) {
-    next = req->next;
+  if (!slab)
+    return HSK_ENOMEM;
 
-    req->callback(
-      req->name,
-      HSK_SUCCESS,
-      exists,
-      data,
-      data_len,
-      req->arg
+  int rc = hsk_peer_verify_proof(peer, msg->root, msg->key, &msg->proof, slab);
+
+  hsk_proof_slab_unref(slab);
+
+  return rc;
+}
+
+static int
+hsk_peer_handle_proofs(hsk_peer_t *peer, const hsk_proofs_msg_t *msg) {
+  hsk_peer_log(peer, "received batched proofs (%zu names)\n",
+    msg->proof_count);
+
+  hsk_proof_slab_t *slab = hsk_proof_slab_take(peer);
+
+  if (!slab)
+    return HSK_ENOMEM;
+
+  int rc = HSK_SUCCESS;
+  size_t i;
+
+  // A bad entry does not spoil the rest of the
+  // batch. The first error is reported once all
+  // valid proofs have been dispatched.
+  for (i = 0; i < msg->proof_count; i++) {
+    int r = hsk_peer_verify_proof(
+      peer,
+      msg->root,
+      msg->keys[i],
+      &msg->proofs[i],
+      slab
     );
 
-    free(req);
-  }
+    if (r != HSK_SUCCESS && rc == HSK_SUCCESS)
+      rc = r;
 
-  free(data);
+    // An invalid proof verified inline closes the peer.
+    if (peer->state != HSK_STATE_HANDSHAKE)
+      break;
+  }
 
-  peer->proofs += 1;
+  hsk_proof_slab_unref(slab);
 
-  return HSK_SUCCESS;
+  return rc;
 }
 
 static int
@@ -1630,6 +2118,13 @@ hsk_peer_handle_msg(hsk_peer_t *peer, const hsk_msg_t *msg) {
     case HSK_MSG_PROOF: {
       return hsk_peer_handle_proof(peer, (hsk_proof_msg_t *)msg);
     }
+    case HSK_MSG_GETPROOFS: {
+      hsk_peer_debug(peer, "cannot handle getproofs\n");
+      return HSK_SUCCESS;
+    }
+    case HSK_MSG_PROOFS: {
+      return hsk_peer_handle_proofs(peer, (hsk_proofs_msg_t *)msg);
+    }
     case HSK_MSG_UNKNOWN:
     default: {
       return HSK_SUCCESS;
@@ -13,6 +13,8 @@
 #include "ec.h"
 #include "header.h"
 #include "map.h"
+#include "msg.h"
+#include "proof.h"
 #include "timedata.h"
 
 /*
@@ -28,6 +30,8 @@
 #define HSK_STATE_HANDSHAKE 5
 #define HSK_STATE_DISCONNECTING 6
 #define HSK_MAX_AGENT 255
+#define HSK_POOL_PROOF_LIMIT 10000
+#define HSK_POOL_ABSENT_LIMIT 20000
 
 /*
  * Types
@@ -52,6 +56,50 @@ typedef struct hsk_name_req_s {
   struct hsk_name_req_s *next;
 } hsk_name_req_t;
 
+typedef struct hsk_proof_item_s {
+  char name[256];
+  uint8_t hash[32];
+  bool exists;
+  uint8_t *data;
+  size_t data_len;
+} hsk_proof_item_t;
+
+// Names proven not to exist under the current
+// root. Kept in a ring with its own budget, so a
+// flood of random names only evicts its own kind.
+typedef struct hsk_absent_s {
+  uint8_t (*hashes)[32];
+  uint32_t pos;
+  hsk_map_t map;
+} hsk_absent_t;
+
+// Message bytes taken over from a peer. Proofs
+// and resource data point into them, a batch
+// shares one slab between its work items.
+typedef struct hsk_proof_slab_s {
+  uint8_t *data;
+  int refs;
+} hsk_proof_slab_t;
+
+// Proof handed to the libuv threadpool for
+// verification.
+typedef struct hsk_proof_work_s {
+  uv_work_t req;
+  struct hsk_pool_s *pool;
+  uint64_t peer_id;
+  char name[256];
+  uint8_t key[32];
+  uint8_t root[32];
+  hsk_proof_slab_t *slab;
+  hsk_proof_cache_t *cache;
+  hsk_proof_t proof;
+  int status;
+  bool exists;
+  const uint8_t *data;
+  size_t data_len;
+  struct hsk_proof_work_s *next;
+} hsk_proof_work_t;
+
 typedef struct hsk_peer_s {
   void *pool;
   hsk_chain_t *chain;
@@ -68,6 +116,10 @@ typedef struct hsk_peer_s {
   int proofs;
   int64_t height;
   hsk_map_t names;
+  uint64_t services;
+  uint8_t batch_root[32];
+  uint8_t batch[HSK_MSG_MAX_PROOFS][32];
+  size_t batch_count;
   int64_t getheaders_time;
   int64_t version_time;
   int64_t last_ping;
@@ -104,6 +156,14 @@ typedef struct hsk_pool_s {
   int max_size;
   hsk_name_req_t *pending;
   int pending_count;
+  hsk_map_t proofs;
+  hsk_absent_t absent;
+  uint8_t proof_root[32];
+  hsk_proof_work_t *verifying;
+  hsk_proof_cache_t *verified;
+  bool batching;
+  hsk_chain_root_cb root_cb;
+  void *root_arg;
   int64_t block_time;
   int64_t getheaders_time;
   char *user_agent;
@@ -153,4 +213,13 @@ hsk_pool_resolve(
   hsk_resolve_cb callback,
   const void *arg
 );
+
+int
+hsk_pool_resolve_batch(
+  hsk_pool_t *pool,
+  const char **names,
+  int count,
+  hsk_resolve_cb callback,
+  const void *arg
+);
 #endif
@@ -51,9 +51,9 @@ read_bitlen(uint8_t **data, size_t *data_len, uint16_t *bits, size_t *bytes) {
 void
 hsk_proof_init(hsk_proof_t *proof) {
   assert(proof);
+  proof->data = NULL;
   proof->type = HSK_PROOF_DEADEND;
   proof->depth = 0;
-  proof->nodes = NULL;
   proof->node_count = 0;
   proof->prefix = NULL;
   proof->prefix_size = 0;
@@ -76,44 +76,8 @@ hsk_proof_alloc(void) {
 void
 hsk_proof_uninit(hsk_proof_t *proof) {
   assert(proof);
-
-  if (proof->nodes) {
-    free(proof->nodes);
-    proof->nodes = NULL;
-    proof->node_count = 0;
-  }
-
-  if (proof->prefix) {
-    free(proof->prefix);
-    proof->prefix = NULL;
-    proof->prefix_size = 0;
-  }
-
-  if (proof->left) {
-    free(proof->left);
-    proof->left = NULL;
-  }
-
-  if (proof->right) {
-    free(proof->right);
-    proof->right = NULL;
-  }
-
-  if (proof->nx_key) {
-    free(proof->nx_key);
-    proof->nx_key = NULL;
-  }
-
-  if (proof->nx_hash) {
-    free(proof->nx_hash);
-    proof->nx_hash = NULL;
-  }
-
-  if (proof->value) {
-    free(proof->value);
-    proof->value = NULL;
-    proof->value_size = 0;
-  }
+  // Nothing is owned, drop the views.
+  hsk_proof_init(proof);
 }
 
 void
@@ -124,63 +88,58 @@ hsk_proof_free(hsk_proof_t *proof) {
 }
 
 bool
-hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
-  assert(data && proof);
-  assert(proof->node_count == 0);
-
-  uint16_t field;
-
-  if (!read_u16(data, data_len, &field))
-    return false;
-
-  proof->type = field >> 14;
-  proof->depth = field & ~(3 << 14);
-
-  if (proof->depth > 256)
-    return false;
-
-  uint16_t count;
-
-  if (!read_u16(data, data_len, &count))
-    return false;
-
-  if (count > 256)
-    return false;
-
+hsk_proof_read_nodes(
+  uint8_t **data,
+  size_t *data_len,
+  const uint8_t *start,
+  hsk_proof_node_t *nodes,
+  size_t count
+) {
   size_t bsize = (count + 7) / 8;
   uint8_t *map;
 
   if (!slice_bytes(data, data_len, &map, bsize))
     return false;
 
-  proof->nodes = calloc(count, sizeof(hsk_proof_node_t));
-
-  if (count > 0 && !proof->nodes)
-    return false;
-
-  proof->node_count = count;
-
   size_t i;
   for (i = 0; i < count; i++) {
-    hsk_proof_node_t *item = &proof->nodes[i];
+    hsk_proof_node_t *item = &nodes[i];
+    uint8_t *ptr;
+
+    item->prefix = 0;
+    item->prefix_size = 0;
 
     if (HSK_HAS_BIT(map, i)) {
       uint16_t size;
       size_t bytes;
 
       if (!read_bitlen(data, data_len, &size, &bytes))
-        goto fail;
+        return false;
 
-      if (!read_bytes(data, data_len, &item->prefix[0], bytes))
-        goto fail;
+      if (!slice_bytes(data, data_len, &ptr, bytes))
+        return false;
 
+      item->prefix = (uint16_t)(ptr - start);
       item->prefix_size = size;
     }
 
-    if (!read_bytes(data, data_len, &item->node[0], 32))
-      goto fail;
+    if (!slice_bytes(data, data_len, &ptr, 32))
+      return false;
+
+    // Offsets are 16 bits. A single proof has at
+    // most 256 nodes of up to 66 bytes each, and
+    // batched node tables are capped to fit too.
+    if (ptr - start > UINT16_MAX)
+      return false;
+
+    item->node = (uint16_t)(ptr - start);
   }
 
+  return true;
+}
+
+static bool
+hsk_proof_read_leaf(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
   switch (proof->type) {
     case HSK_PROOF_DEADEND: {
       break;
@@ -191,41 +150,43 @@ hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
       size_t bytes;
 
       if (!read_bitlen(data, data_len, &size, &bytes))
-        goto fail;
+        return false;
 
-      if (!alloc_bytes(data, data_len, &proof->prefix, bytes))
-        goto fail;
+      if (!slice_bytes(data, data_len, (uint8_t **)&proof->prefix, bytes))
+        return false;
 
       proof->prefix_size = size;
 
-      if (!alloc_bytes(data, data_len, &proof->left, 32))
-        goto fail;
+      if (!slice_bytes(data, data_len, (uint8_t **)&proof->left, 32))
+        return false;
 
-      if (!alloc_bytes(data, data_len, &proof->right, 32))
-        goto fail;
+      if (!slice_bytes(data, data_len, (uint8_t **)&proof->right, 32))
+        return false;
 
       break;
     }
 
     case HSK_PROOF_COLLISION: {
-      if (!alloc_bytes(data, data_len, &proof->nx_key, 32))
-        goto fail;
+      if (!slice_bytes(data, data_len, (uint8_t **)&proof->nx_key, 32))
+        return false;
 
-      if (!alloc_bytes(data, data_len, &proof->nx_hash, 32))
-        goto fail;
+      if (!slice_bytes(data, data_len, (uint8_t **)&proof->nx_hash, 32))
+        return false;
 
       break;
     }
 
     case HSK_PROOF_EXISTS: {
       if (!read_u16(data, data_len, &proof->value_size))
-        goto fail;
+        return false;
 
       if (proof->value_size > HSK_MAX_DATA_SIZE)
-        goto fail;
+        return false;
 
-      if (!alloc_bytes(data, data_len, &proof->value, proof->value_size))
-        goto fail;
+      if (!slice_bytes(data, data_len, (uint8_t **)&proof->value,
+                       proof->value_size)) {
+        return false;
+      }
 
       break;
     }
@@ -237,6 +198,103 @@ hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
   }
 
   return true;
+}
+
+static bool
+hsk_proof_read_field(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
+  uint16_t field;
+
+  if (!read_u16(data, data_len, &field))
+    return false;
+
+  proof->type = field >> 14;
+  proof->depth = field & ~(3 << 14);
+
+  if (proof->depth > 256)
+    return false;
+
+  return true;
+}
+
+bool
+hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof) {
+  assert(data && proof);
+  assert(proof->node_count == 0);
+
+  const uint8_t *start = *data;
+
+  proof->data = start;
+
+  if (!hsk_proof_read_field(data, data_len, proof))
+    return false;
+
+  uint16_t count;
+
+  if (!read_u16(data, data_len, &count))
+    return false;
+
+  if (count > HSK_PROOF_MAX_NODES)
+    return false;
+
+  if (!hsk_proof_read_nodes(data, data_len, start, proof->nodes, count))
+    goto fail;
+
+  proof->node_count = count;
+
+  if (!hsk_proof_read_leaf(data, data_len, proof))
+    goto fail;
+
+  return true;
+
+fail:
+  hsk_proof_uninit(proof);
+  return false;
+}
+
+bool
+hsk_proof_read_shared(
+  uint8_t **data,
+  size_t *data_len,
+  const uint8_t *table,
+  const hsk_proof_node_t *nodes,
+  size_t node_count,
+  hsk_proof_t *proof
+) {
+  assert(data && table && proof);
+  assert(proof->node_count == 0);
+
+  proof->data = table;
+
+  if (!hsk_proof_read_field(data, data_len, proof))
+    return false;
+
+  uint16_t count;
+
+  if (!read_u16(data, data_len, &count))
+    return false;
+
+  if (count > HSK_PROOF_MAX_NODES)
+    return false;
+
+  size_t i;
+  for (i = 0; i < count; i++) {
+    uint16_t index;
+
+    if (!read_u16(data, data_len, &index))
+      goto fail;
+
+    if (index >= node_count)
+      goto fail;
+
+    proof->nodes[i] = nodes[index];
+  }
+
+  proof->node_count = count;
+
+  if (!hsk_proof_read_leaf(data, data_len, proof))
+    goto fail;
+
+  return true;
 
 fail:
   hsk_proof_uninit(proof);
@@ -334,11 +392,136 @@ hsk_proof_has(
   return c == prefix_size;
 }
 
+/*
+ * Verified Node Cache
+ */
+
+hsk_proof_cache_t *
+hsk_proof_cache_alloc(void) {
+  hsk_proof_cache_t *cache = malloc(sizeof(hsk_proof_cache_t));
+
+  if (!cache)
+    return NULL;
+
+  if (uv_mutex_init(&cache->lock) != 0) {
+    free(cache);
+    return NULL;
+  }
+
+  memset(cache->root, 0x00, 32);
+  memset(cache->entries, 0x00, sizeof(cache->entries));
+  cache->refs = 1;
+
+  return cache;
+}
+
+// References are only taken and dropped on the
+// event loop, the lock guards the entries.
+void
+hsk_proof_cache_ref(hsk_proof_cache_t *cache) {
+  assert(cache && cache->refs > 0);
+  cache->refs += 1;
+}
+
+void
+hsk_proof_cache_unref(hsk_proof_cache_t *cache) {
+  assert(cache && cache->refs > 0);
+
+  cache->refs -= 1;
+
+  if (cache->refs > 0)
+    return;
+
+  uv_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+static hsk_proof_cache_entry_t *
+hsk_proof_cache_slot(hsk_proof_cache_t *cache, const uint8_t *hash) {
+  // Node hashes are uniformly distributed already.
+  uint32_t index = ((uint32_t)hash[0] << 8) | hash[1];
+  return &cache->entries[index % HSK_PROOF_CACHE_SIZE];
+}
+
+static bool
+hsk_proof_path_equal(const uint8_t *a, const uint8_t *b, uint16_t depth) {
+  size_t bytes = depth >> 3;
+  uint8_t bits = depth & 7;
+
+  if (memcmp(a, b, bytes) != 0)
+    return false;
+
+  if (bits == 0)
+    return true;
+
+  uint8_t mask = 0xff << (8 - bits);
+
+  return (a[bytes] & mask) == (b[bytes] & mask);
+}
+
+static bool
+hsk_proof_cache_has(
+  hsk_proof_cache_t *cache,
+  const uint8_t *root,
+  const uint8_t *key,
+  uint16_t depth,
+  const uint8_t *hash
+) {
+  bool found = false;
+
+  uv_mutex_lock(&cache->lock);
+
+  hsk_proof_cache_entry_t *entry = hsk_proof_cache_slot(cache, hash);
+
+  if (entry->valid
+      && entry->depth == depth
+      && memcmp(cache->root, root, 32) == 0
+      && memcmp(entry->hash, hash, 32) == 0
+      && hsk_proof_path_equal(entry->path, key, depth)) {
+    found = true;
+  }
+
+  uv_mutex_unlock(&cache->lock);
+
+  return found;
+}
+
+static void
+hsk_proof_cache_add(
+  hsk_proof_cache_t *cache,
+  const uint8_t *root,
+  const uint8_t *key,
+  const uint16_t *depths,
+  const uint8_t (*hashes)[32],
+  size_t count
+) {
+  size_t i;
+
+  uv_mutex_lock(&cache->lock);
+
+  if (memcmp(cache->root, root, 32) != 0) {
+    memset(cache->entries, 0x00, sizeof(cache->entries));
+    memcpy(cache->root, root, 32);
+  }
+
+  for (i = 0; i < count; i++) {
+    hsk_proof_cache_entry_t *entry = hsk_proof_cache_slot(cache, hashes[i]);
+
+    memcpy(entry->hash, hashes[i], 32);
+    memset(entry->path, 0x00, 32);
+    memcpy(entry->path, key, (depths[i] + 7) / 8);
+    entry->depth = depths[i];
+    entry->valid = true;
+  }
+
+  uv_mutex_unlock(&cache->lock);
+}
+
 static bool
 hsk_parse_namestate(
   uint8_t *data,
   size_t data_len,
-  uint8_t **res,
+  const uint8_t **res,
   size_t *res_len
 ) {
   if (data_len > HSK_MAX_DATA_SIZE)
@@ -359,7 +542,7 @@ hsk_parse_namestate(
   if (!read_u16(&data, &data_len, &res_size))
     return false;
 
-  if (!alloc_bytes(&data, &data_len, res, res_size))
+  if (!slice_bytes(&data, &data_len, (uint8_t **)res, res_size))
     return false;
 
   *res_len = res_size;
@@ -372,8 +555,9 @@ hsk_proof_verify(
   const uint8_t *root,
   const uint8_t *key,
   const hsk_proof_t *proof,
+  hsk_proof_cache_t *cache,
   bool *exists,
-  uint8_t **data,
+  const uint8_t **data,
   size_t *data_len
 ) {
   if (root == NULL || key == NULL || proof == NULL)
@@ -382,8 +566,8 @@ hsk_proof_verify(
   uint8_t leaf[32];
 
   assert(proof->depth <= 256);
-  assert(proof->nodes || proof->node_count == 0);
-  assert(proof->node_count <= 256);
+  assert(proof->data || proof->node_count == 0);
+  assert(proof->node_count <= HSK_PROOF_MAX_NODES);
   assert(proof->value_size <= HSK_MAX_DATA_SIZE);
 
   // Re-create the leaf.
@@ -394,10 +578,10 @@ hsk_proof_verify(
     }
 
     case HSK_PROOF_SHORT: {
-      uint8_t *prefix = proof->prefix;
+      const uint8_t *prefix = proof->prefix;
       uint16_t prefix_size = proof->prefix_size;
-      uint8_t *left = proof->left;
-      uint8_t *right = proof->right;
+      const uint8_t *left = proof->left;
+      const uint8_t *right = proof->right;
 
       assert(prefix);
       assert(prefix_size != 0);
@@ -438,12 +622,19 @@ hsk_proof_verify(
   int depth = (int)proof->depth;
   int i = ((int)proof->node_count) - 1;
 
+  // Upper nodes computed on the way, to be
+  // remembered once the root is reached.
+  uint8_t hashes[HSK_PROOF_CACHE_DEPTH + 1][32];
+  uint16_t depths[HSK_PROOF_CACHE_DEPTH + 1];
+  size_t count = 0;
+  bool known = false;
+
   // Traverse bits right to left.
   for (; i >= 0; i--) {
-    hsk_proof_node_t *item = &proof->nodes[i];
-    uint8_t *prefix = &item->prefix[0];
+    const hsk_proof_node_t *item = &proof->nodes[i];
+    const uint8_t *prefix = proof->data + item->prefix;
     uint16_t prefix_size = item->prefix_size;
-    uint8_t *node = &item->node[0];
+    const uint8_t *node = proof->data + item->node;
 
     if (depth < prefix_size + 1)
       return HSK_ENEGDEPTH;
@@ -459,16 +650,39 @@ hsk_proof_verify(
 
     if (!hsk_proof_has(prefix, prefix_size, key, depth))
       return HSK_EPATHMISMATCH;
+
+    if (!cache || depth > HSK_PROOF_CACHE_DEPTH || depth == 0)
+      continue;
+
+    // The same node at the same position was
+    // already proven to chain to this root.
+    if (hsk_proof_cache_has(cache, root, key, depth, next)) {
+      known = true;
+      break;
+    }
+
+    assert(count <= HSK_PROOF_CACHE_DEPTH);
+    memcpy(hashes[count], next, 32);
+    depths[count] = depth;
+    count += 1;
   }
 
-  if (depth != 0)
-    return HSK_ETOODEEP;
+  if (!known) {
+    if (depth != 0)
+      return HSK_ETOODEEP;
 
-  if (memcmp(next, root, 32) != 0)
-    return HSK_EHASHMISMATCH;
+    if (memcmp(next, root, 32) != 0)
+      return HSK_EHASHMISMATCH;
+  }
+
+  if (cache && count > 0)
+    hsk_proof_cache_add(cache, root, key, depths, hashes, count);
 
   if (proof->type == HSK_PROOF_EXISTS) {
-    if (!hsk_parse_namestate(proof->value, proof->value_size, data, data_len))
+    uint8_t *value = (uint8_t *)proof->value;
+
+    // The resource is returned as a slice of the proof.
+    if (!hsk_parse_namestate(value, proof->value_size, data, data_len))
       return HSK_EENCODING;
 
     *exists = true;
@@ -4,33 +4,70 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "uv.h"
+
 #define HSK_PROOF_DEADEND 0
 #define HSK_PROOF_SHORT 1
 #define HSK_PROOF_COLLISION 2
 #define HSK_PROOF_EXISTS 3
 #define HSK_PROOF_UNKNOWN 4
+#define HSK_PROOF_MAX_NODES 256
+#define HSK_PROOF_CACHE_SIZE 4096
+#define HSK_PROOF_CACHE_DEPTH 12
 
+// A proof is a view over the wire bytes it was
+// read from, which must outlive it. Nodes are
+// stored as offsets from `data`, every other
+// field points directly into the buffer.
 typedef struct hsk_proof_node_s {
-  uint8_t prefix[32];
+  uint16_t prefix;
   uint16_t prefix_size;
-  uint8_t node[32];
+  uint16_t node;
 } hsk_proof_node_t;
 
 typedef struct hsk_proof_s {
+  const uint8_t *data;
   uint8_t type;
   uint16_t depth;
-  hsk_proof_node_t *nodes;
+  hsk_proof_node_t nodes[HSK_PROOF_MAX_NODES];
   uint16_t node_count;
-  uint8_t *prefix;
+  const uint8_t *prefix;
   uint16_t prefix_size;
-  uint8_t *left;
-  uint8_t *right;
-  uint8_t *nx_key;
-  uint8_t *nx_hash;
-  uint8_t *value;
+  const uint8_t *left;
+  const uint8_t *right;
+  const uint8_t *nx_key;
+  const uint8_t *nx_hash;
+  const uint8_t *value;
   uint16_t value_size;
 } hsk_proof_t;
 
+// Internal nodes already shown to chain up to
+// `root`, for nodes no deeper than CACHE_DEPTH.
+// Verification stops at the first one it meets.
+// Indexed by the node hash, shared by threads.
+typedef struct hsk_proof_cache_entry_s {
+  uint8_t hash[32];
+  uint8_t path[32];
+  uint16_t depth;
+  bool valid;
+} hsk_proof_cache_entry_t;
+
+typedef struct hsk_proof_cache_s {
+  uv_mutex_t lock;
+  uint8_t root[32];
+  int refs;
+  hsk_proof_cache_entry_t entries[HSK_PROOF_CACHE_SIZE];
+} hsk_proof_cache_t;
+
+hsk_proof_cache_t *
+hsk_proof_cache_alloc(void);
+
+void
+hsk_proof_cache_ref(hsk_proof_cache_t *cache);
+
+void
+hsk_proof_cache_unref(hsk_proof_cache_t *cache);
+
 void
 hsk_proof_init(hsk_proof_t *proof);
 
@@ -49,13 +86,35 @@ hsk_proof_read(uint8_t **data, size_t *data_len, hsk_proof_t *proof);
 bool
 hsk_proof_decode(const uint8_t *data, size_t data_len, hsk_proof_t *proof);
 
+// Batched proofs share one node table, every
+// proof then lists its path as table indexes.
+bool
+hsk_proof_read_nodes(
+  uint8_t **data,
+  size_t *data_len,
+  const uint8_t *start,
+  hsk_proof_node_t *nodes,
+  size_t count
+);
+
+bool
+hsk_proof_read_shared(
+  uint8_t **data,
+  size_t *data_len,
+  const uint8_t *table,
+  const hsk_proof_node_t *nodes,
+  size_t node_count,
+  hsk_proof_t *proof
+);
+
 int
 hsk_proof_verify(
   const uint8_t *root,
   const uint8_t *key,
   const hsk_proof_t *proof,
+  hsk_proof_cache_t *cache,
   bool *exists,
-  uint8_t **data,
+  const uint8_t **data,
   size_t *data_len
 );
 #endif
@@ -8,6 +8,7 @@
 #include <stdio.h>
 
 #include "addr.h"
+#include "bio.h"
 #include "constants.h"
 #include "dns.h"
 #include "ec.h"
@@ -23,6 +24,7 @@ hsk_dns_req_init(hsk_dns_req_t *req) {
   req->id = 0;
   req->labels = 0;
   memset(req->name, 0x00, sizeof(req->name));
+  hsk_dns_name_analyze(req->name, &req->info);
   req->type = 0;
   req->class = 0;
   req->rd = false;
@@ -31,6 +33,8 @@ hsk_dns_req_init(hsk_dns_req_t *req) {
   req->edns = false;
   req->dnssec = false;
   memset(req->tld, 0x00, sizeof(req->tld));
+  req->timer = NULL;
+  req->answered = false;
   memset(&req->ss, 0x00, sizeof(struct sockaddr_storage));
   req->addr = (struct sockaddr *)&req->ss;
 }
@@ -55,89 +59,196 @@ hsk_dns_req_free(hsk_dns_req_t *req) {
   free(req);
 }
 
-hsk_dns_req_t *
-hsk_dns_req_create(
-  const uint8_t *data,
-  size_t data_len,
-  const struct sockaddr *addr
+static void
+hsk_dns_req_set(
+  hsk_dns_req_t *req,
+  uint16_t id,
+  uint16_t flags,
+  bool edns,
+  uint16_t edns_size,
+  uint16_t edns_flags
 ) {
-  hsk_dns_req_t *req = NULL;
-  hsk_dns_msg_t *msg = NULL;
+  req->id = id;
+  req->rd = (flags & HSK_DNS_RD) != 0;
+  req->cd = (flags & HSK_DNS_CD) != 0;
+  req->ad = (flags & HSK_DNS_AD) != 0;
+  req->edns = edns;
+  req->max_size = HSK_DNS_MAX_UDP;
+  if (edns && edns_size >= HSK_DNS_MAX_UDP) {
+    req->max_size = edns_size;
+    if (req->max_size > HSK_DNS_MAX_EDNS)
+      req->max_size = HSK_DNS_MAX_EDNS;
+  }
+  req->dnssec = (edns_flags & HSK_DNS_DO) != 0;
+}
 
-  req = hsk_dns_req_alloc();
+// Reads a plain query (one question, at most an
+// OPT record) straight off the wire without
+// building a message. Anything else returns
+// false and goes through the full decoder.
+bool
+hsk_dns_req_read(hsk_dns_req_t *req, const uint8_t *data, size_t data_len) {
+  uint8_t *buf = (uint8_t *)data;
+  size_t len = data_len;
+  uint16_t id, flags, qdcount, ancount, nscount, arcount;
+
+  hsk_dns_dmp_t dmp;
+  dmp.msg = buf;
+  dmp.msg_len = len;
+
+  if (!read_u16be(&buf, &len, &id)
+      || !read_u16be(&buf, &len, &flags)
+      || !read_u16be(&buf, &len, &qdcount)
+      || !read_u16be(&buf, &len, &ancount)
+      || !read_u16be(&buf, &len, &nscount)
+      || !read_u16be(&buf, &len, &arcount)) {
+    return false;
+  }
 
-  if (!req)
-    goto fail;
+  if (((flags >> 11) & 0x0f) != HSK_DNS_QUERY
+      || (flags & 0x0f) != HSK_DNS_NOERROR
+      || qdcount != 1
+      || ancount != 0
+      || nscount != 0
+      || arcount > 1) {
+    return false;
+  }
+
+  if (!hsk_dns_name_read(&buf, &len, &dmp, req->name))
+    return false;
+
+  if (!read_u16be(&buf, &len, &req->type))
+    return false;
+
+  if (!read_u16be(&buf, &len, &req->class))
+    return false;
+
+  bool edns = false;
+  uint16_t edns_size = 0;
+  uint16_t edns_flags = 0;
+
+  if (arcount == 1) {
+    uint8_t root;
+    uint16_t type;
+    uint32_t ttl;
+    uint16_t rdlen;
+
+    // Only an OPT record owned by the root.
+    if (!read_u8(&buf, &len, &root) || root != 0x00)
+      return false;
+
+    if (!read_u16be(&buf, &len, &type) || type != HSK_DNS_OPT)
+      return false;
+
+    if (!read_u16be(&buf, &len, &edns_size))
+      return false;
+
+    if (!read_u32be(&buf, &len, &ttl))
+      return false;
+
+    if (!read_u16be(&buf, &len, &rdlen) || len < rdlen)
+      return false;
+
+    // Extended rcode.
+    if ((ttl >> 24) != 0)
+      return false;
+
+    edns = true;
+    edns_flags = ttl & 0xffff;
+  }
+
+  hsk_dns_req_set(req, id, flags, edns, edns_size, edns_flags);
+
+  return true;
+}
+
+bool
+hsk_dns_req_decode(hsk_dns_req_t *req, const uint8_t *data, size_t data_len) {
+  hsk_dns_msg_t *msg = NULL;
 
   if (!hsk_dns_msg_decode(data, data_len, &msg))
-    goto fail;
+    return false;
 
   if (msg->opcode != HSK_DNS_QUERY
       || msg->code != HSK_DNS_NOERROR
       || msg->qd.size != 1
       || msg->an.size != 0
       || msg->ns.size != 0) {
-    goto fail;
+    hsk_dns_msg_free(msg);
+    return false;
   }
 
   // Grab the first question.
   hsk_dns_qs_t *qs = msg->qd.items[0];
 
+  strcpy(req->name, qs->name);
+  req->type = qs->type;
+  req->class = qs->class;
+
+  hsk_dns_req_set(
+    req,
+    msg->id,
+    msg->flags,
+    msg->edns.enabled,
+    msg->edns.size,
+    msg->edns.flags
+  );
+
+  hsk_dns_msg_free(msg);
+
+  return true;
+}
+
+hsk_dns_req_t *
+hsk_dns_req_create(
+  const uint8_t *data,
+  size_t data_len,
+  const struct sockaddr *addr
+) {
+  hsk_dns_req_t *req = hsk_dns_req_alloc();
+
+  if (!req)
+    return NULL;
+
+  if (!hsk_dns_req_read(req, data, data_len)
+      && !hsk_dns_req_decode(req, data, data_len)) {
+    goto fail;
+  }
+
 #if 0
-  if (qs->class != HSK_DNS_IN)
+  if (req->class != HSK_DNS_IN)
     goto fail;
 
   // Don't allow dirty names.
-  if (hsk_dns_name_dirty(qs->name))
+  if (hsk_dns_name_dirty(req->name))
     goto fail;
 #endif
 
-  // Check for a TLD.
-  hsk_dns_label_get(qs->name, -1, req->tld);
+  // Split, check and lowercase the name once.
+  hsk_dns_name_info_t *info = &req->info;
+
+  hsk_dns_name_analyze(req->name, info);
+
+  // Check for a lowercased TLD.
+  int tld_len = hsk_dns_label_get2(info->lower, info->labels,
+                                   info->count, -1, req->tld);
 
   // Don't allow dirty TLDs.
-  if (hsk_dns_name_dirty(req->tld))
+  if (tld_len > 0 && info->last_dirty >= info->labels[info->count - 1])
     goto fail;
 
-  // Lowercase.
-  hsk_to_lower(req->tld);
-
   // Reference.
   req->ns = NULL;
 
-  // DNS stuff.
-  req->id = msg->id;
-  req->labels = hsk_dns_label_count(qs->name);
-  strcpy(req->name, qs->name);
-  req->type = qs->type;
-  req->class = qs->class;
-  req->rd = (msg->flags & HSK_DNS_RD) != 0;
-  req->cd = (msg->flags & HSK_DNS_CD) != 0;
-  req->ad = (msg->flags & HSK_DNS_AD) != 0;
-  req->edns = msg->edns.enabled;
-  req->max_size = HSK_DNS_MAX_UDP;
-  if (msg->edns.enabled && msg->edns.size >= HSK_DNS_MAX_UDP) {
-    req->max_size = msg->edns.size;
-    if (req->max_size > HSK_DNS_MAX_EDNS)
-      req->max_size = HSK_DNS_MAX_EDNS;
-  }
-  req->dnssec = (msg->edns.flags & HSK_DNS_DO) != 0;
+  req->labels = info->count;
 
   // Sender address.
   hsk_sa_copy(req->addr, addr);
 
-  // Free stuff up.
-  hsk_dns_msg_free(msg);
-
   return req;
 
 fail:
-  if (req)
-    free(req);
-
-  if (msg)
-    hsk_dns_msg_free(msg);
-
+  free(req);
   return NULL;
 }
 
@@ -235,50 +346,403 @@ hsk_dns_msg_finalize(
     }
   }
 
-  // Reserialize.
-  uint8_t *data = NULL;
+  // Serialize once into a buffer of the
+  // maximum size, truncating as we go and
+  // leaving room for the signature.
+  size_t max = req->max_size;
+  uint8_t *data = malloc(max);
   size_t data_len = 0;
 
-  if (!hsk_dns_msg_encode(msg, &data, &data_len)) {
+  if (!data) {
     hsk_dns_msg_free(msg);
     return false;
   }
 
-  assert(data);
+  if (key)
+    max -= HSK_SIG0_RR_SIZE;
+
+  if (!hsk_dns_msg_pack(msg, data, max, &data_len)) {
+    hsk_dns_msg_free(msg);
+    free(data);
+    return false;
+  }
 
   hsk_dns_msg_free(msg);
 
-  // Truncate.
-  size_t max = req->max_size;
+  // Sign.
+  if (key && !hsk_sig0_append(ec, key, data, data_len, &data_len)) {
+    free(data);
+    return false;
+  }
 
-  if (key)
-    max -= HSK_SIG0_RR_SIZE;
+  *wire = data;
+  *wire_len = data_len;
 
-  if (!hsk_dns_msg_truncate(data, data_len, max, &data_len)) {
+  return true;
+}
+
+/*
+ * Templates
+ */
+
+static void
+hsk_dns_tmpl_body_init(hsk_dns_tmpl_body_t *body) {
+  body->data = NULL;
+  body->len = 0;
+  body->counts[0] = 0;
+  body->counts[1] = 0;
+  body->counts[2] = 0;
+  body->ends = NULL;
+  body->ptrs = NULL;
+  body->ptrs_len = 0;
+  body->var = 0;
+  body->var_len = 0;
+}
+
+static void
+hsk_dns_tmpl_body_uninit(hsk_dns_tmpl_body_t *body) {
+  if (body->data)
+    free(body->data);
+
+  if (body->ends)
+    free(body->ends);
+
+  if (body->ptrs)
+    free(body->ptrs);
+
+  hsk_dns_tmpl_body_init(body);
+}
+
+static bool
+hsk_dns_tmpl_body_set(
+  hsk_dns_tmpl_body_t *body,
+  const hsk_dns_msg_t *msg,
+  const char *qname
+) {
+  const hsk_dns_rrs_t *sections[3] = {
+    &msg->an,
+    &msg->ns,
+    &msg->ar
+  };
+
+  size_t size = 0;
+  int count = 0;
+  int s, i;
+
+  for (s = 0; s < 3; s++) {
+    for (i = 0; i < sections[s]->size; i++)
+      size += hsk_dns_rr_size(sections[s]->items[i]);
+    count += sections[s]->size;
+  }
+
+  // Written after a header and a root question,
+  // compressed against the body itself.
+  uint8_t *data = malloc(HSK_DNS_TMPL_BASE + size + 1);
+  size_t *ends = malloc((count + 1) * sizeof(size_t));
+  uint16_t *ptrs = malloc((size / 2 + 1) * sizeof(uint16_t));
+
+  if (!data || !ends || !ptrs) {
     free(data);
+    free(ends);
+    free(ptrs);
     return false;
   }
 
-  if (!key) {
-    *wire = data;
-    *wire_len = data_len;
-    return true;
+  memset(data, 0x00, HSK_DNS_TMPL_BASE);
+
+  hsk_dns_cmp_t cmp;
+  hsk_dns_cmp_init(&cmp, data);
+  cmp.ptrs = ptrs;
+  cmp.ptrs_size = size / 2 + 1;
+
+  uint8_t *pos = &data[HSK_DNS_TMPL_BASE];
+  int n = 0;
+
+  for (s = 0; s < 3; s++) {
+    const hsk_dns_rrs_t *rrs = sections[s];
+
+    for (i = 0; i < rrs->size; i++) {
+      const hsk_dns_rr_t *rr = rrs->items[i];
+      uint8_t *start = pos;
+      int name_len;
+
+      if (qname && strcmp(rr->name, qname) == 0) {
+        // The question always sits at offset 12.
+        uint8_t *rd_len;
+
+        write_u16be(&pos, 0xc00c);
+        write_u16be(&pos, rr->type);
+        write_u16be(&pos, rr->class);
+        write_u32be(&pos, rr->ttl);
+
+        rd_len = pos;
+        pos += 2;
+
+        if (rr->rd)
+          write_u16be(&rd_len, hsk_dns_rd_write(rr->rd, rr->type, &pos, &cmp));
+        else
+          write_u16be(&rd_len, 0);
+
+        name_len = 2;
+      } else {
+        name_len = hsk_dns_name_write(rr->name, NULL, &cmp);
+        hsk_dns_rr_write(rr, &pos, &cmp);
+      }
+
+      // The first answer's rdata may be patched.
+      if (s == 0 && i == 0) {
+        body->var = (start - data) - HSK_DNS_TMPL_BASE + name_len + 10;
+        body->var_len = (pos - data) - HSK_DNS_TMPL_BASE - body->var;
+      }
+
+      ends[n++] = (pos - data) - HSK_DNS_TMPL_BASE;
+    }
+
+    body->counts[s] = rrs->size;
   }
 
-  // Sign.
-  uint8_t *out = NULL;
-  size_t out_len = 0;
+  hsk_dns_cmp_uninit(&cmp);
 
-  if (!hsk_sig0_sign(ec, key, data, data_len, &out, &out_len)) {
-    free(data);
+  size_t k;
+
+  for (k = 0; k < cmp.ptrs_count; k++)
+    ptrs[k] -= HSK_DNS_TMPL_BASE;
+
+  body->len = (pos - data) - HSK_DNS_TMPL_BASE;
+  memmove(data, &data[HSK_DNS_TMPL_BASE], body->len);
+
+  body->data = data;
+  body->ends = ends;
+  body->ptrs = ptrs;
+  body->ptrs_len = cmp.ptrs_count;
+
+  return true;
+}
+
+void
+hsk_dns_tmpl_init(hsk_dns_tmpl_t *tmpl) {
+  assert(tmpl);
+  tmpl->flags = 0;
+  tmpl->type = HSK_DNS_UNKNOWN;
+  tmpl->time = 0;
+  hsk_dns_tmpl_body_init(&tmpl->sec);
+  hsk_dns_tmpl_body_init(&tmpl->plain);
+}
+
+void
+hsk_dns_tmpl_uninit(hsk_dns_tmpl_t *tmpl) {
+  assert(tmpl);
+  hsk_dns_tmpl_body_uninit(&tmpl->sec);
+  hsk_dns_tmpl_body_uninit(&tmpl->plain);
+  hsk_dns_tmpl_init(tmpl);
+}
+
+// Consumes the message. `type` is the query type the
+// plain body is cleaned for, and `dnssec` whether to
+// keep a body with signatures for DO queries.
+bool
+hsk_dns_tmpl_compile(
+  hsk_dns_tmpl_t *tmpl,
+  hsk_dns_msg_t **res,
+  uint16_t type,
+  const char *qname,
+  bool dnssec
+) {
+  assert(tmpl && res);
+
+  hsk_dns_msg_t *msg = *res;
+
+  *res = NULL;
+
+  hsk_dns_tmpl_uninit(tmpl);
+
+  if (msg->code > 0x0f)
+    goto fail;
+
+  tmpl->flags = msg->flags;
+  tmpl->flags &= ~(0x0f << 11);
+  tmpl->flags &= ~0x0f;
+  tmpl->flags |= ((uint16_t)(msg->opcode & 0x0f)) << 11;
+  tmpl->flags |= msg->code & 0x0f;
+  tmpl->type = type;
+
+  if (dnssec) {
+    if (!hsk_dns_tmpl_body_set(&tmpl->sec, msg, qname))
+      goto fail;
+  }
+
+  if (!hsk_dns_msg_clean(msg, type))
+    goto fail;
+
+  if (!hsk_dns_tmpl_body_set(&tmpl->plain, msg, qname))
+    goto fail;
+
+  tmpl->time = hsk_now();
+
+  hsk_dns_msg_free(msg);
+
+  return true;
+
+fail:
+  hsk_dns_tmpl_uninit(tmpl);
+  hsk_dns_msg_free(msg);
+  return false;
+}
+
+// Whether hsk_dns_msg_clean keeps records
+// of this type only when they are queried.
+static bool
+hsk_dns_tmpl_cleans(uint16_t type) {
+  switch (type) {
+    case HSK_DNS_DS:
+    case HSK_DNS_DLV:
+    case HSK_DNS_DNSKEY:
+    case HSK_DNS_RRSIG:
+    case HSK_DNS_NXT:
+    case HSK_DNS_NSEC:
+    case HSK_DNS_NSEC3:
+    case HSK_DNS_NSEC3PARAM:
+      return true;
+  }
+  return false;
+}
+
+// Writes the same response hsk_dns_msg_finalize would,
+// patching the question and the first answer's rdata.
+// When the body does not fit, trailing additional
+// records are dropped at their recorded boundaries
+// and the OPT record is kept. Returns false when the
+// caller should build the message instead (no matching
+// body, or the answer or authority would be cut).
+bool
+hsk_dns_tmpl_write(
+  const hsk_dns_tmpl_t *tmpl,
+  const hsk_dns_req_t *req,
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  const uint8_t *var,
+  size_t var_len,
+  uint8_t **wire,
+  size_t *wire_len
+) {
+  assert(tmpl && req && wire && wire_len);
+
+  *wire = NULL;
+  *wire_len = 0;
+
+  const hsk_dns_tmpl_body_t *body = req->dnssec ? &tmpl->sec : &tmpl->plain;
+
+  if (!body->data)
+    return false;
+
+  if (!req->dnssec && req->type != tmpl->type && hsk_dns_tmpl_cleans(req->type))
     return false;
+
+  if (var && var_len != body->var_len)
+    return false;
+
+  size_t size = 12;
+
+  size += hsk_dns_name_write(req->name, NULL, NULL) + 4;
+
+  if (req->edns)
+    size += 11;
+
+  if (key)
+    size += HSK_SIG0_RR_SIZE;
+
+  if (size > req->max_size)
+    return false;
+
+  size_t body_len = body->len;
+  uint16_t ar = body->counts[2];
+
+  if (size + body_len > req->max_size) {
+    // Anything past the additional section is left
+    // to the encoder, which compresses and may fit
+    // more than the uncompressed body.
+    size_t left = req->max_size - size;
+    int keep = body->counts[0] + body->counts[1];
+
+    if (keep > 0 && body->ends[keep - 1] > left)
+      return false;
+
+    while (ar > 0 && body->ends[keep + ar - 1] > left)
+      ar -= 1;
+
+    body_len = ar > 0 || keep > 0 ? body->ends[keep + ar - 1] : 0;
   }
 
-  assert(out);
-  free(data);
+  size += body_len;
+
+  uint8_t *data = malloc(size);
+
+  if (!data)
+    return false;
+
+  uint8_t *pos = data;
+  uint16_t flags = tmpl->flags | HSK_DNS_QR;
+
+  if (req->rd)
+    flags |= HSK_DNS_RD;
+
+  if (req->cd)
+    flags |= HSK_DNS_CD;
+
+  write_u16be(&pos, req->id);
+  write_u16be(&pos, flags);
+  write_u16be(&pos, 1);
+  write_u16be(&pos, body->counts[0]);
+  write_u16be(&pos, body->counts[1]);
+  write_u16be(&pos, ar + (req->edns ? 1 : 0));
+
+  hsk_dns_name_write(req->name, &pos, NULL);
+  write_u16be(&pos, req->type);
+  write_u16be(&pos, req->class);
+
+  memcpy(pos, body->data, body_len);
+
+  // Pointers into the body move with the question.
+  size_t shift = (pos - data) - HSK_DNS_TMPL_BASE;
+  size_t k;
+
+  for (k = 0; k < body->ptrs_len; k++) {
+    size_t p = body->ptrs[k];
+
+    if (p >= body_len)
+      break;
+
+    uint16_t ptr = ((pos[p] & 0x3f) << 8) | pos[p + 1];
+
+    if (ptr >= HSK_DNS_TMPL_BASE) {
+      ptr += shift;
+      pos[p] = 0xc0 | (ptr >> 8);
+      pos[p + 1] = ptr & 0xff;
+    }
+  }
+
+  if (var)
+    memcpy(&pos[body->var], var, var_len);
+
+  pos += body_len;
+
+  if (req->edns) {
+    write_u8(&pos, 0);
+    write_u16be(&pos, HSK_DNS_OPT);
+    write_u16be(&pos, HSK_DNS_MAX_EDNS);
+    write_u32be(&pos, req->dnssec ? HSK_DNS_DO : 0);
+    write_u16be(&pos, 0);
+  }
+
+  size_t len = pos - data;
+
+  if (key && !hsk_sig0_append(ec, key, data, len, &len)) {
+    free(data);
+    return false;
+  }
 
-  *wire = out;
-  *wire_len = out_len;
+  *wire = data;
+  *wire_len = len;
 
   return true;
 }
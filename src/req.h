@@ -18,6 +18,7 @@ typedef struct {
   uint16_t id;
   size_t labels;
   char name[HSK_DNS_MAX_NAME + 1];
+  hsk_dns_name_info_t info;
   uint16_t type;
   uint16_t class;
   bool rd;
@@ -30,11 +31,44 @@ typedef struct {
   // HSK stuff
   char tld[HSK_DNS_MAX_LABEL + 1];
 
+  // Serve-stale client response timer.
+  void *timer;
+  bool answered;
+
   // Who it's from.
   struct sockaddr_storage ss;
   struct sockaddr *addr;
 } hsk_dns_req_t;
 
+// Body offset assumed when compressing: a header
+// followed by a root question.
+#define HSK_DNS_TMPL_BASE 17
+
+// A pre-encoded response body. Owners equal to the
+// question point at offset 12, other names are
+// compressed within the body and the pointers in
+// `ptrs` are moved past the actual question when
+// written. `ends` holds the offset just past each
+// record, so the body can be cut without parsing it.
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  uint16_t counts[3];
+  size_t *ends;
+  uint16_t *ptrs;
+  size_t ptrs_len;
+  size_t var;
+  size_t var_len;
+} hsk_dns_tmpl_body_t;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t type;
+  int64_t time;
+  hsk_dns_tmpl_body_t sec;
+  hsk_dns_tmpl_body_t plain;
+} hsk_dns_tmpl_t;
+
 void
 hsk_dns_req_init(hsk_dns_req_t *req);
 
@@ -47,6 +81,12 @@ hsk_dns_req_alloc(void);
 void
 hsk_dns_req_free(hsk_dns_req_t *req);
 
+bool
+hsk_dns_req_read(hsk_dns_req_t *req, const uint8_t *data, size_t data_len);
+
+bool
+hsk_dns_req_decode(hsk_dns_req_t *req, const uint8_t *data, size_t data_len);
+
 hsk_dns_req_t *
 hsk_dns_req_create(
   const uint8_t *data,
@@ -66,4 +106,31 @@ hsk_dns_msg_finalize(
   uint8_t **wire,
   size_t *wire_len
 );
+
+void
+hsk_dns_tmpl_init(hsk_dns_tmpl_t *tmpl);
+
+void
+hsk_dns_tmpl_uninit(hsk_dns_tmpl_t *tmpl);
+
+bool
+hsk_dns_tmpl_compile(
+  hsk_dns_tmpl_t *tmpl,
+  hsk_dns_msg_t **res,
+  uint16_t type,
+  const char *qname,
+  bool dnssec
+);
+
+bool
+hsk_dns_tmpl_write(
+  const hsk_dns_tmpl_t *tmpl,
+  const hsk_dns_req_t *req,
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  const uint8_t *var,
+  size_t var_len,
+  uint8_t **wire,
+  size_t *wire_len
+);
 #endif
@@ -518,7 +518,7 @@ hsk_resource_to_ns(
       strcpy(nsname, c->name);
     }
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_NS);
+    hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_NS);
 
     if (!rr)
       return false;
@@ -552,7 +552,7 @@ hsk_resource_to_txt(
     hsk_txt_record_t *rec = (hsk_txt_record_t *)c;
     hsk_dns_txts_t *txts = &rec->txts;
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_TXT);
+    hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_TXT);
 
     if (!rr)
       return false;
@@ -564,13 +564,15 @@ hsk_resource_to_txt(
 
     int i;
     for (i = 0; i < txts->size; i++) {
-      hsk_dns_txt_t *txt = hsk_dns_txt_alloc();
+      hsk_dns_txt_t *txt = hsk_dns_rr_alloc_data(rr, sizeof(hsk_dns_txt_t));
 
       if (!txt) {
         hsk_dns_rr_free(rr);
         return false;
       }
 
+      hsk_dns_txt_init(txt);
+
       hsk_dns_txt_t *item = txts->items[i]; 
       txt->data_len = item->data_len;
       assert(txt->data_len <= 255);
@@ -601,7 +603,7 @@ hsk_resource_to_ds(
 
     hsk_ds_record_t *rec = (hsk_ds_record_t *)c;
 
-    hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_DS);
+    hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_DS);
 
     if (!rr)
       return false;
@@ -616,7 +618,7 @@ hsk_resource_to_ds(
     rd->digest_type = rec->digest_type;
     rd->digest_len = rec->digest_len;
 
-    rd->digest = malloc(rec->digest_len);
+    rd->digest = hsk_dns_rr_alloc_data(rr, rec->digest_len);
 
     if (!rd->digest) {
       hsk_dns_rr_free(rr);
@@ -647,7 +649,7 @@ hsk_resource_to_glue(
         if (!hsk_dns_is_subdomain(tld, c->name))
           break;
 
-        hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_A);
+        hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_A);
         if (!rr)
           return false;
 
@@ -662,7 +664,7 @@ hsk_resource_to_glue(
         break;
       }
       case HSK_SYNTH4: {
-        hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_A);
+        hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_A);
         if (!rr)
           return false;
 
@@ -686,7 +688,7 @@ hsk_resource_to_glue(
         if (!hsk_dns_is_subdomain(tld, c->name))
           break;
 
-        hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_AAAA);
+        hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_AAAA);
         if (!rr)
           return false;
 
@@ -701,7 +703,7 @@ hsk_resource_to_glue(
         break;
       }
       case HSK_SYNTH6: {
-        hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_AAAA);
+        hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_AAAA);
         if (!rr)
           return false;
 
@@ -728,7 +730,7 @@ hsk_resource_to_glue(
 
 bool
 hsk_resource_root_to_soa(hsk_dns_rrs_t *an) {
-  hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_SOA);
+  hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_SOA);
 
   if (!rr)
     return false;
@@ -766,7 +768,7 @@ hsk_resource_root_to_soa(hsk_dns_rrs_t *an) {
 
 static bool
 hsk_resource_root_to_ns(hsk_dns_rrs_t *an) {
-  hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_NS);
+  hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_NS);
 
   if (!rr)
     return false;
@@ -789,7 +791,7 @@ hsk_resource_root_to_a(hsk_dns_rrs_t *an, const hsk_addr_t *addr) {
 
   const uint8_t *ip = hsk_addr_get_ip(addr);
 
-  hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_A);
+  hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_A);
 
   if (!rr)
     return false;
@@ -814,7 +816,7 @@ hsk_resource_root_to_aaaa(hsk_dns_rrs_t *an, const hsk_addr_t *addr) {
 
   const uint8_t *ip = hsk_addr_get_ip(addr);
 
-  hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_AAAA);
+  hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_AAAA);
 
   if (!rr)
     return false;
@@ -873,7 +875,7 @@ hsk_resource_to_empty(
   size_t type_map_len,
   hsk_dns_rrs_t *an
 ) {
-  hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_NSEC);
+  hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_NSEC);
 
   if (!rr)
     return false;
@@ -889,7 +891,7 @@ hsk_resource_to_empty(
   rd->type_map_len = 0;
 
   if (type_map) {
-    uint8_t *buf = malloc(type_map_len);
+    uint8_t *buf = hsk_dns_rr_alloc_data(rr, type_map_len);
 
     if (!buf) {
       hsk_dns_rr_free(rr);
@@ -909,12 +911,12 @@ hsk_resource_to_empty(
 
 static bool
 hsk_resource_root_to_nsec(hsk_dns_rrs_t *an) {
-  hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_NSEC);
+  hsk_dns_rr_t *rr = hsk_dns_rr_create_in(an->arena, HSK_DNS_NSEC);
 
   if (!rr)
     return false;
 
-  uint8_t *bitmap = malloc(sizeof(hsk_type_map));
+  uint8_t *bitmap = hsk_dns_rr_alloc_data(rr, sizeof(hsk_type_map));
 
   if (!bitmap) {
     hsk_dns_rr_free(rr);
@@ -938,23 +940,53 @@ hsk_resource_root_to_nsec(hsk_dns_rrs_t *an) {
   return true;
 }
 
+void
+hsk_resource_to_referral(
+  const hsk_resource_t *rs,
+  const char *tld,
+  hsk_dns_msg_t *msg
+) {
+  hsk_dns_rrs_t *ns = &msg->ns; // authority
+  hsk_dns_rrs_t *ar = &msg->ar; // additional
+
+  if (hsk_resource_has_ns(rs)) {
+    hsk_resource_to_ns(rs, tld, ns);
+    hsk_resource_to_ds(rs, tld, ns);
+    hsk_resource_to_glue(rs, tld, ar);
+    if (!hsk_resource_has(rs, HSK_DS))
+      hsk_dnssec_sign_zsk(ns, HSK_DNS_NS);
+    else
+      hsk_dnssec_sign_zsk(ns, HSK_DNS_DS);
+  } else {
+    // Needs SOA.
+    // Empty proof:
+    hsk_resource_to_empty(tld, NULL, 0, ns);
+    hsk_dnssec_sign_zsk(ns, HSK_DNS_NSEC);
+    hsk_resource_root_to_soa(ns);
+    hsk_dnssec_sign_zsk(ns, HSK_DNS_SOA);
+  }
+}
+
 hsk_dns_msg_t *
 hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
   assert(hsk_dns_name_is_fqdn(name));
 
-  int labels = hsk_dns_label_count(name);
+  hsk_dns_name_info_t info;
+  hsk_dns_name_analyze(name, &info);
+
+  int labels = info.count;
 
   if (labels == 0)
     return NULL;
 
   char tld[HSK_DNS_MAX_NAME];
-  int tld_len = hsk_dns_label_from(name, -1, tld);
+  int tld_len = hsk_dns_label_from2(name, info.labels, labels, -1, tld);
 
   // tld_len includes the final dot but not the \0
   if (tld_len > HSK_DNS_MAX_LABEL + 1)
     return NULL;
 
-  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
 
   if (!msg)
     return NULL;
@@ -965,23 +997,7 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
 
   // Referral.
   if (labels > 1) {
-    if (hsk_resource_has_ns(rs)) {
-      hsk_resource_to_ns(rs, tld, ns);
-      hsk_resource_to_ds(rs, tld, ns);
-      hsk_resource_to_glue(rs, tld, ar);
-      if (!hsk_resource_has(rs, HSK_DS))
-        hsk_dnssec_sign_zsk(ns, HSK_DNS_NS);
-      else
-        hsk_dnssec_sign_zsk(ns, HSK_DNS_DS);
-    } else {
-      // Needs SOA.
-      // Empty proof:
-      hsk_resource_to_empty(tld, NULL, 0, ns);
-      hsk_dnssec_sign_zsk(ns, HSK_DNS_NSEC);
-      hsk_resource_root_to_soa(ns);
-      hsk_dnssec_sign_zsk(ns, HSK_DNS_SOA);
-    }
-
+    hsk_resource_to_referral(rs, tld, msg);
     return msg;
   }
 
@@ -1031,7 +1047,7 @@ hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type) {
 
 hsk_dns_msg_t *
 hsk_resource_root(uint16_t type, const hsk_addr_t *addr) {
-  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
 
   if (!msg)
     return NULL;
@@ -1100,7 +1116,7 @@ hsk_resource_root(uint16_t type, const hsk_addr_t *addr) {
 
 hsk_dns_msg_t *
 hsk_resource_to_nx(void) {
-  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
 
   if (!msg)
     return NULL;
@@ -1127,7 +1143,7 @@ hsk_resource_to_nx(void) {
 
 hsk_dns_msg_t *
 hsk_resource_to_servfail(void) {
-  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
 
   if (!msg)
     return NULL;
@@ -1139,7 +1155,7 @@ hsk_resource_to_servfail(void) {
 
 hsk_dns_msg_t *
 hsk_resource_to_notimp(void) {
-  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
 
   if (!msg)
     return NULL;
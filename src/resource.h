@@ -76,6 +76,15 @@ hsk_resource_has(const hsk_resource_t *res, uint8_t type);
 bool
 hsk_resource_has_ns(const hsk_resource_t *res);
 
+// Fills the authority and additional sections
+// referring `tld` (with a final dot) downward.
+void
+hsk_resource_to_referral(
+  const hsk_resource_t *rs,
+  const char *tld,
+  hsk_dns_msg_t *msg
+);
+
 hsk_dns_msg_t *
 hsk_resource_to_dns(const hsk_resource_t *rs, const char *name, uint16_t type);
 
@@ -161,29 +161,50 @@ hsk_sig0_sign(
   if (wire_len < 12)
     return false;
 
-  uint16_t arcount = get_u16be(&wire[10]);
-  arcount += 1;
-
-  size_t o_len = wire_len + HSK_SIG0_RR_SIZE;
+  bool has_sig = hsk_sig0_has_sig(wire, wire_len);
 
   // Overwrite sigs. Do not append.
-  if (hsk_sig0_has_sig(wire, wire_len)) {
-    o_len -= HSK_SIG0_RR_SIZE;
+  if (has_sig)
     wire_len -= HSK_SIG0_RR_SIZE;
-    arcount -= 1;
-  }
 
-  uint8_t *o = malloc(o_len);
+  uint8_t *o = malloc(wire_len + HSK_SIG0_RR_SIZE);
 
   if (!o)
     return false;
 
   memcpy(o, wire, wire_len);
 
+  // The stripped sig is still counted in arcount.
+  if (has_sig)
+    set_u16be(&o[10], get_u16be(&o[10]) - 1);
+
+  if (!hsk_sig0_append(ec, key, o, wire_len, out_len)) {
+    free(o);
+    return false;
+  }
+
+  *out = o;
+
+  return true;
+}
+
+bool
+hsk_sig0_append(
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  uint8_t *wire,
+  size_t wire_len,
+  size_t *out_len
+) {
+  if (wire_len < 12)
+    return false;
+
+  size_t o_len = wire_len + HSK_SIG0_RR_SIZE;
+
   // arcount + 1
-  set_u16be(&o[10], arcount);
+  set_u16be(&wire[10], get_u16be(&wire[10]) + 1);
 
-  uint8_t *rr = &o[wire_len];
+  uint8_t *rr = &wire[wire_len];
   uint8_t *rd = &rr[11];
 
   // name = .
@@ -232,20 +253,15 @@ hsk_sig0_sign(
 
   uint8_t hash[32];
 
-  if (!hsk_sig0_sighash(o, o_len, hash)) {
-    free(o);
+  if (!hsk_sig0_sighash(wire, o_len, hash))
     return false;
-  }
 
   uint8_t *sig = &rd[19];
   int rec;
 
-  if (!hsk_ec_sign_msg(ec, key, hash, sig, &rec)) {
-    free(o);
+  if (!hsk_ec_sign_msg(ec, key, hash, sig, &rec))
     return false;
-  }
 
-  *out = o;
   *out_len = o_len;
 
   return true;
@@ -39,6 +39,17 @@ hsk_sig0_sign(
   size_t *out_len
 );
 
+// Appends a SIG(0) record in place. The caller must
+// leave HSK_SIG0_RR_SIZE bytes free after `wire_len`.
+bool
+hsk_sig0_append(
+  const hsk_ec_t *ec,
+  const uint8_t *key,
+  uint8_t *wire,
+  size_t wire_len,
+  size_t *out_len
+);
+
 bool
 hsk_sig0_verify(
   const hsk_ec_t *ec,
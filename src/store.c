@@ -5,6 +5,9 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
 
 #include "bio.h"
 #include "chain.h"
@@ -12,12 +15,16 @@
 #include "error.h"
 #include "header.h"
 #include "store.h"
+#include "uv.h"
 
 #if defined(_WIN32)
 #  include <windows.h>
+#  include <io.h>
 #  define HSK_PATH_SEP '\\'
 #else
+#  include <sys/mman.h>
 #  include <sys/stat.h>
+#  include <unistd.h>
 #  define HSK_PATH_SEP '/'
 #endif
 
@@ -55,38 +62,47 @@ hsk_store_filename(char *prefix, char *path, uint32_t height) {
   );
 
   if (height > 0) {
-    sprintf(path, "%s~%u", path, height);
+    sprintf(path + strlen(path), "~%u", height);
   }
 }
 
-void
-hsk_store_write(const hsk_chain_t *chain) {
-  // Serialize
-  char buf[HSK_STORE_CHECKPOINT_SIZE];
-  uint8_t *data = (uint8_t *)&buf;
+static bool
+hsk_store_serialize(const hsk_chain_t *chain, uint8_t *buf, uint32_t *out) {
+  uint8_t *data = buf;
 
   if (!write_u32be(&data, HSK_MAGIC))
-    goto fail;
+    return false;
 
   if (!write_u8(&data, HSK_STORE_VERSION))
-    goto fail;
+    return false;
 
   assert(chain->height % HSK_STORE_CHECKPOINT_WINDOW == 0);
   uint32_t height = chain->height - HSK_STORE_CHECKPOINT_WINDOW;
   if (!write_u32be(&data, height))
-    goto fail;
+    return false;
 
   hsk_header_t *prev = hsk_chain_get_by_height(chain, height - 1);
   if (!write_bytes(&data, prev->work, 32))
-    goto fail;
+    return false;
 
   for (int i = 0; i < HSK_STORE_HEADERS_COUNT; i++) {
     hsk_header_t *hdr = hsk_chain_get_by_height(chain, i + height);
 
     if (!hsk_header_write(hdr, &data))
-      goto fail;
+      return false;
   }
 
+  *out = height;
+
+  return true;
+}
+
+static void
+hsk_store_write_sync(
+  const hsk_chain_t *chain,
+  const uint8_t *buf,
+  uint32_t height
+) {
   // Prepare
   char path[HSK_STORE_PATH_MAX];
   char tmp[HSK_STORE_PATH_MAX];
@@ -101,7 +117,7 @@ hsk_store_write(const hsk_chain_t *chain) {
   }
 
   // Write temp
-  size_t written = fwrite(&buf, 1, HSK_STORE_CHECKPOINT_SIZE, file);
+  size_t written = fwrite(buf, 1, HSK_STORE_CHECKPOINT_SIZE, file);
   fclose(file);
 
   if (written != HSK_STORE_CHECKPOINT_SIZE) {
@@ -124,9 +140,305 @@ hsk_store_write(const hsk_chain_t *chain) {
     hsk_store_log("(%u) failed to write checkpoint file: %s\n", height, path);
     return;
   }
+}
 
-fail:
-  hsk_store_log("could not serialize checkpoint data\n");
+/*
+ * Async File Write
+ */
+
+static void
+hsk_store_file_after_open(uv_fs_t *req);
+
+static void
+hsk_store_file_after_write(uv_fs_t *req);
+
+static void
+hsk_store_file_after_fsync(uv_fs_t *req);
+
+static void
+hsk_store_file_after_close(uv_fs_t *req);
+
+static void
+hsk_store_file_after_rename(uv_fs_t *req);
+
+static void
+hsk_store_file_fail(hsk_store_file_t *f, const char *step, int err) {
+  uv_loop_t *loop = f->req.loop;
+
+  if (f->fd >= 0) {
+    uv_fs_t req;
+    uv_fs_close(loop, &req, f->fd, NULL);
+    uv_fs_req_cleanup(&req);
+    f->fd = -1;
+  }
+
+  uv_fs_t unlink_req;
+  uv_fs_unlink(loop, &unlink_req, f->tmp, NULL);
+  uv_fs_req_cleanup(&unlink_req);
+
+  f->cb(f, step, err);
+}
+
+static void
+hsk_store_file_write_next(hsk_store_file_t *f) {
+  uv_buf_t buf = uv_buf_init((char *)f->data + f->pos,
+                             (unsigned int)(f->data_len - f->pos));
+
+  int rc = uv_fs_write(f->req.loop, &f->req, f->fd, &buf, 1,
+                       (int64_t)f->pos, hsk_store_file_after_write);
+
+  if (rc != 0)
+    hsk_store_file_fail(f, "write", rc);
+}
+
+static void
+hsk_store_file_after_open(uv_fs_t *req) {
+  hsk_store_file_t *f = (hsk_store_file_t *)req->data;
+  int rc = (int)req->result;
+
+  uv_fs_req_cleanup(req);
+
+  if (rc < 0) {
+    hsk_store_file_fail(f, "open", rc);
+    return;
+  }
+
+  f->fd = rc;
+
+  hsk_store_file_write_next(f);
+}
+
+static void
+hsk_store_file_after_write(uv_fs_t *req) {
+  hsk_store_file_t *f = (hsk_store_file_t *)req->data;
+  ssize_t result = req->result;
+
+  uv_fs_req_cleanup(req);
+
+  if (result < 0) {
+    hsk_store_file_fail(f, "write", (int)result);
+    return;
+  }
+
+  if (result == 0) {
+    hsk_store_file_fail(f, "write", UV_EIO);
+    return;
+  }
+
+  f->pos += (size_t)result;
+
+  if (f->pos < f->data_len) {
+    hsk_store_file_write_next(f);
+    return;
+  }
+
+  int rc = uv_fs_fsync(req->loop, req, f->fd, hsk_store_file_after_fsync);
+
+  if (rc != 0)
+    hsk_store_file_fail(f, "sync", rc);
+}
+
+static void
+hsk_store_file_after_fsync(uv_fs_t *req) {
+  hsk_store_file_t *f = (hsk_store_file_t *)req->data;
+  int rc = (int)req->result;
+
+  uv_fs_req_cleanup(req);
+
+  if (rc < 0) {
+    hsk_store_file_fail(f, "sync", rc);
+    return;
+  }
+
+  uv_file fd = f->fd;
+  f->fd = -1;
+
+  rc = uv_fs_close(req->loop, req, fd, hsk_store_file_after_close);
+
+  if (rc != 0)
+    hsk_store_file_fail(f, "close", rc);
+}
+
+static void
+hsk_store_file_after_close(uv_fs_t *req) {
+  hsk_store_file_t *f = (hsk_store_file_t *)req->data;
+  int rc = (int)req->result;
+
+  uv_fs_req_cleanup(req);
+
+  if (rc < 0) {
+    hsk_store_file_fail(f, "close", rc);
+    return;
+  }
+
+  if (f->cancel) {
+    hsk_store_file_fail(f, "rename", UV_ECANCELED);
+    return;
+  }
+
+#if defined(_WIN32)
+  // Can not do the rename-file trick to guarantee atomicity on windows
+  uv_fs_t unlink_req;
+  uv_fs_unlink(req->loop, &unlink_req, f->path, NULL);
+  uv_fs_req_cleanup(&unlink_req);
+#endif
+
+  rc = uv_fs_rename(req->loop, req, f->tmp, f->path,
+                    hsk_store_file_after_rename);
+
+  if (rc != 0)
+    hsk_store_file_fail(f, "rename", rc);
+}
+
+static void
+hsk_store_file_after_rename(uv_fs_t *req) {
+  hsk_store_file_t *f = (hsk_store_file_t *)req->data;
+  int rc = (int)req->result;
+
+  uv_fs_req_cleanup(req);
+
+  if (rc < 0) {
+    hsk_store_file_fail(f, "rename", rc);
+    return;
+  }
+
+  f->cb(f, NULL, 0);
+}
+
+int
+hsk_store_file_write(
+  uv_loop_t *loop,
+  hsk_store_file_t *f,
+  const uint8_t *data,
+  size_t data_len,
+  const char *tmp,
+  const char *path,
+  hsk_store_file_cb cb,
+  void *arg
+) {
+  assert(loop && f && data && tmp && path && cb);
+
+  f->fd = -1;
+  f->data = data;
+  f->data_len = data_len;
+  f->pos = 0;
+  f->tmp = tmp;
+  f->path = path;
+  f->cancel = false;
+  f->cb = cb;
+  f->arg = arg;
+  f->req.data = (void *)f;
+
+  return uv_fs_open(
+    loop,
+    &f->req,
+    tmp,
+    O_WRONLY | O_CREAT | O_TRUNC,
+    0644,
+    hsk_store_file_after_open
+  );
+}
+
+/*
+ * Async Checkpoint Write
+ */
+
+static void
+hsk_store_after_write(hsk_store_file_t *f, const char *step, int status) {
+  hsk_store_write_t *w = (hsk_store_write_t *)f->arg;
+
+  if (status < 0) {
+    hsk_store_log(
+      "(%u) could not %s checkpoint file: %s (%s)\n",
+      w->height,
+      step,
+      w->tmp,
+      uv_strerror(status)
+    );
+  } else {
+    hsk_store_log("(%u) wrote checkpoint file: %s\n", w->height, w->path);
+  }
+
+  if (w->chain)
+    w->chain->checkpoint = NULL;
+
+  free(w);
+}
+
+void
+hsk_store_write(hsk_chain_t *chain) {
+  // Serialize
+  uint8_t buf[HSK_STORE_CHECKPOINT_SIZE];
+  uint32_t height;
+
+  // Without an event loop, write synchronously
+  if (!chain->loop) {
+    if (!hsk_store_serialize(chain, buf, &height)) {
+      hsk_store_log("could not serialize checkpoint data\n");
+      return;
+    }
+
+    hsk_store_write_sync(chain, buf, height);
+    return;
+  }
+
+  // Slow disks may still be busy with the previous window
+  if (chain->checkpoint) {
+    hsk_store_log(
+      "(%u) checkpoint write still in progress, skipping\n",
+      chain->checkpoint->height
+    );
+    return;
+  }
+
+  hsk_store_write_t *w = malloc(sizeof(hsk_store_write_t));
+
+  if (!w) {
+    hsk_store_log("could not allocate checkpoint write\n");
+    return;
+  }
+
+  if (!hsk_store_serialize(chain, w->data, &w->height)) {
+    hsk_store_log("could not serialize checkpoint data\n");
+    free(w);
+    return;
+  }
+
+  w->chain = chain;
+  hsk_store_filename(chain->prefix, w->tmp, w->height);
+  hsk_store_filename(chain->prefix, w->path, 0);
+
+  int rc = hsk_store_file_write(
+    chain->loop,
+    &w->file,
+    w->data,
+    HSK_STORE_CHECKPOINT_SIZE,
+    w->tmp,
+    w->path,
+    hsk_store_after_write,
+    (void *)w
+  );
+
+  if (rc != 0) {
+    hsk_store_log(
+      "could not open temp file to write checkpoint: %s (%s)\n",
+      w->tmp,
+      uv_strerror(rc)
+    );
+    free(w);
+    return;
+  }
+
+  chain->checkpoint = w;
+}
+
+void
+hsk_store_write_detach(hsk_chain_t *chain) {
+  // Let the write finish without touching the chain
+  if (chain->checkpoint) {
+    chain->checkpoint->chain = NULL;
+    chain->checkpoint = NULL;
+  }
 }
 
 bool
@@ -247,3 +559,993 @@ hsk_store_read(
 
   return true;
 }
+
+void
+hsk_store_cache_filename(const char *prefix, char *path) {
+  sprintf(
+    path,
+    "%s%c%s_%s%s",
+    prefix,
+    HSK_PATH_SEP,
+    HSK_STORE_CACHE_FILENAME,
+    HSK_NETWORK_NAME,
+    HSK_STORE_EXTENSION
+  );
+}
+
+/*
+ * Header Log
+ */
+
+static void
+hsk_store_log_filename(char *prefix, char *path, const char *ext) {
+  sprintf(
+    path,
+    "%s%c%s_%s%s",
+    prefix,
+    HSK_PATH_SEP,
+    HSK_STORE_LOG_FILENAME,
+    HSK_NETWORK_NAME,
+    ext
+  );
+}
+
+bool
+hsk_store_file_sync(FILE *file) {
+  if (fflush(file) != 0)
+    return false;
+
+#if defined(_WIN32)
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool
+hsk_store_file_resize(FILE *file, long size) {
+  if (fflush(file) != 0)
+    return false;
+
+#if defined(_WIN32)
+  if (_chsize(_fileno(file), size) != 0)
+    return false;
+#else
+  if (ftruncate(fileno(file), size) != 0)
+    return false;
+#endif
+
+  return fseek(file, size, SEEK_SET) == 0;
+}
+
+/*
+ * Header Log Index
+ */
+
+static bool
+hsk_store_index_reset(hsk_store_log_t *log) {
+  log->index_len = 0;
+
+  if (!log->index_file)
+    return true;
+
+  uint8_t buf[HSK_STORE_LOG_INDEX_HEADER_SIZE];
+  uint8_t *data = (uint8_t *)&buf;
+
+  write_u32be(&data, HSK_MAGIC);
+  write_u8(&data, HSK_STORE_LOG_INDEX_VERSION);
+
+  if (!hsk_store_file_resize(log->index_file, 0))
+    return false;
+
+  size_t size = HSK_STORE_LOG_INDEX_HEADER_SIZE;
+
+  return fwrite(buf, 1, size, log->index_file) == size;
+}
+
+static void
+hsk_store_index_open(hsk_store_log_t *log) {
+  log->index_file = fopen(log->index_path, "r+b");
+
+  if (!log->index_file) {
+    log->index_file = fopen(log->index_path, "w+b");
+
+    if (!log->index_file || !hsk_store_index_reset(log)) {
+      hsk_store_log("could not open header log index: %s\n", log->index_path);
+
+      if (log->index_file)
+        fclose(log->index_file);
+
+      log->index_file = NULL;
+    }
+
+    return;
+  }
+
+  uint8_t buf[HSK_STORE_LOG_INDEX_ENTRY_SIZE];
+  uint8_t *data = (uint8_t *)&buf;
+  size_t data_len = HSK_STORE_LOG_INDEX_HEADER_SIZE;
+  uint32_t magic;
+  uint8_t version;
+
+  if (fread(buf, 1, data_len, log->index_file) != data_len
+      || !read_u32be(&data, &data_len, &magic)
+      || magic != HSK_MAGIC
+      || !read_u8(&data, &data_len, &version)
+      || version != HSK_STORE_LOG_INDEX_VERSION) {
+    hsk_store_index_reset(log);
+    return;
+  }
+
+  // Read entries up to the first torn or out of order one.
+  for (;;) {
+    data = (uint8_t *)&buf;
+    data_len = HSK_STORE_LOG_INDEX_ENTRY_SIZE;
+
+    if (fread(buf, 1, data_len, log->index_file) != data_len)
+      break;
+
+    if (log->index_len == log->index_cap) {
+      size_t cap = log->index_cap ? log->index_cap * 2 : 64;
+      hsk_store_index_t *index =
+        realloc(log->index, cap * sizeof(hsk_store_index_t));
+
+      if (!index)
+        break;
+
+      log->index = index;
+      log->index_cap = cap;
+    }
+
+    hsk_store_index_t *entry = &log->index[log->index_len];
+
+    read_u32be(&data, &data_len, &entry->height);
+    read_bytes(&data, &data_len, entry->hash, 32);
+    read_bytes(&data, &data_len, entry->work, 32);
+
+    if (log->index_len > 0 && entry->height <= entry[-1].height)
+      break;
+
+    log->index_len += 1;
+  }
+
+  long size = HSK_STORE_LOG_INDEX_HEADER_SIZE
+    + (long)log->index_len * HSK_STORE_LOG_INDEX_ENTRY_SIZE;
+
+  if (!hsk_store_file_resize(log->index_file, size))
+    hsk_store_index_reset(log);
+}
+
+static void
+hsk_store_index_close(hsk_store_log_t *log) {
+  if (log->index_file) {
+    hsk_store_log("closing header log index: %s\n", log->index_path);
+    fclose(log->index_file);
+  }
+
+  log->index_file = NULL;
+  log->index_len = 0;
+}
+
+// Drop every entry at or above `height`.
+static bool
+hsk_store_index_truncate(hsk_store_log_t *log, uint32_t height) {
+  size_t len = log->index_len;
+
+  while (len > 0 && log->index[len - 1].height >= height)
+    len -= 1;
+
+  if (len == log->index_len)
+    return true;
+
+  log->index_len = len;
+
+  if (!log->index_file)
+    return true;
+
+  long size = HSK_STORE_LOG_INDEX_HEADER_SIZE
+    + (long)len * HSK_STORE_LOG_INDEX_ENTRY_SIZE;
+
+  return hsk_store_file_resize(log->index_file, size);
+}
+
+static bool
+hsk_store_index_add(hsk_store_log_t *log, hsk_header_t *hdr) {
+  if (!log->index_file)
+    return true;
+
+  if (hdr->height % HSK_STORE_LOG_INDEX_INTERVAL != 0)
+    return true;
+
+  if (log->index_len > 0
+      && log->index[log->index_len - 1].height >= hdr->height) {
+    return true;
+  }
+
+  if (log->index_len == log->index_cap) {
+    size_t cap = log->index_cap ? log->index_cap * 2 : 64;
+    hsk_store_index_t *index =
+      realloc(log->index, cap * sizeof(hsk_store_index_t));
+
+    if (!index)
+      return false;
+
+    log->index = index;
+    log->index_cap = cap;
+  }
+
+  hsk_store_index_t *entry = &log->index[log->index_len];
+
+  entry->height = hdr->height;
+  memcpy(entry->hash, hsk_header_cache(hdr), 32);
+  memcpy(entry->work, hdr->work, 32);
+
+  uint8_t buf[HSK_STORE_LOG_INDEX_ENTRY_SIZE];
+  uint8_t *data = (uint8_t *)&buf;
+
+  write_u32be(&data, entry->height);
+  write_bytes(&data, entry->hash, 32);
+  write_bytes(&data, entry->work, 32);
+
+  size_t size = HSK_STORE_LOG_INDEX_ENTRY_SIZE;
+
+  if (fwrite(buf, 1, size, log->index_file) != size)
+    return false;
+
+  log->index_len += 1;
+
+  return true;
+}
+
+/*
+ * Header Log Mapping
+ */
+
+static void
+hsk_store_log_unmap(hsk_store_log_t *log) {
+#if !defined(_WIN32)
+  if (log->map)
+    munmap(log->map, log->map_len);
+#endif
+
+  log->map = NULL;
+  log->map_len = 0;
+}
+
+static bool
+hsk_store_log_map(hsk_store_log_t *log) {
+#if defined(_WIN32)
+  return false;
+#else
+  if (fflush(log->file) != 0)
+    return false;
+
+  struct stat st;
+
+  if (fstat(fileno(log->file), &st) != 0)
+    return false;
+
+  if (st.st_size == 0)
+    return false;
+
+  void *map = mmap(
+    NULL,
+    (size_t)st.st_size,
+    PROT_READ,
+    MAP_SHARED,
+    fileno(log->file),
+    0
+  );
+
+  // Keep the old mapping, evicted headers need it.
+  if (map == MAP_FAILED)
+    return false;
+
+  hsk_store_log_unmap(log);
+
+  log->map = map;
+  log->map_len = (size_t)st.st_size;
+
+  return true;
+#endif
+}
+
+bool
+hsk_store_log_has(const hsk_store_log_t *log, uint32_t height) {
+  if (!log || !log->map)
+    return false;
+
+  return height >= log->start && height < log->start + log->count;
+}
+
+// Decodes the record at `height` without its chainwork.
+static bool
+hsk_store_log_decode(hsk_store_log_t *log, uint32_t height, hsk_header_t *hdr) {
+  if (!hsk_store_log_has(log, height))
+    return false;
+
+  size_t pos = HSK_STORE_LOG_HEADER_SIZE
+    + (size_t)(height - log->start) * HSK_HEADER_SIZE;
+
+  // Appended since the last mapping.
+  if (pos + HSK_HEADER_SIZE > log->map_len) {
+    if (!hsk_store_log_map(log))
+      return false;
+
+    if (pos + HSK_HEADER_SIZE > log->map_len)
+      return false;
+  }
+
+  hsk_header_init(hdr);
+
+  if (!hsk_header_decode(&log->map[pos], HSK_HEADER_SIZE, hdr))
+    return false;
+
+  hdr->height = height;
+
+  return true;
+}
+
+bool
+hsk_store_log_read(hsk_store_log_t *log, uint32_t height, hsk_header_t *hdr) {
+  if (!hsk_store_log_decode(log, height, hdr))
+    return false;
+
+  hsk_header_cache(hdr);
+
+  // Sum chainwork from the nearest known total:
+  // an index entry or the start of the log.
+  uint32_t base = log->start;
+  const uint8_t *work = log->work;
+  size_t lo = 0;
+  size_t hi = log->index_len;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (log->index[mid].height <= height)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo > 0 && log->index[lo - 1].height >= base) {
+    base = log->index[lo - 1].height;
+    work = log->index[lo - 1].work;
+  }
+
+  hsk_header_t prev;
+  hsk_header_t next;
+  uint32_t h;
+
+  memcpy(prev.work, work, 32);
+
+  for (h = base + 1; h < height; h++) {
+    if (!hsk_store_log_decode(log, h, &next))
+      return false;
+
+    if (!hsk_header_calc_work(&next, &prev))
+      return false;
+
+    memcpy(prev.work, next.work, 32);
+  }
+
+  if (height == base)
+    memcpy(hdr->work, work, 32);
+  else if (!hsk_header_calc_work(hdr, &prev))
+    return false;
+
+  return true;
+}
+
+void
+hsk_store_log_prune(hsk_chain_t *chain) {
+  hsk_store_log_t *log = chain->log;
+
+  if (!log || !log->map)
+    return;
+
+  if (chain->height < HSK_STORE_LOG_WINDOW)
+    return;
+
+  uint32_t end = (uint32_t)chain->height - HSK_STORE_LOG_WINDOW;
+
+  if (log->pruned < log->start)
+    log->pruned = log->start;
+
+  for (; log->pruned <= end; log->pruned++) {
+    if (!hsk_store_log_has(log, log->pruned))
+      break;
+
+    if (hsk_chain_evict(chain, log->pruned))
+      log->evicted = true;
+  }
+}
+
+/*
+ * Header Log Writes
+ */
+
+static bool
+hsk_store_log_sync(hsk_store_log_t *log) {
+  if (!hsk_store_file_sync(log->file))
+    return false;
+
+  if (log->index_file && !hsk_store_file_sync(log->index_file))
+    return false;
+
+  log->unsynced = 0;
+
+  return true;
+}
+
+// In-flight asynchronous sync of a duplicated
+// descriptor, so the log may close before it lands.
+typedef struct hsk_store_sync_s {
+  uv_fs_t req;
+  uv_file fd;
+} hsk_store_sync_t;
+
+static void
+hsk_store_after_log_fsync(uv_fs_t *req) {
+  hsk_store_sync_t *sync = (hsk_store_sync_t *)req->data;
+  int rc = (int)req->result;
+
+  uv_fs_req_cleanup(req);
+
+  if (rc < 0)
+    hsk_store_log("could not sync header log (%s)\n", uv_strerror(rc));
+
+  uv_fs_close(req->loop, req, sync->fd, NULL);
+  uv_fs_req_cleanup(req);
+
+  free(sync);
+}
+
+static bool
+hsk_store_file_sync_async(uv_loop_t *loop, FILE *file) {
+  if (fflush(file) != 0)
+    return false;
+
+  hsk_store_sync_t *sync = malloc(sizeof(hsk_store_sync_t));
+
+  if (!sync)
+    return false;
+
+#if defined(_WIN32)
+  sync->fd = _dup(_fileno(file));
+#else
+  sync->fd = dup(fileno(file));
+#endif
+
+  if (sync->fd < 0) {
+    free(sync);
+    return false;
+  }
+
+  sync->req.data = (void *)sync;
+
+  if (uv_fs_fsync(loop, &sync->req, sync->fd, hsk_store_after_log_fsync) != 0) {
+    uv_fs_t req;
+    uv_fs_close(loop, &req, sync->fd, NULL);
+    uv_fs_req_cleanup(&req);
+    free(sync);
+    return false;
+  }
+
+  return true;
+}
+
+// Like hsk_store_log_sync, but with an event loop the
+// fsyncs run on the threadpool. Only the flush to the
+// kernel happens here.
+static bool
+hsk_store_log_flush(hsk_store_log_t *log) {
+  if (!log->loop)
+    return hsk_store_log_sync(log);
+
+  if (!hsk_store_file_sync_async(log->loop, log->file))
+    return false;
+
+  if (log->index_file && !hsk_store_file_sync_async(log->loop, log->index_file))
+    return false;
+
+  log->unsynced = 0;
+
+  return true;
+}
+
+// Reorgs and rewrites need no synchronous fsync either:
+// replay checks every record against its predecessor, so
+// a lost truncate leaves stale records it cuts off itself.
+static bool
+hsk_store_log_resize(hsk_store_log_t *log, uint32_t count) {
+  long size = HSK_STORE_LOG_HEADER_SIZE + (long)count * HSK_HEADER_SIZE;
+
+  if (!hsk_store_file_resize(log->file, size))
+    return false;
+
+  log->count = count;
+
+  if (!hsk_store_index_truncate(log, log->start + count))
+    return false;
+
+  return hsk_store_log_flush(log);
+}
+
+static bool
+hsk_store_log_write(hsk_store_log_t *log, hsk_header_t *hdr) {
+  uint8_t raw[HSK_HEADER_SIZE];
+
+  hsk_header_encode(hdr, raw);
+
+  if (fwrite(raw, 1, HSK_HEADER_SIZE, log->file) != HSK_HEADER_SIZE)
+    return false;
+
+  log->count += 1;
+  log->unsynced += 1;
+
+  if (!hsk_store_index_add(log, hdr))
+    return false;
+
+  if (log->unsynced >= HSK_STORE_LOG_SYNC_INTERVAL)
+    return hsk_store_log_flush(log);
+
+  return true;
+}
+
+static bool
+hsk_store_log_rewrite(hsk_chain_t *chain, hsk_store_log_t *log) {
+  // Evicted headers only live in this file.
+  if (log->evicted)
+    return false;
+
+  hsk_header_t *first = hsk_chain_get_by_height(chain, chain->init_height);
+
+  if (!first)
+    return false;
+
+  uint8_t buf[HSK_STORE_LOG_HEADER_SIZE];
+  uint8_t *data = (uint8_t *)&buf;
+
+  write_u32be(&data, HSK_MAGIC);
+  write_u8(&data, HSK_STORE_LOG_VERSION);
+  write_u32be(&data, chain->init_height);
+  write_bytes(&data, first->work, 32);
+
+  hsk_store_log_unmap(log);
+
+  if (!hsk_store_file_resize(log->file, 0))
+    return false;
+
+  if (!hsk_store_index_reset(log))
+    return false;
+
+  if (fwrite(buf, 1, HSK_STORE_LOG_HEADER_SIZE, log->file)
+      != HSK_STORE_LOG_HEADER_SIZE) {
+    return false;
+  }
+
+  log->start = chain->init_height;
+  memcpy(log->work, first->work, 32);
+  log->count = 0;
+  log->pruned = log->start;
+
+  for (uint32_t h = log->start; h <= (uint32_t)chain->height; h++) {
+    hsk_header_t *hdr = hsk_chain_get_by_height(chain, h);
+
+    if (!hdr || !hsk_store_log_write(log, hdr))
+      return false;
+  }
+
+  if (!hsk_store_log_flush(log))
+    return false;
+
+  hsk_store_log(
+    "(%u) rewrote header log from height %u: %s\n",
+    (uint32_t)chain->height,
+    log->start,
+    log->path
+  );
+
+  return true;
+}
+
+/*
+ * Header Log Replay
+ */
+
+// Pick an index entry to replay from, leaving everything
+// below it on disk. Returns the record number to start at.
+static uint32_t
+hsk_store_log_base(
+  hsk_chain_t *chain,
+  hsk_store_log_t *log,
+  uint32_t count,
+  uint8_t *work
+) {
+#if defined(_WIN32)
+  // No mapping to serve skipped headers from.
+  return 0;
+#else
+  if (count <= HSK_STORE_LOG_WINDOW)
+    return 0;
+
+  uint32_t limit = log->start + count - HSK_STORE_LOG_WINDOW;
+  size_t i = log->index_len;
+
+  while (i > 0 && log->index[i - 1].height > limit)
+    i -= 1;
+
+  if (i == 0)
+    return 0;
+
+  hsk_store_index_t *entry = &log->index[i - 1];
+
+  // Checkpoints already cover this height.
+  if (entry->height <= log->start || entry->height <= chain->height)
+    return 0;
+
+  uint32_t first = entry->height - log->start;
+  long pos = HSK_STORE_LOG_HEADER_SIZE + (long)first * HSK_HEADER_SIZE;
+  uint8_t raw[HSK_HEADER_SIZE];
+  hsk_header_t hdr;
+
+  hsk_header_init(&hdr);
+
+  if (fseek(log->file, pos, SEEK_SET) != 0
+      || fread(raw, 1, HSK_HEADER_SIZE, log->file) != HSK_HEADER_SIZE
+      || !hsk_header_decode(raw, HSK_HEADER_SIZE, &hdr)
+      || memcmp(hsk_header_cache(&hdr), entry->hash, 32) != 0) {
+    hsk_store_log("header log index does not match: %s\n", log->index_path);
+    return 0;
+  }
+
+  memcpy(work, entry->work, 32);
+
+  return first;
+#endif
+}
+
+// Returns the number of records in the log that are valid,
+// restoring those above the chain tip, or -1 if the log
+// conflicts with the chain and must be rewritten.
+static int64_t
+hsk_store_log_replay(
+  hsk_chain_t *chain,
+  hsk_store_log_t *log,
+  const uint8_t *work,
+  uint32_t first,
+  uint32_t count
+) {
+  uint8_t raw[HSK_HEADER_SIZE];
+  hsk_header_t *prev = NULL;
+  uint32_t i;
+
+  if (log->start + first > 0)
+    prev = hsk_chain_get_by_height(chain, log->start + first - 1);
+
+  long pos = HSK_STORE_LOG_HEADER_SIZE + (long)first * HSK_HEADER_SIZE;
+
+  if (fseek(log->file, pos, SEEK_SET) != 0)
+    return -1;
+
+  for (i = first; i < count; i++) {
+    if (fread(raw, 1, HSK_HEADER_SIZE, log->file) != HSK_HEADER_SIZE)
+      break;
+
+    hsk_header_t *hdr = hsk_header_alloc();
+
+    if (!hdr)
+      break;
+
+    if (!hsk_header_decode(raw, HSK_HEADER_SIZE, hdr)) {
+      free(hdr);
+      break;
+    }
+
+    const uint8_t *hash = hsk_header_cache(hdr);
+    hdr->height = log->start + i;
+
+    // Already in the chain from a checkpoint.
+    if (hdr->height <= chain->height) {
+      hsk_header_t *entry = hsk_chain_get_by_height(chain, hdr->height);
+
+      if (entry && memcmp(entry->hash, hash, 32) != 0) {
+        free(hdr);
+        return -1;
+      }
+
+      prev = entry;
+      free(hdr);
+      continue;
+    }
+
+    if (prev) {
+      if (memcmp(hdr->prev_block, prev->hash, 32) != 0) {
+        free(hdr);
+        break;
+      }
+
+      if (!hsk_header_calc_work(hdr, prev)) {
+        free(hdr);
+        break;
+      }
+    } else if (i == first) {
+      // Log starts above everything we have,
+      // inject it like a checkpoint.
+      memcpy(hdr->work, work, 32);
+      chain->init_height = hdr->height;
+    } else {
+      free(hdr);
+      break;
+    }
+
+    // Every other record is vouched for by its
+    // successor's prev_block, the tail is not.
+    if (i == count - 1 && hsk_header_verify_pow(hdr) != HSK_SUCCESS) {
+      free(hdr);
+      break;
+    }
+
+    if (hsk_chain_restore(chain, hdr) != HSK_SUCCESS) {
+      free(hdr);
+      break;
+    }
+
+    if (!hsk_store_index_add(log, hdr))
+      hsk_store_index_close(log);
+
+    prev = hdr;
+  }
+
+  // Nothing usable above a lazy base.
+  if (first > 0 && i == first)
+    return -1;
+
+  return i;
+}
+
+bool
+hsk_store_log_open(hsk_chain_t *chain) {
+  assert(chain && chain->prefix && !chain->log);
+
+  hsk_store_log_t *log = malloc(sizeof(hsk_store_log_t));
+
+  if (!log)
+    return false;
+
+  memset(log, 0, sizeof(hsk_store_log_t));
+
+  log->loop = chain->loop;
+
+  hsk_store_log_filename(chain->prefix, log->path, HSK_STORE_EXTENSION);
+  hsk_store_log_filename(
+    chain->prefix,
+    log->index_path,
+    HSK_STORE_LOG_INDEX_EXTENSION
+  );
+
+  bool fresh = false;
+  log->file = fopen(log->path, "r+b");
+
+  if (!log->file) {
+    log->file = fopen(log->path, "w+b");
+    fresh = true;
+  }
+
+  if (!log->file) {
+    hsk_store_log("could not open header log: %s\n", log->path);
+    free(log);
+    return false;
+  }
+
+  hsk_store_index_open(log);
+
+  int64_t kept = -1;
+
+  if (!fresh) {
+    uint8_t buf[HSK_STORE_LOG_HEADER_SIZE];
+    uint8_t *data = (uint8_t *)&buf;
+    size_t data_len = HSK_STORE_LOG_HEADER_SIZE;
+    uint32_t magic;
+    uint8_t version;
+    uint8_t work[32];
+
+    fseek(log->file, 0, SEEK_END);
+    long size = ftell(log->file);
+    fseek(log->file, 0, SEEK_SET);
+
+    if (size >= HSK_STORE_LOG_HEADER_SIZE
+        && fread(buf, 1, data_len, log->file) == data_len
+        && read_u32be(&data, &data_len, &magic)
+        && magic == HSK_MAGIC
+        && read_u8(&data, &data_len, &version)
+        && version == HSK_STORE_LOG_VERSION
+        && read_u32be(&data, &data_len, &log->start)
+        && read_bytes(&data, &data_len, work, 32)) {
+      memcpy(log->work, work, 32);
+
+      long body = size - HSK_STORE_LOG_HEADER_SIZE;
+      uint32_t count = body / HSK_HEADER_SIZE;
+
+      if (body % HSK_HEADER_SIZE != 0)
+        hsk_store_log("truncating torn record in header log: %s\n", log->path);
+
+      // Start from an indexed height if possible,
+      // the index is rebuilt from there on.
+      uint32_t first = hsk_store_log_base(chain, log, count, work);
+
+      // Headers below the base only live in the log.
+      if (first > 0) {
+        hsk_store_index_truncate(log, log->start + first + 1);
+        log->pruned = log->start + first;
+        log->evicted = true;
+      } else {
+        hsk_store_index_reset(log);
+      }
+
+      kept = hsk_store_log_replay(chain, log, work, first, count);
+
+      if (kept >= 0 && kept < count) {
+        hsk_store_log(
+          "truncating header log at height %u: %s\n",
+          log->start + (uint32_t)kept,
+          log->path
+        );
+      }
+    } else {
+      hsk_store_log("invalid header log, rewriting: %s\n", log->path);
+    }
+  }
+
+  if (kept > 0) {
+    if (!hsk_store_log_resize(log, (uint32_t)kept))
+      goto fail;
+
+    hsk_store_log(
+      "(%u) restored chain from header log: %s\n",
+      (uint32_t)chain->height,
+      log->path
+    );
+  } else if (!hsk_store_log_rewrite(chain, log)) {
+    goto fail;
+  }
+
+  chain->log = log;
+
+  // Log may end below a newer checkpoint.
+  if (log->start + log->count <= chain->height)
+    hsk_store_log_append(chain, chain->tip);
+
+  // Serve old headers from the page cache.
+  if (chain->log && hsk_store_log_map(log))
+    hsk_store_log_prune(chain);
+
+  return true;
+
+fail:
+  hsk_store_log("could not initialize header log: %s\n", log->path);
+  hsk_store_log_unmap(log);
+  fclose(log->file);
+  if (log->index_file)
+    fclose(log->index_file);
+  free(log->index);
+  free(log);
+  return false;
+}
+
+void
+hsk_store_log_close(hsk_chain_t *chain) {
+  hsk_store_log_t *log = chain->log;
+
+  if (!log)
+    return;
+
+  if (!log->readonly && !hsk_store_log_sync(log))
+    hsk_store_log("could not sync header log: %s\n", log->path);
+
+  hsk_store_log_unmap(log);
+  fclose(log->file);
+
+  if (log->index_file)
+    fclose(log->index_file);
+
+  free(log->index);
+  free(log);
+
+  chain->log = NULL;
+}
+
+static void
+hsk_store_log_fail(hsk_chain_t *chain) {
+  hsk_store_log_t *log = chain->log;
+
+  // Evicted headers only live in this file. Keep
+  // serving those, but stop writing and evicting.
+  if (log->evicted && (log->map || hsk_store_log_map(log))) {
+    hsk_store_log("header log write failed, keeping it read-only: %s\n",
+                  log->path);
+    log->readonly = true;
+    log->count = log->pruned > log->start ? log->pruned - log->start : 0;
+    return;
+  }
+
+  hsk_store_log("header log write failed, disabling: %s\n", log->path);
+  hsk_store_log_close(chain);
+}
+
+void
+hsk_store_log_append(hsk_chain_t *chain, hsk_header_t *hdr) {
+  hsk_store_log_t *log = chain->log;
+
+  assert(log && hdr);
+
+  if (log->readonly)
+    return;
+
+  uint32_t next = log->start + log->count;
+
+  if (hdr->height < log->start) {
+    if (!hsk_store_log_rewrite(chain, log))
+      hsk_store_log_fail(chain);
+    return;
+  }
+
+  // Replacing headers after a reorg.
+  if (hdr->height < next) {
+    if (!hsk_store_log_resize(log, hdr->height - log->start)) {
+      hsk_store_log_fail(chain);
+      return;
+    }
+  }
+
+  // Fill in headers connected by a reorg.
+  for (uint32_t h = next; h < hdr->height; h++) {
+    hsk_header_t *entry = hsk_chain_get_by_height(chain, h);
+
+    if (!entry) {
+      if (!hsk_store_log_rewrite(chain, log))
+        hsk_store_log_fail(chain);
+      return;
+    }
+
+    if (!hsk_store_log_write(log, entry)) {
+      hsk_store_log_fail(chain);
+      return;
+    }
+  }
+
+  if (!hsk_store_log_write(log, hdr)) {
+    hsk_store_log_fail(chain);
+    return;
+  }
+
+  // Once synced, new blocks are rare enough
+  // to make every one of them durable.
+  if (chain->synced && !hsk_store_log_flush(log)) {
+    hsk_store_log_fail(chain);
+    return;
+  }
+
+  hsk_store_log_prune(chain);
+}
+
+void
+hsk_store_log_truncate(hsk_chain_t *chain, uint32_t height) {
+  hsk_store_log_t *log = chain->log;
+
+  assert(log);
+
+  if (log->readonly)
+    return;
+
+  if (height < log->start)
+    height = log->start;
+
+  if (height >= log->start + log->count)
+    return;
+
+  if (!hsk_store_log_resize(log, height - log->start))
+    hsk_store_log_fail(chain);
+}
@@ -1,7 +1,10 @@
 #ifndef _HSK_STORE
 #define _HSK_STORE
 
+#include <stdio.h>
+
 #include "chain.h"
+#include "uv.h"
 
 /*
  * Defs
@@ -23,6 +26,117 @@
 #define HSK_STORE_PATH_RESERVED 32
 #define HSK_STORE_PATH_MAX 1024
 
+// Version 0 header log file serialization:
+// Size    Data
+//  4       network magic
+//  1       version (0)
+//  4       start height
+//  32      total chainwork including block at start height
+//  236*n   serialized main chain headers from start height
+//
+// Headers are fixed size, so the record for height h
+// lives at HSK_STORE_LOG_HEADER_SIZE + (h - start) * 236.
+
+#define HSK_STORE_CACHE_FILENAME "cache"
+
+#define HSK_STORE_LOG_VERSION 0
+#define HSK_STORE_LOG_HEADER_SIZE 41
+#define HSK_STORE_LOG_FILENAME "headers"
+#define HSK_STORE_LOG_SYNC_INTERVAL 500
+
+// Version 0 header log index serialization:
+// Size    Data
+//  4       network magic
+//  1       version (0)
+//  68*n    entries of:
+//            4   height
+//            32  header hash
+//            32  total chainwork including block at height
+//
+// An entry is added every HSK_STORE_LOG_INDEX_INTERVAL
+// heights. On startup, the newest entry at least one
+// materialized window below the log tail lets the log
+// be replayed from there instead of from its start.
+
+#define HSK_STORE_LOG_INDEX_VERSION 0
+#define HSK_STORE_LOG_INDEX_HEADER_SIZE 5
+#define HSK_STORE_LOG_INDEX_ENTRY_SIZE 68
+#define HSK_STORE_LOG_INDEX_EXTENSION ".idx"
+#define HSK_STORE_LOG_INDEX_INTERVAL HSK_STORE_CHECKPOINT_WINDOW
+
+// Headers within this distance of the tip are kept in
+// memory, older ones are read from the mapped log on
+// demand. Must cover reorgs, retargeting and the
+// chainwork lookup in hsk_store_write().
+#define HSK_STORE_LOG_WINDOW (2 * HSK_STORE_CHECKPOINT_WINDOW)
+
+/*
+ * Types
+ */
+
+typedef struct hsk_store_file_s hsk_store_file_t;
+
+// Called once the write is done. On failure `step`
+// names the operation that failed.
+typedef void (*hsk_store_file_cb)(
+  hsk_store_file_t *file,
+  const char *step,
+  int status
+);
+
+// In-flight asynchronous file write. Data goes to
+// `tmp`, which is synced and closed before being
+// renamed over `path`. Setting `cancel` skips the
+// rename and removes the temp file instead.
+struct hsk_store_file_s {
+  uv_fs_t req;
+  uv_file fd;
+  const uint8_t *data;
+  size_t data_len;
+  size_t pos;
+  const char *tmp;
+  const char *path;
+  bool cancel;
+  hsk_store_file_cb cb;
+  void *arg;
+};
+
+// In-flight asynchronous checkpoint write.
+typedef struct hsk_store_write_s {
+  hsk_store_file_t file;
+  hsk_chain_t *chain;
+  uint32_t height;
+  uint8_t data[HSK_STORE_CHECKPOINT_SIZE];
+  char tmp[HSK_STORE_PATH_MAX];
+  char path[HSK_STORE_PATH_MAX];
+} hsk_store_write_t;
+
+typedef struct hsk_store_index_s {
+  uint32_t height;
+  uint8_t hash[32];
+  uint8_t work[32];
+} hsk_store_index_t;
+
+typedef struct hsk_store_log_s {
+  uv_loop_t *loop;
+  FILE *file;
+  uint32_t start;
+  uint8_t work[32];
+  uint32_t count;
+  uint32_t unsynced;
+  uint32_t pruned;
+  bool evicted;
+  bool readonly;
+  FILE *index_file;
+  hsk_store_index_t *index;
+  size_t index_len;
+  size_t index_cap;
+  uint8_t *map;
+  size_t map_len;
+  char path[HSK_STORE_PATH_MAX];
+  char index_path[HSK_STORE_PATH_MAX];
+} hsk_store_log_t;
+
 /*
  * Store
  */
@@ -31,7 +145,28 @@ bool
 hsk_store_exists(char *path);
 
 void
-hsk_store_write(const hsk_chain_t *chain);
+hsk_store_cache_filename(const char *prefix, char *path);
+
+bool
+hsk_store_file_sync(FILE *file);
+
+int
+hsk_store_file_write(
+  uv_loop_t *loop,
+  hsk_store_file_t *file,
+  const uint8_t *data,
+  size_t data_len,
+  const char *tmp,
+  const char *path,
+  hsk_store_file_cb cb,
+  void *arg
+);
+
+void
+hsk_store_write(hsk_chain_t *chain);
+
+void
+hsk_store_write_detach(hsk_chain_t *chain);
 
 bool
 hsk_store_inject_checkpoint(
@@ -47,4 +182,25 @@ hsk_store_read(
   hsk_chain_t *chain
 );
 
+bool
+hsk_store_log_open(hsk_chain_t *chain);
+
+void
+hsk_store_log_close(hsk_chain_t *chain);
+
+void
+hsk_store_log_append(hsk_chain_t *chain, hsk_header_t *hdr);
+
+void
+hsk_store_log_truncate(hsk_chain_t *chain, uint32_t height);
+
+bool
+hsk_store_log_has(const hsk_store_log_t *log, uint32_t height);
+
+bool
+hsk_store_log_read(hsk_store_log_t *log, uint32_t height, hsk_header_t *hdr);
+
+void
+hsk_store_log_prune(hsk_chain_t *chain);
+
 #endif
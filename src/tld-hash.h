@@ -0,0 +1,203 @@
+#ifndef _HSK_TLD_HASH_H
+#define _HSK_TLD_HASH_H
+
+/* Autogenerated by scripts/tld-hash.py, do not edit. */
+
+#include <stdint.h>
+
+#define HSK_TLD_HASH_SIZE 1489
+#define HSK_TLD_HASH_BUCKETS 373
+
+// Pseudo-TLDs missing from HSK_TLD_NAMES,
+// indexed from HSK_TLD_SIZE.
+static const char *HSK_TLD_EXTRA[] = {
+  "bit",
+  "eth",
+  "exit",
+  "gnu",
+  "i2p",
+  "onion",
+  "tor",
+  "zkey"
+};
+
+static const uint16_t HSK_TLD_HASH_DISP[373] = {
+  36, 8, 35, 10, 25, 1, 2, 5, 64, 0, 167, 1,
+  5, 3, 80, 178, 30, 14, 34, 8, 117, 40, 0, 0,
+  1, 38, 27, 0, 53, 73, 10, 42, 183, 2, 24, 42,
+  9, 40, 2, 12, 99, 0, 9, 151, 32, 284, 123, 3,
+  62, 2, 2, 2, 0, 0, 105, 32, 273, 1, 108, 46,
+  28, 201, 28, 11, 276, 12, 301, 276, 76, 68, 41, 9,
+  292, 2, 22, 0, 5, 374, 0, 60, 52, 29, 66, 1,
+  17, 70, 8, 127, 23, 6, 157, 143, 5, 563, 37, 1,
+  4, 377, 35, 156, 19, 39, 2, 2, 87, 237, 556, 20,
+  0, 32, 39, 31, 3, 12, 11, 0, 193, 3, 9, 0,
+  222, 8, 59, 1226, 2, 46, 7, 1, 92, 2, 0, 25,
+  56, 254, 730, 26, 51, 0, 89, 297, 622, 9, 36, 103,
+  35, 160, 0, 1, 31, 116, 6, 21, 0, 11, 6, 1,
+  142, 0, 62, 106, 237, 195, 15, 136, 5, 102, 0, 25,
+  99, 4, 0, 300, 2, 542, 0, 125, 98, 36, 24, 77,
+  193, 251, 733, 0, 111, 0, 40, 2, 343, 2, 0, 37,
+  40, 83, 71, 1, 73, 17, 40, 70, 2, 5, 3, 0,
+  591, 14, 285, 0, 143, 0, 48, 414, 6, 1040, 4, 10,
+  533, 27, 5, 18, 605, 534, 0, 74, 261, 4, 162, 118,
+  534, 19, 174, 2038, 92, 7, 4, 64, 60, 55, 68, 1,
+  1, 2, 2, 5, 116, 17, 45, 12, 29, 177, 246, 51,
+  130, 15, 0, 318, 14, 382, 209, 2, 2225, 20, 23, 63,
+  17, 45, 22, 303, 10, 34, 22, 453, 57, 299, 272, 831,
+  9, 600, 87, 2, 17, 22, 33, 4, 122, 2, 5, 14,
+  25, 319, 40, 0, 785, 1606, 3, 61, 0, 93, 65, 170,
+  215, 681, 17, 5, 1183, 24, 7, 14, 205, 53, 3, 27,
+  0, 892, 140, 25, 26, 40, 1, 36, 3, 143, 421, 32,
+  2, 24, 1164, 532, 94, 98, 0, 5, 30, 159, 570, 30,
+  6380, 0, 358, 6, 270, 2, 437, 144, 0, 39, 12, 8,
+  12, 3251, 560, 7, 23, 100, 16, 160, 43, 1270, 107, 179,
+  368, 85, 962, 167, 478, 22, 193, 38, 72, 1, 655, 62,
+  1850
+};
+
+static const uint16_t HSK_TLD_HASH_SLOTS[1489] = {
+  622, 405, 791, 996, 680, 593, 1012, 627, 1281, 393, 397, 767,
+  188, 1150, 961, 59, 139, 494, 89, 1240, 528, 1373, 835, 151,
+  47, 906, 1372, 161, 1221, 109, 526, 485, 1094, 1399, 1224, 1296,
+  220, 453, 1443, 615, 468, 424, 1259, 1287, 686, 1379, 1194, 516,
+  1109, 829, 67, 941, 947, 1339, 341, 683, 530, 260, 578, 797,
+  87, 349, 333, 1141, 810, 251, 1463, 677, 843, 291, 737, 132,
+  479, 669, 144, 564, 438, 708, 180, 813, 841, 1247, 955, 837,
+  223, 1264, 88, 1173, 437, 430, 545, 1214, 279, 1039, 110, 663,
+  707, 44, 854, 642, 890, 1355, 1349, 1069, 828, 1231, 1262, 143,
+  101, 232, 725, 14, 20, 943, 429, 117, 455, 1180, 1447, 1028,
+  486, 798, 504, 936, 877, 783, 27, 1191, 269, 815, 3, 741,
+  624, 754, 614, 975, 976, 1461, 111, 1327, 1450, 337, 103, 315,
+  445, 743, 712, 1462, 265, 777, 1042, 1075, 938, 871, 823, 1157,
+  390, 1304, 1099, 1, 175, 406, 330, 1110, 505, 320, 1300, 1020,
+  1018, 164, 1167, 755, 565, 1426, 356, 202, 1375, 326, 949, 1424,
+  1292, 401, 283, 1192, 1384, 342, 247, 316, 235, 1058, 452, 413,
+  946, 739, 1486, 54, 53, 22, 1416, 929, 958, 860, 965, 363,
+  1449, 718, 195, 1177, 1415, 324, 1154, 922, 1129, 474, 506, 1273,
+  851, 971, 503, 1122, 82, 926, 293, 527, 1313, 1187, 1352, 248,
+  809, 402, 1234, 1168, 131, 323, 442, 303, 358, 32, 15, 1136,
+  1050, 328, 1073, 1101, 435, 481, 1452, 447, 240, 919, 801, 534,
+  174, 753, 179, 728, 676, 691, 970, 1201, 502, 532, 1376, 1432,
+  85, 617, 1288, 1144, 1090, 373, 966, 1190, 1026, 268, 832, 467,
+  752, 1066, 225, 319, 873, 1082, 911, 1294, 331, 1207, 351, 146,
+  713, 796, 162, 1397, 119, 255, 1362, 700, 1303, 566, 1271, 726,
+  1407, 1454, 592, 1422, 1052, 687, 1038, 586, 1139, 979, 57, 8,
+  1045, 679, 731, 121, 244, 176, 844, 834, 652, 974, 1239, 104,
+  1290, 284, 1431, 1257, 558, 954, 404, 611, 806, 584, 471, 1465,
+  433, 249, 347, 314, 933, 1153, 469, 190, 882, 613, 1034, 1030,
+  1183, 1236, 1164, 921, 340, 734, 1166, 842, 761, 1169, 1420, 610,
+  826, 830, 317, 1203, 309, 1043, 888, 1014, 786, 1307, 70, 34,
+  1298, 1056, 1385, 1124, 1358, 97, 1451, 883, 1378, 388, 7, 866,
+  746, 1275, 410, 385, 1392, 596, 216, 893, 48, 332, 735, 563,
+  788, 905, 419, 643, 1120, 1131, 1248, 1408, 1193, 477, 118, 959,
+  1202, 612, 897, 1320, 550, 814, 1333, 377, 327, 204, 1297, 1112,
+  203, 115, 354, 1381, 1147, 17, 83, 1467, 338, 273, 412, 427,
+  859, 574, 1359, 932, 1003, 944, 428, 1394, 241, 986, 994, 423,
+  1186, 379, 816, 1374, 415, 311, 1104, 1215, 827, 869, 681, 389,
+  436, 1087, 635, 94, 597, 682, 2, 1133, 1282, 1466, 793, 963,
+  644, 226, 264, 907, 1159, 92, 1033, 817, 432, 443, 30, 394,
+  1400, 521, 1455, 1212, 952, 666, 1470, 695, 1364, 49, 482, 290,
+  864, 1008, 256, 1487, 1225, 633, 382, 559, 1004, 672, 1322, 150,
+  667, 1217, 308, 1334, 568, 1438, 71, 219, 304, 1242, 1182, 1023,
+  570, 664, 885, 1064, 1021, 1222, 177, 874, 1309, 210, 1027, 567,
+  1107, 1059, 831, 386, 343, 1025, 148, 344, 928, 312, 100, 355,
+  1311, 785, 1481, 261, 362, 589, 515, 630, 1398, 715, 1314, 1371,
+  1179, 285, 18, 297, 305, 46, 1406, 1204, 1209, 1477, 1266, 1123,
+  886, 451, 1475, 346, 1444, 1116, 1170, 383, 457, 1184, 463, 554,
+  130, 940, 852, 72, 122, 1267, 140, 536, 1325, 1100, 198, 1125,
+  647, 674, 193, 107, 426, 727, 126, 1160, 422, 585, 81, 542,
+  376, 1276, 313, 1474, 638, 510, 149, 1299, 651, 967, 1244, 167,
+  792, 495, 77, 171, 381, 168, 1172, 1286, 1189, 493, 825, 501,
+  239, 1433, 524, 556, 155, 544, 1332, 417, 73, 861, 500, 133,
+  1383, 184, 560, 803, 420, 977, 294, 1067, 881, 183, 863, 450,
+  750, 1283, 517, 60, 1365, 79, 839, 1151, 237, 272, 732, 1484,
+  1174, 12, 581, 1145, 301, 361, 321, 629, 1434, 1382, 1326, 396,
+  1199, 507, 1126, 384, 1370, 1468, 1411, 541, 987, 1278, 58, 648,
+  357, 199, 322, 325, 668, 1218, 483, 789, 310, 896, 45, 892,
+  288, 525, 1106, 1006, 720, 894, 891, 1377, 78, 1046, 1412, 571,
+  895, 856, 448, 460, 1228, 488, 927, 1137, 1181, 348, 496, 1113,
+  127, 169, 13, 930, 62, 350, 984, 646, 757, 1396, 1235, 292,
+  1345, 766, 1391, 699, 758, 1388, 1429, 756, 141, 454, 1233, 1338,
+  1016, 35, 228, 594, 489, 1010, 618, 740, 214, 591, 623, 1317,
+  514, 587, 41, 656, 537, 91, 281, 603, 1442, 1208, 359, 252,
+  776, 1152, 1077, 1111, 763, 1049, 37, 336, 1071, 153, 631, 1097,
+  982, 1009, 233, 925, 1340, 684, 935, 632, 334, 120, 145, 201,
+  923, 439, 1446, 246, 887, 1272, 579, 662, 280, 335, 821, 998,
+  160, 1185, 1413, 1206, 1095, 411, 539, 51, 661, 770, 1409, 939,
+  658, 768, 889, 698, 621, 1471, 802, 924, 192, 538, 645, 1260,
+  722, 491, 900, 847, 771, 989, 156, 912, 512, 1456, 549, 300,
+  242, 296, 878, 1211, 782, 470, 1197, 696, 794, 1161, 408, 640,
+  154, 773, 1253, 105, 562, 582, 1005, 250, 518, 1324, 599, 915,
+  751, 29, 991, 918, 458, 884, 197, 1078, 173, 461, 1238, 1335,
+  576, 1089, 561, 108, 1121, 186, 1277, 1347, 499, 1295, 1246, 1328,
+  1261, 717, 673, 945, 403, 880, 234, 1258, 1019, 287, 1350, 1331,
+  387, 778, 535, 1047, 1130, 1480, 1367, 440, 908, 1117, 1081, 759,
+  211, 543, 1425, 43, 400, 1070, 1250, 693, 607, 1114, 1232, 441,
+  522, 1226, 1178, 689, 808, 480, 799, 1430, 634, 158, 1440, 1007,
+  903, 36, 862, 1061, 407, 1254, 1418, 1319, 1485, 572, 1128, 33,
+  580, 302, 968, 276, 904, 96, 392, 1421, 533, 1445, 978, 1103,
+  1243, 137, 1051, 769, 16, 187, 369, 449, 1483, 218, 733, 529,
+  1037, 1063, 694, 910, 205, 1142, 670, 230, 547, 1315, 748, 1195,
+  744, 711, 1351, 209, 259, 65, 775, 263, 224, 267, 551, 1083,
+  42, 378, 1312, 969, 222, 616, 774, 1132, 497, 569, 129, 6,
+  213, 1291, 1176, 764, 600, 1155, 1249, 23, 318, 1088, 1024, 1044,
+  257, 353, 478, 372, 706, 1448, 1245, 520, 1031, 339, 142, 487,
+  68, 123, 846, 1163, 1270, 659, 951, 217, 1165, 106, 1336, 760,
+  418, 872, 64, 1002, 1255, 765, 124, 398, 1366, 1057, 531, 1285,
+  38, 194, 189, 295, 1473, 577, 367, 208, 166, 473, 1017, 352,
+  172, 0, 1387, 548, 762, 870, 462, 671, 879, 136, 865, 636,
+  307, 116, 1321, 374, 1263, 822, 1119, 655, 254, 1148, 1035, 1472,
+  266, 626, 277, 980, 1279, 995, 811, 84, 819, 784, 5, 113,
+  1162, 723, 845, 125, 1060, 899, 931, 1135, 555, 807, 1096, 605,
+  498, 1210, 1344, 990, 69, 345, 1329, 999, 484, 690, 1072, 56,
+  163, 434, 364, 1410, 1337, 182, 745, 286, 152, 1284, 850, 1417,
+  26, 1280, 795, 289, 1342, 608, 1363, 1403, 1423, 685, 948, 604,
+  1436, 620, 1439, 227, 258, 63, 736, 1032, 812, 236, 973, 86,
+  243, 147, 215, 207, 557, 21, 920, 628, 1414, 1251, 1256, 625,
+  98, 1080, 76, 490, 395, 1219, 90, 1085, 1093, 867, 10, 898,
+  262, 714, 1108, 787, 4, 1171, 114, 456, 1360, 24, 425, 942,
+  1427, 855, 55, 1076, 716, 1127, 1223, 804, 74, 1402, 40, 914,
+  857, 747, 1068, 475, 780, 601, 1361, 1346, 1001, 365, 1464, 956,
+  134, 1230, 983, 902, 421, 805, 360, 19, 200, 1478, 1265, 102,
+  1479, 270, 1458, 868, 370, 1156, 840, 1013, 459, 50, 221, 128,
+  1405, 1065, 1134, 1098, 721, 660, 552, 275, 159, 476, 298, 112,
+  553, 1459, 11, 704, 513, 993, 1196, 639, 1053, 619, 1205, 824,
+  953, 1237, 1074, 170, 637, 212, 702, 749, 1158, 654, 1306, 1354,
+  157, 1029, 1389, 583, 368, 719, 772, 649, 836, 1036, 191, 703,
+  1305, 665, 1091, 595, 1368, 245, 181, 93, 61, 573, 1308, 1105,
+  1393, 1200, 1428, 876, 1213, 833, 138, 1356, 99, 901, 1092, 375,
+  1041, 1040, 329, 606, 523, 590, 1395, 306, 1323, 1216, 409, 540,
+  1118, 444, 598, 238, 299, 464, 588, 271, 1143, 1453, 1084, 274,
+  742, 28, 509, 546, 52, 1054, 1390, 466, 1353, 1055, 653, 25,
+  849, 446, 1386, 1457, 602, 1419, 730, 1229, 399, 229, 1310, 1482,
+  790, 957, 366, 1302, 1011, 678, 9, 39, 95, 1369, 1227, 80,
+  916, 985, 937, 1079, 909, 657, 701, 988, 253, 917, 465, 962,
+  165, 1198, 278, 1048, 1301, 934, 848, 135, 231, 1175, 820, 1469,
+  414, 380, 206, 779, 1102, 1115, 1330, 1289, 1140, 724, 650, 282,
+  1015, 913, 31, 519, 1341, 781, 1188, 391, 1380, 800, 709, 416,
+  964, 1348, 511, 1316, 1357, 185, 738, 196, 818, 178, 1404, 697,
+  1460, 1293, 492, 609, 641, 1476, 692, 1343, 1022, 1269, 1241, 1435,
+  1488, 1149, 858, 1274, 992, 1401, 1441, 431, 1268, 508, 575, 1437,
+  1086, 960, 75, 853, 981, 1146, 688, 66, 1318, 1062, 472, 675,
+  875, 838, 710, 371, 1000, 950, 729, 997, 1252, 1220, 1138, 972,
+  705
+};
+
+// Slots of blacklisted pseudo-TLDs.
+static const uint8_t HSK_TLD_HASH_BLACKLIST[187] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 128, 0, 0,
+  0, 0, 0, 64, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 128, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 16, 0, 0, 0, 0, 0
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "config.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include "tld.h"
+#include "tld-hash.h"
+#include "tld-lookup.h"
+
+// Must match scripts/tld-hash.py.
+static uint64_t
+hsk_tld_hash(const char *name) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  const char *s;
+
+  for (s = name; *s; s++) {
+    uint8_t ch = (uint8_t)*s;
+
+    if (ch >= 'A' && ch <= 'Z')
+      ch |= 0x20;
+
+    hash ^= ch;
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+static uint32_t
+hsk_tld_mix(uint32_t f, uint32_t d) {
+  uint32_t x = f ^ (d * 0x9e3779b9);
+  x ^= x >> 16;
+  x *= 0x85ebca6b;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35;
+  x ^= x >> 16;
+  return x;
+}
+
+int
+hsk_tld_slot(const char *name) {
+  uint64_t hash = hsk_tld_hash(name);
+  uint32_t bucket = (uint32_t)(hash >> 32) % HSK_TLD_HASH_BUCKETS;
+  uint32_t disp = HSK_TLD_HASH_DISP[bucket];
+  uint32_t slot = hsk_tld_mix((uint32_t)hash, disp) % HSK_TLD_HASH_SIZE;
+  int index = HSK_TLD_HASH_SLOTS[slot];
+  const char *key;
+
+  if (index < HSK_TLD_SIZE)
+    key = HSK_TLD_NAMES[index];
+  else
+    key = HSK_TLD_EXTRA[index - HSK_TLD_SIZE];
+
+  if (strcasecmp(key, name) != 0)
+    return -1;
+
+  return slot;
+}
+
+int
+hsk_tld_index(const char *name) {
+  int slot = hsk_tld_slot(name);
+
+  if (slot == -1)
+    return -1;
+
+  int index = HSK_TLD_HASH_SLOTS[slot];
+
+  if (index >= HSK_TLD_SIZE)
+    return -1;
+
+  return index;
+}
+
+bool
+hsk_tld_blacklisted(const char *name) {
+  int slot = hsk_tld_slot(name);
+
+  if (slot == -1)
+    return false;
+
+  return (HSK_TLD_HASH_BLACKLIST[slot >> 3] >> (slot & 7)) & 1;
+}
+
+int
+hsk_tld_count(void) {
+  return HSK_TLD_SIZE;
+}
+
+const char *
+hsk_tld_name(int index) {
+  return HSK_TLD_NAMES[index];
+}
+
+const uint8_t *
+hsk_tld_data(int index) {
+  return (const uint8_t *)HSK_TLD_DATA[index];
+}
@@ -0,0 +1,32 @@
+#ifndef _HSK_TLD_LOOKUP_H
+#define _HSK_TLD_LOOKUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Slot of an ICANN or blacklisted TLD in the
+// perfect hash (scripts/tld-hash.py), or -1.
+// Names are matched case-insensitively.
+int
+hsk_tld_slot(const char *name);
+
+// Index into HSK_TLD_NAMES and HSK_TLD_DATA, or -1.
+int
+hsk_tld_index(const char *name);
+
+bool
+hsk_tld_blacklisted(const char *name);
+
+// The generated tables in tld.h are static, so
+// they are only included here and reached through
+// these accessors.
+int
+hsk_tld_count(void);
+
+const char *
+hsk_tld_name(int index);
+
+// Length-prefixed (little-endian u16) resource.
+const uint8_t *
+hsk_tld_data(int index);
+#endif
@@ -0,0 +1,183 @@
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "u256.h"
+
+void
+hsk_u256_from_array(hsk_u256_t *n, const uint8_t *array) {
+  assert(n && array);
+
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    const uint8_t *p = &array[(3 - i) * 8];
+    uint64_t limb = 0;
+
+    for (j = 0; j < 8; j++)
+      limb = (limb << 8) | p[j];
+
+    n->limbs[i] = limb;
+  }
+}
+
+void
+hsk_u256_to_array(const hsk_u256_t *n, uint8_t *array) {
+  assert(n && array);
+
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    uint8_t *p = &array[(3 - i) * 8];
+    uint64_t limb = n->limbs[i];
+
+    for (j = 7; j >= 0; j--) {
+      p[j] = (uint8_t)limb;
+      limb >>= 8;
+    }
+  }
+}
+
+int
+hsk_u256_cmp(const hsk_u256_t *a, const hsk_u256_t *b) {
+  assert(a && b);
+
+  int i;
+
+  for (i = 3; i >= 0; i--) {
+    if (a->limbs[i] > b->limbs[i])
+      return 1;
+
+    if (a->limbs[i] < b->limbs[i])
+      return -1;
+  }
+
+  return 0;
+}
+
+bool
+hsk_u256_is_zero(const hsk_u256_t *n) {
+  assert(n);
+  return (n->limbs[0] | n->limbs[1] | n->limbs[2] | n->limbs[3]) == 0;
+}
+
+static uint64_t
+hsk_u256_sub_borrow(const hsk_u256_t *a, const hsk_u256_t *b, hsk_u256_t *c) {
+  uint64_t borrow = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    uint64_t x = a->limbs[i];
+    uint64_t y = b->limbs[i];
+    uint64_t z = x - y - borrow;
+
+    borrow = (x < y) | ((x == y) & borrow);
+    c->limbs[i] = z;
+  }
+
+  return borrow;
+}
+
+void
+hsk_u256_sub(const hsk_u256_t *a, const hsk_u256_t *b, hsk_u256_t *c) {
+  assert(a && b && c);
+  hsk_u256_sub_borrow(a, b, c);
+}
+
+bool
+hsk_u256_muldiv(
+  const hsk_u256_t *a,
+  uint32_t mul,
+  uint32_t div,
+  hsk_u256_t *c
+) {
+  assert(a && c);
+
+  if (div == 0)
+    return false;
+
+  // Work in 32 bit digits so that every partial
+  // product and remainder fits in 64 bits, even
+  // on platforms without a 128 bit type.
+  uint32_t prod[9];
+  uint64_t carry = 0;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    uint64_t digit = (a->limbs[i >> 1] >> ((i & 1) * 32)) & 0xffffffff;
+    uint64_t t = digit * mul + carry;
+    prod[i] = (uint32_t)t;
+    carry = t >> 32;
+  }
+
+  prod[8] = (uint32_t)carry;
+
+  uint64_t rem = 0;
+
+  for (i = 8; i >= 0; i--) {
+    uint64_t t = (rem << 32) | prod[i];
+    prod[i] = (uint32_t)(t / div);
+    rem = t % div;
+  }
+
+  // Quotient must fit in 256 bits.
+  if (prod[8] != 0)
+    return false;
+
+  for (i = 0; i < 4; i++)
+    c->limbs[i] = ((uint64_t)prod[i * 2 + 1] << 32) | prod[i * 2];
+
+  return true;
+}
+
+bool
+hsk_u256_inverse(const hsk_u256_t *a, hsk_u256_t *c) {
+  assert(a && c);
+
+  if (hsk_u256_is_zero(a))
+    return false;
+
+  hsk_u256_t one = {{1, 0, 0, 0}};
+
+  // 2^256 / 1 - 1 = 2^256 - 1
+  if (hsk_u256_cmp(a, &one) == 0) {
+    memset(c->limbs, 0xff, sizeof(c->limbs));
+    return true;
+  }
+
+  // Restoring binary division of 2^256 - 1 by a.
+  // 2^256 = q * a + r + 1, so q is bumped when
+  // the remainder is a - 1 (a divides 2^256).
+  hsk_u256_t q = {{0, 0, 0, 0}};
+  hsk_u256_t r = {{0, 0, 0, 0}};
+  int i, j;
+
+  for (i = 255; i >= 0; i--) {
+    uint64_t top = r.limbs[3] >> 63;
+
+    for (j = 3; j > 0; j--)
+      r.limbs[j] = (r.limbs[j] << 1) | (r.limbs[j - 1] >> 63);
+
+    r.limbs[0] = (r.limbs[0] << 1) | 1;
+
+    if (top || hsk_u256_cmp(&r, a) >= 0) {
+      hsk_u256_sub_borrow(&r, a, &r);
+      q.limbs[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+  }
+
+  hsk_u256_t am1;
+  hsk_u256_sub_borrow(a, &one, &am1);
+
+  // Bump for exact division, then subtract one:
+  // the two cancel out.
+  if (hsk_u256_cmp(&r, &am1) != 0)
+    hsk_u256_sub_borrow(&q, &one, &q);
+
+  *c = q;
+
+  return true;
+}
@@ -0,0 +1,48 @@
+#ifndef _HSK_U256_H
+#define _HSK_U256_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Fixed-width 256 bit unsigned integers
+ * with 64 bit limbs (least significant first).
+ * Only the operations needed for difficulty
+ * retargeting are implemented, see bn.h for
+ * the generic arbitrary precision code.
+ */
+
+typedef struct hsk_u256_s {
+  uint64_t limbs[4];
+} hsk_u256_t;
+
+void
+hsk_u256_from_array(hsk_u256_t *n, const uint8_t *array);
+
+void
+hsk_u256_to_array(const hsk_u256_t *n, uint8_t *array);
+
+int
+hsk_u256_cmp(const hsk_u256_t *a, const hsk_u256_t *b);
+
+bool
+hsk_u256_is_zero(const hsk_u256_t *n);
+
+// c = a - b (mod 2^256)
+void
+hsk_u256_sub(const hsk_u256_t *a, const hsk_u256_t *b, hsk_u256_t *c);
+
+// c = (a * mul) / div, with a 288 bit intermediate
+bool
+hsk_u256_muldiv(
+  const hsk_u256_t *a,
+  uint32_t mul,
+  uint32_t div,
+  hsk_u256_t *c
+);
+
+// c = (2^256 / a) - 1
+bool
+hsk_u256_inverse(const hsk_u256_t *a, hsk_u256_t *c);
+
+#endif
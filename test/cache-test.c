@@ -0,0 +1,397 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bio.h"
+#include "cache.h"
+#include "constants.h"
+#include "dns.h"
+#include "map.h"
+#include "utils.h"
+#include "uv.h"
+
+static const struct {
+  const char *name;
+  uint16_t type;
+  size_t wire_len;
+} test_cache_entries[] = {
+  {"example.", HSK_DNS_NS, 40},
+  {"example.", HSK_DNS_A, 1},
+  {"www.example.", HSK_DNS_A, 300},
+  {"_443._tcp.example.", HSK_DNS_TLSA, 512},
+  {"foo.", HSK_DNS_TXT, 0xffff}
+};
+
+#define TEST_CACHE_ENTRIES \
+  (sizeof(test_cache_entries) / sizeof(test_cache_entries[0]))
+
+static hsk_cache_item_t *
+test_cache_find(hsk_cache_t *c, const hsk_cache_key_t *ck) {
+  for (int i = 0; i < HSK_CACHE_SHARDS; i++) {
+    hsk_cache_item_t *item = hsk_map_get(&c->shards[i].map, ck);
+
+    if (item)
+      return item;
+  }
+
+  return NULL;
+}
+
+static uint32_t
+test_cache_count(hsk_cache_t *c) {
+  uint32_t count = 0;
+
+  for (int i = 0; i < HSK_CACHE_SHARDS; i++)
+    count += c->shards[i].map.size;
+
+  return count;
+}
+
+static void
+test_cache_fill(hsk_cache_t *c) {
+  uint8_t root[32];
+
+  memset(root, 0x11, 32);
+  hsk_cache_set_root(c, root, NULL, 0);
+
+  for (size_t i = 0; i < TEST_CACHE_ENTRIES; i++) {
+    size_t wire_len = test_cache_entries[i].wire_len;
+    uint8_t *wire = malloc(wire_len);
+
+    assert(wire);
+
+    for (size_t j = 0; j < wire_len; j++)
+      wire[j] = (uint8_t)(i * 41 + j);
+
+    assert(hsk_cache_insert_data(c, test_cache_entries[i].name,
+                                 test_cache_entries[i].type,
+                                 wire, wire_len));
+  }
+
+  assert(test_cache_count(c) == TEST_CACHE_ENTRIES);
+}
+
+static void
+test_cache_write(hsk_cache_t *c, const char *path) {
+  uv_loop_t loop;
+
+  assert(uv_loop_init(&loop) == 0);
+  assert(hsk_cache_write_file(c, &loop, path));
+  assert(c->writing);
+  assert(uv_run(&loop, UV_RUN_DEFAULT) == 0);
+  assert(!c->writing);
+  assert(uv_loop_close(&loop) == 0);
+}
+
+static void
+test_cache_dump(const char *path, const uint8_t *data, size_t data_len) {
+  FILE *file = fopen(path, "wb");
+  assert(file);
+  assert(fwrite(data, 1, data_len, file) == data_len);
+  assert(fclose(file) == 0);
+}
+
+static uint8_t *
+test_cache_load(const char *path, size_t *data_len) {
+  FILE *file = fopen(path, "rb");
+  assert(file);
+  assert(fseek(file, 0, SEEK_END) == 0);
+
+  long size = ftell(file);
+  assert(size > 0);
+  assert(fseek(file, 0, SEEK_SET) == 0);
+
+  uint8_t *data = malloc(size);
+  assert(data);
+  assert(fread(data, 1, size, file) == (size_t)size);
+  assert(fclose(file) == 0);
+
+  *data_len = (size_t)size;
+
+  return data;
+}
+
+static void
+test_cache_roundtrip() {
+  char prefix[] = "/tmp/hnsd-test-XXXXXX";
+  char path[HSK_STORE_PATH_MAX];
+
+  assert(mkdtemp(prefix));
+  snprintf(path, sizeof(path), "%s/cache.dat", prefix);
+
+  hsk_cache_t *a = hsk_cache_alloc();
+  hsk_cache_t *b = hsk_cache_alloc();
+
+  assert(a && b);
+
+  test_cache_fill(a);
+
+  // Vary the expiry, down to stale answers. Answers
+  // too old to serve stale are not written out.
+  int64_t now = hsk_now();
+  int64_t shift = 0;
+
+  for (int i = 0; i < HSK_CACHE_SHARDS; i++) {
+    hsk_map_t *map = &a->shards[i].map;
+    hsk_map_iter_t it;
+
+    for (it = hsk_map_begin(map); it != hsk_map_end(map); it++) {
+      if (!hsk_map_exists(map, it))
+        continue;
+
+      hsk_cache_item_t *item = (hsk_cache_item_t *)hsk_map_value(map, it);
+      item->expires = now + HSK_CACHE_TTL - shift;
+      shift += 4 * 60 * 60;
+    }
+  }
+
+  assert(now + HSK_CACHE_TTL - shift < now);
+
+  uint8_t *wire = malloc(8);
+  assert(wire);
+  memset(wire, 0x44, 8);
+  assert(hsk_cache_insert_data(a, "old.", HSK_DNS_A, wire, 8));
+
+  hsk_cache_key_t old;
+  hsk_cache_key_init(&old);
+  assert(hsk_cache_key_set(&old, "old.", HSK_DNS_A));
+
+  hsk_cache_item_t *item = test_cache_find(a, &old);
+  assert(item);
+  item->expires = now - a->max_stale - 1;
+
+  test_cache_write(a, path);
+
+  assert(hsk_cache_read_file(b, path));
+  assert(memcmp(b->root, a->root, 32) == 0);
+  assert(test_cache_count(b) == TEST_CACHE_ENTRIES);
+
+  for (int i = 0; i < HSK_CACHE_SHARDS; i++) {
+    hsk_map_t *map = &a->shards[i].map;
+    hsk_map_iter_t it;
+
+    for (it = hsk_map_begin(map); it != hsk_map_end(map); it++) {
+      if (!hsk_map_exists(map, it))
+        continue;
+
+      hsk_cache_item_t *x = (hsk_cache_item_t *)hsk_map_value(map, it);
+      hsk_cache_item_t *y = test_cache_find(b, &x->key);
+
+      if (x == item) {
+        assert(!y);
+        continue;
+      }
+
+      assert(y);
+      assert(y->key.name_len == x->key.name_len);
+      assert(memcmp(y->key.name, x->key.name, x->key.name_len + 1) == 0);
+      assert(y->key.type == x->key.type);
+      assert(y->key.ref == x->key.ref);
+      assert(y->time == x->time);
+      assert(y->expires == x->expires);
+      assert(y->msg_len == x->msg_len);
+      assert(memcmp(y->msg, x->msg, x->msg_len) == 0);
+    }
+  }
+
+  // Lookups go through the same keys, stale
+  // answers are only kept for serve-stale.
+  for (size_t i = 0; i < TEST_CACHE_ENTRIES; i++) {
+    hsk_cache_key_t ck;
+    uint8_t *wire;
+    size_t wire_len;
+
+    hsk_cache_key_init(&ck);
+    assert(hsk_cache_key_set(&ck, test_cache_entries[i].name,
+                             test_cache_entries[i].type));
+
+    hsk_cache_item_t *y = test_cache_find(b, &ck);
+    assert(y);
+
+    bool found = hsk_cache_get_data(b, test_cache_entries[i].name,
+                                    test_cache_entries[i].type,
+                                    &wire, &wire_len);
+
+    if (y->expires <= now) {
+      assert(!found);
+      continue;
+    }
+
+    assert(found);
+    assert(wire_len == test_cache_entries[i].wire_len);
+    assert(wire[wire_len - 1] == (uint8_t)(i * 41 + wire_len - 1));
+
+    free(wire);
+  }
+
+  hsk_cache_free(a);
+  hsk_cache_free(b);
+
+  assert(unlink(path) == 0);
+  assert(rmdir(prefix) == 0);
+}
+
+static void
+test_cache_corrupt() {
+  char prefix[] = "/tmp/hnsd-test-XXXXXX";
+  char path[HSK_STORE_PATH_MAX];
+  char bad[HSK_STORE_PATH_MAX];
+  size_t len;
+
+  assert(mkdtemp(prefix));
+  snprintf(path, sizeof(path), "%s/cache.dat", prefix);
+  snprintf(bad, sizeof(bad), "%s/bad.dat", prefix);
+
+  hsk_cache_t *a = hsk_cache_alloc();
+  assert(a);
+  test_cache_fill(a);
+  test_cache_write(a, path);
+  hsk_cache_free(a);
+
+  uint8_t *data = test_cache_load(path, &len);
+  uint8_t *copy = malloc(len);
+  size_t head = 4 + 1 + 32 + 4;
+
+  assert(copy);
+
+  // Bad magic.
+  memcpy(copy, data, len);
+  copy[0] ^= 0xff;
+  test_cache_dump(bad, copy, len);
+
+  hsk_cache_t *c = hsk_cache_alloc();
+  assert(c);
+  assert(!hsk_cache_read_file(c, bad));
+  assert(test_cache_count(c) == 0);
+  hsk_cache_free(c);
+
+  // Bad version.
+  memcpy(copy, data, len);
+  copy[4] = HSK_CACHE_FILE_VERSION + 1;
+  test_cache_dump(bad, copy, len);
+
+  c = hsk_cache_alloc();
+  assert(c);
+  assert(!hsk_cache_read_file(c, bad));
+  assert(test_cache_count(c) == 0);
+  hsk_cache_free(c);
+
+  // Truncated file header.
+  test_cache_dump(bad, data, head - 1);
+
+  c = hsk_cache_alloc();
+  assert(c);
+  assert(!hsk_cache_read_file(c, bad));
+  assert(test_cache_count(c) == 0);
+  hsk_cache_free(c);
+
+  // Truncated entries keep everything before the cut.
+  size_t pos = head;
+
+  for (uint32_t k = 0; k < TEST_CACHE_ENTRIES; k++) {
+    size_t name_len = data[pos];
+    size_t at = pos + 1 + name_len + 2 + 1 + 8 + 8;
+    size_t msg_len = ((size_t)data[at] << 8) | data[at + 1];
+    size_t end = at + 2 + msg_len;
+    size_t cuts[3] = {pos + 1, at + 1, end - 1};
+
+    for (int j = 0; j < 3; j++) {
+      test_cache_dump(bad, data, cuts[j]);
+
+      c = hsk_cache_alloc();
+      assert(c);
+      assert(hsk_cache_read_file(c, bad));
+      assert(test_cache_count(c) == k);
+      hsk_cache_free(c);
+    }
+
+    pos = end;
+  }
+
+  assert(pos == len);
+
+  // Entry count beyond the entries present.
+  memcpy(copy, data, len);
+  uint8_t *p = &copy[head - 4];
+  write_u32be(&p, TEST_CACHE_ENTRIES + 1000);
+  test_cache_dump(bad, copy, len);
+
+  c = hsk_cache_alloc();
+  assert(c);
+  assert(hsk_cache_read_file(c, bad));
+  assert(test_cache_count(c) == TEST_CACHE_ENTRIES);
+  hsk_cache_free(c);
+
+  free(copy);
+  free(data);
+
+  // The length is a single byte, so HSK_DNS_MAX_NAME
+  // is the longest name a file can hold. It has to fit
+  // the key with its terminator, a short read does not.
+  size_t entry = 1 + HSK_DNS_MAX_NAME + 2 + 1 + 8 + 8 + 2 + 1;
+  uint8_t *raw = malloc(head + entry);
+
+  assert(raw);
+
+  p = raw;
+  write_u32be(&p, HSK_MAGIC);
+  write_u8(&p, HSK_CACHE_FILE_VERSION);
+  memset(p, 0x22, 32);
+  p += 32;
+  write_u32be(&p, 1);
+  write_u8(&p, HSK_DNS_MAX_NAME);
+  memset(p, 'a', HSK_DNS_MAX_NAME);
+  p += HSK_DNS_MAX_NAME;
+  write_u16be(&p, HSK_DNS_A);
+  write_u8(&p, 0);
+  write_i64be(&p, hsk_now());
+  write_i64be(&p, hsk_now() + HSK_CACHE_TTL);
+  write_u16be(&p, 1);
+  write_u8(&p, 0x33);
+
+  assert((size_t)(p - raw) == head + entry);
+
+  test_cache_dump(bad, raw, head + entry);
+
+  c = hsk_cache_alloc();
+  assert(c);
+  assert(hsk_cache_read_file(c, bad));
+  assert(test_cache_count(c) == 1);
+
+  hsk_cache_key_t ck;
+  hsk_cache_key_init(&ck);
+  memset(ck.name, 'a', HSK_DNS_MAX_NAME);
+  ck.name_len = HSK_DNS_MAX_NAME;
+  ck.type = HSK_DNS_A;
+
+  hsk_cache_item_t *item = test_cache_find(c, &ck);
+  assert(item);
+  assert(item->key.name[HSK_DNS_MAX_NAME] == 0x00);
+  assert(item->msg_len == 1 && item->msg[0] == 0x33);
+  hsk_cache_free(c);
+
+  test_cache_dump(bad, raw, head + 1 + HSK_DNS_MAX_NAME - 1);
+
+  c = hsk_cache_alloc();
+  assert(c);
+  assert(hsk_cache_read_file(c, bad));
+  assert(test_cache_count(c) == 0);
+  hsk_cache_free(c);
+
+  free(raw);
+
+  assert(unlink(bad) == 0);
+  assert(unlink(path) == 0);
+  assert(rmdir(prefix) == 0);
+}
+
+void
+test_cache() {
+  printf(" test_cache_roundtrip\n");
+  test_cache_roundtrip();
+
+  printf(" test_cache_corrupt\n");
+  test_cache_corrupt();
+}
@@ -0,0 +1,578 @@
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chain.h"
+#include "constants.h"
+#include "error.h"
+#include "header.h"
+#include "store.h"
+#include "timedata.h"
+
+static uint64_t
+test_chain_rand(uint64_t *state) {
+  // xorshift64
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+static void
+test_chain_work_add(uint8_t *work, const uint8_t *delta) {
+  int carry = 0;
+
+  for (int i = 31; i >= 0; i--) {
+    int sum = work[i] + delta[i] + carry;
+    work[i] = (uint8_t)sum;
+    carry = sum >> 8;
+  }
+}
+
+static void
+test_chain_retarget_cmp(
+  const uint8_t *first,
+  const uint8_t *last,
+  int64_t actual
+) {
+  uint32_t fast = hsk_chain_retarget_work(first, last, actual);
+  uint32_t ref = hsk_chain_retarget_work_bn(first, last, actual);
+  assert(fast == ref);
+}
+
+static void
+test_chain_retarget_edges() {
+  uint8_t first[32];
+  uint8_t last[32];
+
+  // Zero work difference.
+  memset(first, 0, 32);
+  memset(last, 0, 32);
+  test_chain_retarget_cmp(first, last, HSK_TARGET_TIMESPAN);
+  assert(hsk_chain_retarget_work(first, last, 0) == HSK_BITS);
+
+  // Differences of one and exact powers of two.
+  for (int bit = 0; bit < 255; bit++) {
+    memset(last, 0, 32);
+    last[31 - (bit >> 3)] = 1 << (bit & 7);
+    test_chain_retarget_cmp(first, last, HSK_MIN_ACTUAL);
+    test_chain_retarget_cmp(first, last, HSK_TARGET_TIMESPAN);
+    test_chain_retarget_cmp(first, last, HSK_MAX_ACTUAL);
+  }
+
+  // Timespans outside of the clamp.
+  memset(last, 0, 32);
+  last[20] = 0x42;
+  test_chain_retarget_cmp(first, last, -1);
+  test_chain_retarget_cmp(first, last, 0);
+  test_chain_retarget_cmp(first, last, HSK_MAX_ACTUAL * 10);
+}
+
+static void
+test_chain_retarget_random() {
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  uint8_t first[32];
+  uint8_t delta[32];
+  uint8_t last[32];
+
+  for (int i = 0; i < 2000; i++) {
+    for (int j = 0; j < 32; j++) {
+      first[j] = (uint8_t)test_chain_rand(&state);
+      delta[j] = (uint8_t)test_chain_rand(&state);
+    }
+
+    // Keep the chainwork below 2^255 and vary the
+    // magnitude of the difference.
+    first[0] &= 0x3f;
+
+    int zeros = (int)(test_chain_rand(&state) % 32);
+    memset(delta, 0, zeros);
+    delta[0] &= 0x3f;
+
+    memcpy(last, first, 32);
+    test_chain_work_add(last, delta);
+
+    int64_t actual = (int64_t)(test_chain_rand(&state) % (HSK_MAX_ACTUAL * 2));
+
+    test_chain_retarget_cmp(first, last, actual);
+  }
+}
+
+/*
+ * Header Log
+ */
+
+static void
+test_chain_rmdir(const char *prefix) {
+  char path[HSK_STORE_PATH_MAX];
+  DIR *dir = opendir(prefix);
+  struct dirent *ent;
+
+  assert(dir);
+
+  while ((ent = readdir(dir)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+
+    snprintf(path, sizeof(path), "%s/%s", prefix, ent->d_name);
+    assert(unlink(path) == 0);
+  }
+
+  closedir(dir);
+  assert(rmdir(prefix) == 0);
+}
+
+static long
+test_chain_size(const char *path) {
+  struct stat st;
+  assert(stat(path, &st) == 0);
+  return (long)st.st_size;
+}
+
+// Regtest difficulty on mainnet headers, so every
+// other nonce or so passes hsk_header_verify_pow().
+static hsk_header_t *
+test_chain_mine(const hsk_header_t *prev, uint8_t salt) {
+  hsk_header_t *hdr = hsk_header_alloc();
+
+  assert(hdr);
+
+  memcpy(hdr->prev_block, prev->hash, 32);
+  hdr->time = prev->time + HSK_TARGET_SPACING;
+  hdr->bits = 0x207fffff;
+  hdr->extra_nonce[0] = salt;
+  hdr->height = prev->height + 1;
+
+  for (;;) {
+    hdr->cache = false;
+
+    if (hsk_header_verify_pow(hdr) == HSK_SUCCESS)
+      break;
+
+    hdr->nonce += 1;
+  }
+
+  hsk_header_cache(hdr);
+
+  assert(hsk_header_calc_work(hdr, prev));
+
+  return hdr;
+}
+
+// Extends the chain to `height` like hsk_chain_save()
+// minus checkpoints and logging, keeping the hash and
+// work of every header in `hashes` and `works`.
+static void
+test_chain_grow(
+  hsk_chain_t *chain,
+  uint32_t height,
+  uint8_t salt,
+  uint8_t (*hashes)[32],
+  uint8_t (*works)[32]
+) {
+  while (chain->height < height) {
+    hsk_header_t *hdr = test_chain_mine(chain->tip, salt);
+
+    if (hashes)
+      memcpy(hashes[hdr->height], hdr->hash, 32);
+
+    if (works)
+      memcpy(works[hdr->height], hdr->work, 32);
+
+    assert(hsk_chain_restore(chain, hdr) == HSK_SUCCESS);
+
+    if (chain->log)
+      hsk_store_log_append(chain, hdr);
+  }
+}
+
+static void
+test_chain_open(hsk_chain_t *chain, hsk_timedata_t *td, char *prefix) {
+  assert(hsk_chain_init(chain, td) == HSK_SUCCESS);
+  chain->prefix = prefix;
+  assert(hsk_store_log_open(chain));
+  assert(chain->log);
+}
+
+static void
+test_chain_log_replay() {
+  char prefix[] = "/tmp/hnsd-test-XXXXXX";
+  uint8_t hashes[301][32];
+  uint8_t works[301][32];
+  hsk_timedata_t td;
+  hsk_chain_t chain;
+
+  assert(mkdtemp(prefix));
+  hsk_timedata_init(&td);
+
+  test_chain_open(&chain, &td, prefix);
+  test_chain_grow(&chain, 300, 0, hashes, works);
+
+  char path[HSK_STORE_PATH_MAX];
+  strcpy(path, chain.log->path);
+
+  hsk_chain_uninit(&chain);
+
+  assert(test_chain_size(path)
+         == HSK_STORE_LOG_HEADER_SIZE + 301 * HSK_HEADER_SIZE);
+
+  // Every header comes back from the log.
+  test_chain_open(&chain, &td, prefix);
+
+  assert(chain.height == 300);
+  assert(chain.init_height == 0);
+  assert(memcmp(chain.tip->hash, hashes[300], 32) == 0);
+  assert(memcmp(chain.tip->work, works[300], 32) == 0);
+
+  for (uint32_t h = 1; h <= 300; h++) {
+    hsk_header_t *hdr = hsk_chain_get_by_height(&chain, h);
+    assert(hdr);
+    assert(memcmp(hdr->hash, hashes[h], 32) == 0);
+    assert(memcmp(hdr->work, works[h], 32) == 0);
+  }
+
+  // New headers go after the replayed ones.
+  test_chain_grow(&chain, 310, 0, NULL, NULL);
+  hsk_chain_uninit(&chain);
+
+  test_chain_open(&chain, &td, prefix);
+  assert(chain.height == 310);
+  hsk_chain_uninit(&chain);
+
+  test_chain_rmdir(prefix);
+}
+
+static void
+test_chain_log_truncate() {
+  char prefix[] = "/tmp/hnsd-test-XXXXXX";
+  uint8_t hashes[301][32];
+  uint8_t forked[301][32];
+  hsk_timedata_t td;
+  hsk_chain_t chain;
+
+  assert(mkdtemp(prefix));
+  hsk_timedata_init(&td);
+
+  test_chain_open(&chain, &td, prefix);
+  test_chain_grow(&chain, 300, 0, hashes, NULL);
+
+  // What a reorg forking off at 200 does to the log.
+  hsk_store_log_truncate(&chain, 201);
+  assert(chain.log->count == 201);
+
+  char path[HSK_STORE_PATH_MAX];
+  strcpy(path, chain.log->path);
+
+  hsk_chain_uninit(&chain);
+
+  assert(test_chain_size(path)
+         == HSK_STORE_LOG_HEADER_SIZE + 201 * HSK_HEADER_SIZE);
+
+  test_chain_open(&chain, &td, prefix);
+
+  assert(chain.height == 200);
+  assert(memcmp(chain.tip->hash, hashes[200], 32) == 0);
+  assert(!hsk_chain_has(&chain, hashes[201]));
+
+  // The competing branch replaces the old one.
+  test_chain_grow(&chain, 250, 1, forked, NULL);
+  hsk_chain_uninit(&chain);
+
+  test_chain_open(&chain, &td, prefix);
+
+  assert(chain.height == 250);
+  assert(memcmp(chain.tip->hash, forked[250], 32) == 0);
+
+  for (uint32_t h = 201; h <= 250; h++) {
+    hsk_header_t *hdr = hsk_chain_get_by_height(&chain, h);
+    assert(hdr);
+    assert(memcmp(hdr->hash, forked[h], 32) == 0);
+    assert(memcmp(hdr->hash, hashes[h], 32) != 0);
+  }
+
+  hsk_chain_uninit(&chain);
+
+  test_chain_rmdir(prefix);
+}
+
+static void
+test_chain_log_torn() {
+  char prefix[] = "/tmp/hnsd-test-XXXXXX";
+  uint8_t hashes[301][32];
+  uint8_t junk[HSK_HEADER_SIZE / 2];
+  hsk_timedata_t td;
+  hsk_chain_t chain;
+
+  assert(mkdtemp(prefix));
+  hsk_timedata_init(&td);
+
+  test_chain_open(&chain, &td, prefix);
+  test_chain_grow(&chain, 300, 0, hashes, NULL);
+
+  char path[HSK_STORE_PATH_MAX];
+  strcpy(path, chain.log->path);
+
+  hsk_chain_uninit(&chain);
+
+  // A crash in the middle of writing a record.
+  memset(junk, 0xaa, sizeof(junk));
+
+  FILE *file = fopen(path, "ab");
+  assert(file);
+  assert(fwrite(junk, 1, sizeof(junk), file) == sizeof(junk));
+  assert(fclose(file) == 0);
+
+  test_chain_open(&chain, &td, prefix);
+
+  assert(chain.height == 300);
+  assert(memcmp(chain.tip->hash, hashes[300], 32) == 0);
+  assert(test_chain_size(path)
+         == HSK_STORE_LOG_HEADER_SIZE + 301 * HSK_HEADER_SIZE);
+
+  // Appends line up with whole records again.
+  test_chain_grow(&chain, 301, 0, NULL, NULL);
+  hsk_chain_uninit(&chain);
+
+  assert(test_chain_size(path)
+         == HSK_STORE_LOG_HEADER_SIZE + 302 * HSK_HEADER_SIZE);
+
+  test_chain_open(&chain, &td, prefix);
+  assert(chain.height == 301);
+  hsk_chain_uninit(&chain);
+
+  test_chain_rmdir(prefix);
+}
+
+static void
+test_chain_log_lazy() {
+  char prefix[] = "/tmp/hnsd-test-XXXXXX";
+  uint32_t base = HSK_STORE_LOG_INDEX_INTERVAL;
+  uint32_t height = HSK_STORE_LOG_WINDOW + base + base / 4;
+  uint8_t (*hashes)[32] = malloc((height + 1) * 32);
+  uint8_t (*works)[32] = malloc((height + 1) * 32);
+  hsk_timedata_t td;
+  hsk_chain_t chain;
+
+  assert(hashes && works);
+  assert(mkdtemp(prefix));
+  hsk_timedata_init(&td);
+
+  test_chain_open(&chain, &td, prefix);
+  test_chain_grow(&chain, height, 0, hashes, works);
+  hsk_chain_uninit(&chain);
+
+  // Replay starts at the last index entry that
+  // leaves a full window above it.
+  test_chain_open(&chain, &td, prefix);
+
+  assert(chain.height == height);
+  assert(chain.init_height == base);
+  assert(chain.log->evicted);
+  assert(memcmp(chain.tip->hash, hashes[height], 32) == 0);
+  assert(memcmp(chain.tip->work, works[height], 32) == 0);
+
+  // Nothing below the base was replayed into memory,
+  // but all of it can be read back from the log.
+  for (uint32_t h = 1; h < base; h++)
+    assert(!hsk_chain_get_by_height(&chain, h));
+
+  for (uint32_t h = 1; h <= height; h++) {
+    hsk_header_t hdr;
+    assert(hsk_chain_read_by_height(&chain, h, &hdr));
+    assert(memcmp(hdr.hash, hashes[h], 32) == 0);
+    assert(memcmp(hdr.work, works[h], 32) == 0);
+  }
+
+  hsk_chain_uninit(&chain);
+
+  test_chain_rmdir(prefix);
+
+  free(hashes);
+  free(works);
+}
+
+// Grows a chain past the in-memory window, keeping
+// the encoding and work of every header.
+static void
+test_chain_grow_raw(
+  hsk_chain_t *chain,
+  uint32_t height,
+  uint8_t *raw,
+  uint8_t (*works)[32]
+) {
+  while (chain->height < height) {
+    hsk_header_t *hdr = test_chain_mine(chain->tip, 0);
+
+    hsk_header_encode(hdr, &raw[hdr->height * HSK_HEADER_SIZE]);
+    memcpy(works[hdr->height], hdr->work, 32);
+
+    assert(hsk_chain_restore(chain, hdr) == HSK_SUCCESS);
+    hsk_store_log_append(chain, hdr);
+  }
+}
+
+static void
+test_chain_read_cmp(
+  const hsk_chain_t *chain,
+  uint32_t height,
+  const uint8_t *raw,
+  uint8_t (*works)[32]
+) {
+  uint8_t data[HSK_HEADER_SIZE];
+  hsk_header_t hdr;
+
+  assert(hsk_chain_read_by_height(chain, height, &hdr));
+  assert(hdr.height == height);
+  assert(hsk_header_encode(&hdr, data) == HSK_HEADER_SIZE);
+  assert(memcmp(data, &raw[height * HSK_HEADER_SIZE], HSK_HEADER_SIZE) == 0);
+  assert(memcmp(hdr.work, works[height], 32) == 0);
+}
+
+static void
+test_chain_log_evict() {
+  char prefix[] = "/tmp/hnsd-test-XXXXXX";
+  uint32_t height = HSK_STORE_LOG_WINDOW + HSK_STORE_LOG_INDEX_INTERVAL / 4;
+  uint8_t *raw = malloc((height + 1) * HSK_HEADER_SIZE);
+  uint8_t (*works)[32] = malloc((height + 1) * 32);
+  hsk_timedata_t td;
+  hsk_chain_t chain;
+
+  assert(raw && works);
+  assert(mkdtemp(prefix));
+  hsk_timedata_init(&td);
+
+  test_chain_open(&chain, &td, prefix);
+  test_chain_grow_raw(&chain, height, raw, works);
+
+  uint32_t pruned = chain.log->pruned;
+
+  assert(chain.log->evicted);
+  assert(pruned == height - HSK_STORE_LOG_WINDOW + 1);
+
+  // The tip and genesis always stay in memory.
+  assert(!hsk_chain_evict(&chain, 0));
+  assert(!hsk_chain_evict(&chain, height));
+
+  // Evict one inside the window by hand too.
+  assert(hsk_chain_evict(&chain, height - 10));
+  assert(!hsk_chain_get_by_height(&chain, height - 10));
+  assert(!hsk_chain_evict(&chain, height - 10));
+
+  // Chainwork is summed up from the index entries.
+  for (uint32_t h = 1; h < pruned; h++) {
+    assert(!hsk_chain_get_by_height(&chain, h));
+    test_chain_read_cmp(&chain, h, raw, works);
+  }
+
+  test_chain_read_cmp(&chain, height - 10, raw, works);
+  test_chain_read_cmp(&chain, height, raw, works);
+
+  hsk_header_t hdr;
+  assert(!hsk_chain_read_by_height(&chain, height + 1, &hdr));
+
+  hsk_chain_uninit(&chain);
+
+  test_chain_rmdir(prefix);
+
+  free(raw);
+  free(works);
+}
+
+static void
+test_chain_log_readonly() {
+  char prefix[] = "/tmp/hnsd-test-XXXXXX";
+  uint32_t height = HSK_STORE_LOG_WINDOW + HSK_STORE_LOG_INDEX_INTERVAL / 4;
+  uint8_t *raw = malloc((height + 11) * HSK_HEADER_SIZE);
+  uint8_t (*works)[32] = malloc((height + 11) * 32);
+  hsk_timedata_t td;
+  hsk_chain_t chain;
+
+  assert(raw && works);
+  assert(mkdtemp(prefix));
+  hsk_timedata_init(&td);
+
+  test_chain_open(&chain, &td, prefix);
+  test_chain_grow_raw(&chain, height, raw, works);
+
+  hsk_store_log_t *log = chain.log;
+  uint32_t pruned = log->pruned;
+  char path[HSK_STORE_PATH_MAX];
+
+  strcpy(path, log->path);
+
+  // Make the next write fail, e.g. a full disk.
+  assert(fclose(log->file) == 0);
+  log->file = fopen(path, "rb");
+  assert(log->file);
+  assert(fseek(log->file, 0, SEEK_END) == 0);
+
+  long size = test_chain_size(path);
+
+  test_chain_grow_raw(&chain, height + 1, raw, works);
+
+  // Evicted headers are still served...
+  assert(chain.log == log);
+  assert(log->readonly);
+  assert(log->count == pruned - log->start);
+
+  for (uint32_t h = 1; h < pruned; h++)
+    test_chain_read_cmp(&chain, h, raw, works);
+
+  // ...but nothing is appended or evicted anymore.
+  test_chain_grow_raw(&chain, height + 10, raw, works);
+
+  assert(log->count == pruned - log->start);
+  assert(log->pruned == pruned);
+  assert(test_chain_size(path) == size);
+
+  for (uint32_t h = pruned; h <= height + 10; h++) {
+    assert(hsk_chain_get_by_height(&chain, h));
+    test_chain_read_cmp(&chain, h, raw, works);
+  }
+
+  hsk_chain_uninit(&chain);
+
+  // The log on disk was left as it was.
+  test_chain_open(&chain, &td, prefix);
+  assert(chain.height == height);
+  test_chain_read_cmp(&chain, height, raw, works);
+  hsk_chain_uninit(&chain);
+
+  test_chain_rmdir(prefix);
+
+  free(raw);
+  free(works);
+}
+
+void
+test_chain() {
+  printf(" test_chain_retarget_edges\n");
+  test_chain_retarget_edges();
+
+  printf(" test_chain_retarget_random\n");
+  test_chain_retarget_random();
+
+  printf(" test_chain_log_replay\n");
+  test_chain_log_replay();
+
+  printf(" test_chain_log_truncate\n");
+  test_chain_log_truncate();
+
+  printf(" test_chain_log_torn\n");
+  test_chain_log_torn();
+
+  printf(" test_chain_log_lazy\n");
+  test_chain_log_lazy();
+
+  printf(" test_chain_log_evict\n");
+  test_chain_log_evict();
+
+  printf(" test_chain_log_readonly\n");
+  test_chain_log_readonly();
+}
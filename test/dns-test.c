@@ -1,7 +1,16 @@
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "addr.h"
+#include "base32.h"
+#include "bio.h"
 #include "dns.h"
+#include "dnssec.h"
+#include "ec.h"
+#include "req.h"
+#include "resource.h"
 
 static void
 test_hsk_dns_is_subdomain() {
@@ -25,8 +34,897 @@ test_hsk_dns_is_subdomain() {
     "ddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddd.ddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddd."));
 }
 
+// Straightforward compression for comparison:
+// every suffix written below offset 16384 is kept
+// and the first match wins.
+typedef struct {
+  const char *names[4096];
+  size_t offs[4096];
+  int count;
+} test_dns_ref_t;
+
+static void
+test_dns_ref_name(
+  test_dns_ref_t *ref,
+  uint8_t *msg,
+  size_t *pos,
+  const char *name
+) {
+  const char *added[128];
+  size_t offs[128];
+  int count = 0;
+  const char *s = name;
+  int i;
+
+  for (;;) {
+    if (*s == '\0') {
+      msg[(*pos)++] = 0;
+      break;
+    }
+
+    for (i = 0; i < ref->count; i++) {
+      if (strcmp(ref->names[i], s) == 0)
+        break;
+    }
+
+    if (i < ref->count) {
+      msg[(*pos)++] = 0xc0 | (ref->offs[i] >> 8);
+      msg[(*pos)++] = ref->offs[i] & 0xff;
+      break;
+    }
+
+    if (*pos < (1 << 14)) {
+      added[count] = s;
+      offs[count] = *pos;
+      count += 1;
+    }
+
+    const char *e = strchr(s, '.');
+    msg[(*pos)++] = e - s;
+    memcpy(&msg[*pos], s, e - s);
+    *pos += e - s;
+    s = e + 1;
+  }
+
+  for (i = 0; i < count; i++) {
+    ref->names[ref->count] = added[i];
+    ref->offs[ref->count] = offs[i];
+    ref->count += 1;
+  }
+}
+
+static void
+test_dns_cmp_ns(int count, const char *pad) {
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+  assert(msg);
+
+  hsk_dns_qs_t *qs = hsk_dns_qs_alloc();
+  assert(qs);
+  hsk_dns_qs_set(qs, "example.", HSK_DNS_NS);
+  hsk_dns_rrs_push(&msg->qd, qs);
+
+  int i;
+  for (i = 0; i < count; i++) {
+    hsk_dns_rr_t *rr = hsk_dns_rr_create(HSK_DNS_NS);
+    assert(rr);
+
+    hsk_dns_rr_set_name(rr, "example.");
+    rr->ttl = 3600;
+
+    hsk_dns_ns_rd_t *rd = rr->rd;
+    // Every target shows up twice.
+    sprintf(rd->ns, "ns%d.%shost%d.example.", i / 2, pad, (i / 2) % 7);
+
+    assert(hsk_dns_rrs_push(&msg->an, rr));
+  }
+
+  uint8_t *data;
+  size_t len;
+  assert(hsk_dns_msg_encode(msg, &data, &len));
+
+  test_dns_ref_t *ref = malloc(sizeof(test_dns_ref_t));
+  uint8_t *exp = malloc(len + 1024);
+  size_t pos = 12;
+  assert(ref && exp);
+
+  uint8_t *p;
+
+  ref->count = 0;
+  test_dns_ref_name(ref, exp, &pos, qs->name);
+  p = &exp[pos];
+  write_u16be(&p, HSK_DNS_NS);
+  write_u16be(&p, HSK_DNS_IN);
+  pos += 4;
+
+  for (i = 0; i < count; i++) {
+    hsk_dns_rr_t *rr = msg->an.items[i];
+    hsk_dns_ns_rd_t *rd = rr->rd;
+
+    test_dns_ref_name(ref, exp, &pos, rr->name);
+    p = &exp[pos];
+    write_u16be(&p, HSK_DNS_NS);
+    write_u16be(&p, HSK_DNS_IN);
+    write_u32be(&p, 3600);
+    pos += 10;
+
+    size_t start = pos;
+    test_dns_ref_name(ref, exp, &pos, rd->ns);
+    p = &exp[start - 2];
+    write_u16be(&p, pos - start);
+  }
+
+  assert(len == pos);
+  assert(memcmp(&data[12], &exp[12], len - 12) == 0);
+
+  free(ref);
+  free(exp);
+  free(data);
+  hsk_dns_msg_free(msg);
+}
+
+// Enough records to outgrow the inline table and,
+// with long names, to run past the last offset a
+// pointer can reach.
+static void
+test_dns_cmp() {
+  const char *pad =
+    "paddingpaddingpaddingpaddingpaddingpaddingpadding.";
+  int counts[] = { 1, 10, 40, 80, HSK_DNS_RRS_MAX };
+  size_t i;
+
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    test_dns_cmp_ns(counts[i], "");
+    test_dns_cmp_ns(counts[i], pad);
+  }
+}
+
+// The encode-then-truncate path responses used
+// to take: cut after the last whole record that
+// ends within max bytes and patch the counts.
+static size_t
+test_dns_ref_truncate(uint8_t *msg, size_t msg_len, size_t max) {
+  if (msg_len <= max)
+    return msg_len;
+
+  hsk_dns_dmp_t dmp;
+  dmp.msg = msg;
+  dmp.msg_len = msg_len;
+
+  uint8_t *data = msg + 12;
+  size_t data_len = msg_len - 12;
+  uint8_t *end = msg + max;
+  uint8_t *last = data;
+  bool full = true;
+  uint16_t counts[4];
+  int s, i;
+
+  for (s = 0; s < 4; s++)
+    counts[s] = get_u16be(&msg[4 + s * 2]);
+
+  for (s = 0; s < 4; s++) {
+    for (i = 0; full && i < counts[s]; i++) {
+      assert(hsk_dns_name_read(&data, &data_len, &dmp, NULL));
+
+      size_t size = s == 0 ? 4 : 10 + get_u16be(&data[8]);
+      assert(data_len >= size);
+
+      data += size;
+      data_len -= size;
+
+      if (data > end) {
+        full = false;
+        break;
+      }
+
+      last = data;
+    }
+
+    counts[s] = i;
+  }
+
+  uint8_t *hdr = &msg[4];
+
+  for (s = 0; s < 4; s++)
+    write_u16be(&hdr, counts[s]);
+
+  return last - msg;
+}
+
+static void
+test_dns_pack_check(hsk_dns_msg_t *msg, bool edns) {
+  uint8_t *data;
+  size_t len;
+
+  msg->edns.enabled = false;
+  assert(hsk_dns_msg_encode(msg, &data, &len));
+  msg->edns.enabled = edns;
+
+  // Room for the OPT record is set aside.
+  size_t opt = edns ? 11 : 0;
+  uint8_t *exp = malloc(len);
+  uint8_t *out = malloc(len + opt);
+  assert(exp && out);
+
+  size_t max, out_len, exp_len;
+
+  for (max = 12 + opt; max <= len + opt; max++) {
+    memcpy(exp, data, len);
+    exp_len = test_dns_ref_truncate(exp, len, max - opt);
+
+    assert(hsk_dns_msg_pack(msg, out, max, &out_len));
+    assert(out_len == exp_len + opt);
+
+    if (edns) {
+      uint8_t *p = &exp[10];
+      write_u16be(&p, get_u16be(&exp[10]) + 1);
+
+      assert(out[exp_len] == 0);
+      assert(get_u16be(&out[exp_len + 1]) == HSK_DNS_OPT);
+      assert(get_u16be(&out[exp_len + 3]) == msg->edns.size);
+    }
+
+    assert(memcmp(out, exp, exp_len) == 0);
+  }
+
+  free(exp);
+  free(out);
+  free(data);
+}
+
+// Packing stops where truncating the full encoding
+// would, for every limit from an empty message up.
+static void
+test_dns_pack() {
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+  assert(msg);
+
+  msg->id = 0x4242;
+  msg->flags = HSK_DNS_QR | HSK_DNS_AA;
+  msg->edns.size = 4096;
+
+  hsk_dns_qs_t *qs = hsk_dns_qs_alloc();
+  assert(qs);
+  hsk_dns_qs_set(qs, "www.example.", HSK_DNS_TXT);
+  hsk_dns_rrs_push(&msg->qd, qs);
+
+  hsk_dns_rrs_t *sections[3] = { &msg->an, &msg->ns, &msg->ar };
+  int s, i;
+
+  for (s = 0; s < 3; s++) {
+    for (i = 0; i < 12; i++) {
+      hsk_dns_rr_t *rr;
+
+      if (s == 1) {
+        rr = hsk_dns_rr_create(HSK_DNS_NS);
+        assert(rr);
+        hsk_dns_ns_rd_t *rd = rr->rd;
+        sprintf(rd->ns, "ns%d.example.", i);
+        hsk_dns_rr_set_name(rr, "example.");
+      } else {
+        rr = hsk_dns_rr_create(HSK_DNS_A);
+        assert(rr);
+        hsk_dns_a_rd_t *rd = rr->rd;
+        memset(rd->addr, i, 4);
+        if (s == 0)
+          hsk_dns_rr_set_name(rr, "www.example.");
+        else
+          sprintf(rr->name, "ns%d.example.", i);
+      }
+
+      rr->ttl = 3600;
+      assert(hsk_dns_rrs_push(sections[s], rr));
+    }
+  }
+
+  test_dns_pack_check(msg, false);
+  test_dns_pack_check(msg, true);
+
+  hsk_dns_msg_free(msg);
+}
+
+// Query for Example.COM. with an optional OPT
+// record, returns the length and the offset just
+// past the question.
+static size_t
+test_dns_req_build(
+  uint8_t *data,
+  size_t *qend,
+  uint16_t arcount,
+  uint8_t owner,
+  uint16_t size,
+  uint32_t ttl
+) {
+  uint8_t *p = data;
+
+  write_u16be(&p, 0x1234);
+  write_u16be(&p, HSK_DNS_RD | HSK_DNS_CD);
+  write_u16be(&p, 1);
+  write_u16be(&p, 0);
+  write_u16be(&p, 0);
+  write_u16be(&p, arcount);
+
+  write_bytes(&p, (const uint8_t *)"\x07" "Example" "\x03" "COM", 12);
+  write_u8(&p, 0);
+  write_u16be(&p, HSK_DNS_TXT);
+  write_u16be(&p, HSK_DNS_IN);
+
+  *qend = p - data;
+
+  if (owner != 0xff) {
+    if (owner != 0) {
+      write_u8(&p, 1);
+      write_u8(&p, owner);
+    }
+    write_u8(&p, 0);
+    write_u16be(&p, HSK_DNS_OPT);
+    write_u16be(&p, size);
+    write_u32be(&p, ttl);
+    write_u16be(&p, 0);
+  }
+
+  return p - data;
+}
+
+static void
+test_dns_req_cmp(const hsk_dns_req_t *a, const hsk_dns_req_t *b) {
+  assert(a->id == b->id);
+  assert(strcmp(a->name, b->name) == 0);
+  assert(a->type == b->type);
+  assert(a->class == b->class);
+  assert(a->rd == b->rd);
+  assert(a->cd == b->cd);
+  assert(a->ad == b->ad);
+  assert(a->edns == b->edns);
+  assert(a->max_size == b->max_size);
+  assert(a->dnssec == b->dnssec);
+}
+
+// Runs both readers, the fast path must agree with
+// the decoder whenever it accepts a query.
+static bool
+test_dns_req_both(
+  const uint8_t *data,
+  size_t len,
+  bool fast,
+  hsk_dns_req_t *out
+) {
+  hsk_dns_req_t a, b;
+
+  hsk_dns_req_init(&a);
+  hsk_dns_req_init(&b);
+
+  assert(hsk_dns_req_read(&a, data, len) == fast);
+
+  bool full = hsk_dns_req_decode(&b, data, len);
+
+  if (fast) {
+    assert(full);
+    test_dns_req_cmp(&a, &b);
+  }
+
+  if (out)
+    *out = b;
+
+  return full;
+}
+
+static void
+test_dns_req_read() {
+  uint8_t data[128];
+  size_t qend;
+  size_t len;
+  size_t i;
+  hsk_dns_req_t req;
+
+  // No OPT.
+  len = test_dns_req_build(data, &qend, 0, 0xff, 0, 0);
+  assert(test_dns_req_both(data, len, true, &req));
+  assert(strcmp(req.name, "Example.COM.") == 0);
+  assert(req.type == HSK_DNS_TXT && req.rd && req.cd && !req.edns);
+  assert(req.max_size == HSK_DNS_MAX_UDP);
+
+  for (i = 0; i < len; i++)
+    assert(!test_dns_req_both(data, i, false, NULL));
+
+  // OPT with DO, oversized buffer.
+  len = test_dns_req_build(data, &qend, 1, 0, 65535, HSK_DNS_DO);
+  assert(test_dns_req_both(data, len, true, &req));
+  assert(req.edns && req.dnssec && req.max_size == HSK_DNS_MAX_EDNS);
+
+  // OPT with a buffer below the minimum.
+  len = test_dns_req_build(data, &qend, 1, 0, 100, 0);
+  assert(test_dns_req_both(data, len, true, &req));
+  assert(req.edns && !req.dnssec && req.max_size == HSK_DNS_MAX_UDP);
+
+  // Truncated header, question or OPT. With the
+  // question complete, the decoder takes arcount
+  // as an upper bound.
+  for (i = 0; i < len; i++) {
+    bool full = test_dns_req_both(data, i, false, &req);
+    assert(full == (i == qend));
+  }
+
+  assert(!req.edns);
+
+  // OPT owned by a name other than the root.
+  len = test_dns_req_build(data, &qend, 1, 'x', 1232, HSK_DNS_DO);
+  assert(test_dns_req_both(data, len, false, &req));
+  assert(req.edns && req.dnssec && req.max_size == 1232);
+
+  // Extended rcode.
+  len = test_dns_req_build(data, &qend, 1, 0, 1232, 1u << 24);
+  assert(!test_dns_req_both(data, len, false, NULL));
+
+  // Additional count without data.
+  len = test_dns_req_build(data, &qend, 1, 0xff, 0, 0);
+  assert(test_dns_req_both(data, len, false, &req));
+  assert(!req.edns && req.max_size == HSK_DNS_MAX_UDP);
+}
+
+// Parses a query the way the server does.
+static void
+test_dns_tmpl_req(
+  hsk_dns_req_t *req,
+  const char *name,
+  uint16_t type,
+  bool edns,
+  bool dnssec
+) {
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc();
+  assert(msg);
+
+  msg->id = 0x1234;
+  msg->flags = HSK_DNS_RD;
+
+  if (edns) {
+    msg->edns.enabled = true;
+    msg->edns.size = 4096;
+    msg->edns.flags = dnssec ? HSK_DNS_DO : 0;
+  }
+
+  hsk_dns_qs_t *qs = hsk_dns_qs_alloc();
+  assert(qs);
+  hsk_dns_qs_set(qs, name, type);
+  hsk_dns_rrs_push(&msg->qd, qs);
+
+  uint8_t *data;
+  size_t len;
+  assert(hsk_dns_msg_encode(msg, &data, &len));
+
+  hsk_dns_req_init(req);
+  assert(hsk_dns_req_decode(req, data, len));
+
+  free(data);
+  hsk_dns_msg_free(msg);
+}
+
+// Re-encodes a response with the RRSIG signatures
+// and validity blanked, those differ per signing.
+static void
+test_dns_tmpl_norm(const uint8_t *wire, size_t len, uint8_t **out, size_t *out_len) {
+  hsk_dns_msg_t *msg;
+  assert(hsk_dns_msg_decode(wire, len, &msg));
+
+  hsk_dns_rrs_t *sections[3] = { &msg->an, &msg->ns, &msg->ar };
+  int s, i;
+
+  for (s = 0; s < 3; s++) {
+    for (i = 0; i < sections[s]->size; i++) {
+      hsk_dns_rr_t *rr = sections[s]->items[i];
+
+      if (rr->type != HSK_DNS_RRSIG)
+        continue;
+
+      hsk_dns_rrsig_rd_t *rd = rr->rd;
+      memset(rd->signature, 0, rd->signature_len);
+      rd->inception = 0;
+      rd->expiration = 0;
+    }
+  }
+
+  assert(hsk_dns_msg_encode(msg, out, out_len));
+  hsk_dns_msg_free(msg);
+}
+
+typedef hsk_dns_msg_t *(*test_dns_tmpl_build_t)(uint16_t type, const char *name);
+
+static hsk_dns_msg_t *
+test_dns_tmpl_root(uint16_t type, const char *name) {
+  hsk_addr_t addr;
+  assert(hsk_addr_from_string(&addr, "127.0.0.1", 53));
+  return hsk_resource_root(type, &addr);
+}
+
+static hsk_dns_msg_t *
+test_dns_tmpl_nx(uint16_t type, const char *name) {
+  return hsk_resource_to_nx();
+}
+
+static hsk_dns_msg_t *
+test_dns_tmpl_apex(uint16_t type, const char *name) {
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
+  assert(msg);
+
+  hsk_resource_to_empty("_synth", NULL, 0, &msg->ns);
+  hsk_dnssec_sign_zsk(&msg->ns, HSK_DNS_NSEC);
+  hsk_resource_root_to_soa(&msg->ns);
+  hsk_dnssec_sign_zsk(&msg->ns, HSK_DNS_SOA);
+
+  return msg;
+}
+
+// Address answer, owned by the template name or
+// by the full pointer name for the old path.
+static hsk_dns_msg_t *
+test_dns_tmpl_synth(uint16_t family, const char *name) {
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
+  assert(msg);
+
+  msg->flags |= HSK_DNS_AA;
+
+  hsk_dns_rr_t *rr = hsk_dns_rr_create_in(msg->an.arena, family);
+  assert(rr);
+
+  rr->ttl = HSK_DEFAULT_TTL;
+  hsk_dns_rr_set_name(rr, name);
+
+  if (strcmp(name, "_synth.") != 0) {
+    char label[HSK_DNS_MAX_LABEL + 1];
+    uint8_t ip[16];
+    uint16_t f;
+
+    hsk_dns_label_from(name, -2, label);
+    assert(pointer_to_ip(label, ip, &f) && f == family);
+    memcpy(rr->rd, ip, family == HSK_DNS_A ? 4 : 16);
+  }
+
+  hsk_dns_rrs_push(&msg->an, rr);
+
+  return msg;
+}
+
+// Writes the template for each query flavour and
+// checks it against finalizing a freshly built
+// message. Templates may decline a query, but not
+// one they were compiled for.
+static void
+test_dns_tmpl_check(
+  hsk_ec_t *ec,
+  test_dns_tmpl_build_t build,
+  uint16_t build_type,
+  uint16_t tmpl_type,
+  const char *tmpl_name,
+  bool dnssec,
+  const char *name,
+  uint16_t type,
+  const uint8_t *var,
+  size_t var_len
+) {
+  hsk_dns_tmpl_t tmpl;
+  hsk_dns_tmpl_init(&tmpl);
+
+  hsk_dns_msg_t *msg = build(build_type, tmpl_name ? tmpl_name : name);
+  assert(msg);
+  assert(hsk_dns_tmpl_compile(&tmpl, &msg, tmpl_type, tmpl_name, dnssec));
+
+  int i;
+  for (i = 0; i < 3; i++) {
+    bool edns = i > 0;
+    bool d = i > 1;
+    hsk_dns_req_t req;
+    uint8_t *a, *b, *na, *nb;
+    size_t a_len, b_len, na_len, nb_len;
+
+    test_dns_tmpl_req(&req, name, type, edns, d);
+
+    if (!hsk_dns_tmpl_write(&tmpl, &req, ec, NULL, var, var_len, &a, &a_len)) {
+      assert(dnssec ? !d : d);
+      continue;
+    }
+
+    msg = build(build_type, name);
+    assert(msg);
+    assert(hsk_dns_msg_finalize(&msg, &req, ec, NULL, &b, &b_len));
+
+    test_dns_tmpl_norm(a, a_len, &na, &na_len);
+    test_dns_tmpl_norm(b, b_len, &nb, &nb_len);
+
+    assert(na_len == nb_len);
+    assert(memcmp(na, nb, na_len) == 0);
+
+    free(a);
+    free(b);
+    free(na);
+    free(nb);
+  }
+
+  hsk_dns_tmpl_uninit(&tmpl);
+}
+
+static void
+test_dns_tmpl() {
+  hsk_ec_t *ec = hsk_ec_alloc();
+  assert(ec);
+
+  // The root has a template per type it answers,
+  // the rest share one.
+  uint16_t types[] = {
+    HSK_DNS_ANY,
+    HSK_DNS_NS,
+    HSK_DNS_SOA,
+    HSK_DNS_DNSKEY,
+    HSK_DNS_DS,
+    HSK_DNS_A,
+    HSK_DNS_TXT,
+    HSK_DNS_NSEC,
+    HSK_DNS_RRSIG
+  };
+
+  size_t i;
+  for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    uint16_t type = types[i];
+    uint16_t tmpl_type = i < 5 ? type : HSK_DNS_UNKNOWN;
+    uint16_t root_type = i < 5 ? type : HSK_DNS_UNKNOWN;
+
+    test_dns_tmpl_check(ec, test_dns_tmpl_root, root_type, tmpl_type,
+                        NULL, true, ".", type, NULL, 0);
+
+    test_dns_tmpl_check(ec, test_dns_tmpl_nx, 0, HSK_DNS_UNKNOWN,
+                        NULL, true, "foo.bit.", type, NULL, 0);
+
+    test_dns_tmpl_check(ec, test_dns_tmpl_apex, 0, HSK_DNS_UNKNOWN,
+                        NULL, true, "_synth.", type, NULL, 0);
+  }
+
+  const uint8_t ip4[4] = { 1, 2, 3, 4 };
+  const uint8_t ip6[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+  char b32[64];
+  char name[HSK_DNS_MAX_NAME + 1];
+
+  hsk_base32_encode_hex(ip4, 4, b32, false);
+  sprintf(name, "_%s._synth.", b32);
+
+  test_dns_tmpl_check(ec, test_dns_tmpl_synth, HSK_DNS_A, HSK_DNS_A,
+                      "_synth.", false, name, HSK_DNS_A, ip4, 4);
+
+  hsk_base32_encode_hex(ip6, 16, b32, false);
+  sprintf(name, "_%s._synth.", b32);
+
+  test_dns_tmpl_check(ec, test_dns_tmpl_synth, HSK_DNS_AAAA, HSK_DNS_AAAA,
+                      "_synth.", false, name, HSK_DNS_AAAA, ip6, 16);
+
+  hsk_ec_free(ec);
+}
+
+// A referral with glue behind a long question, with
+// a 512 byte limit. The template must drop trailing
+// glue at record boundaries, keep the answer and
+// authority, keep OPT and patch the counts.
+static void
+test_dns_tmpl_trunc() {
+  hsk_dns_msg_t *msg = hsk_dns_msg_alloc_arena();
+  assert(msg);
+
+  const char *pad = "abcdefghijklmnopqrstuvwxyzabcdefghijklmn";
+  hsk_dns_rr_t *rr;
+  int i;
+
+  rr = hsk_dns_rr_create_in(msg->an.arena, HSK_DNS_A);
+  assert(rr);
+  hsk_dns_rr_set_name(rr, "example.");
+  memset(((hsk_dns_a_rd_t *)rr->rd)->addr, 1, 4);
+  hsk_dns_rrs_push(&msg->an, rr);
+
+  for (i = 0; i < 4; i++) {
+    rr = hsk_dns_rr_create_in(msg->ns.arena, HSK_DNS_NS);
+    assert(rr);
+    hsk_dns_rr_set_name(rr, "example.");
+    sprintf(((hsk_dns_ns_rd_t *)rr->rd)->ns, "ns%d.%s.example.", i, pad);
+    hsk_dns_rrs_push(&msg->ns, rr);
+  }
+
+  for (i = 0; i < 4; i++) {
+    rr = hsk_dns_rr_create_in(msg->ar.arena, HSK_DNS_A);
+    assert(rr);
+    sprintf(rr->name, "ns%d.%s.example.", i, pad);
+    memset(((hsk_dns_a_rd_t *)rr->rd)->addr, i, 4);
+    hsk_dns_rrs_push(&msg->ar, rr);
+
+    rr = hsk_dns_rr_create_in(msg->ar.arena, HSK_DNS_AAAA);
+    assert(rr);
+    sprintf(rr->name, "ns%d.%s.example.", i, pad);
+    memset(((hsk_dns_aaaa_rd_t *)rr->rd)->addr, i, 16);
+    hsk_dns_rrs_push(&msg->ar, rr);
+  }
+
+  // Kept to compare names against.
+  uint8_t *full_data;
+  size_t full_len;
+  hsk_dns_msg_t *full;
+  assert(hsk_dns_msg_encode(msg, &full_data, &full_len));
+  assert(hsk_dns_msg_decode(full_data, full_len, &full));
+  free(full_data);
+
+  hsk_dns_tmpl_t tmpl;
+  hsk_dns_tmpl_init(&tmpl);
+  assert(hsk_dns_tmpl_compile(&tmpl, &msg, HSK_DNS_UNKNOWN, NULL, false));
+
+  char name[HSK_DNS_MAX_NAME + 1];
+  sprintf(name, "%s0.%s1.%s2.%s3.example.", pad, pad, pad, pad);
+
+  hsk_dns_req_t req;
+  test_dns_tmpl_req(&req, name, HSK_DNS_A, true, false);
+  req.max_size = HSK_DNS_MAX_UDP;
+
+  size_t question = hsk_dns_name_write(name, NULL, NULL) + 4;
+  assert(12 + question + 11 + tmpl.plain.len > HSK_DNS_MAX_UDP);
+
+  uint8_t *wire;
+  size_t wire_len;
+  assert(hsk_dns_tmpl_write(&tmpl, &req, NULL, NULL, NULL, 0,
+                            &wire, &wire_len));
+  assert(wire_len <= HSK_DNS_MAX_UDP);
+
+  hsk_dns_msg_t *out;
+  assert(hsk_dns_msg_decode(wire, wire_len, &out));
+
+  assert(out->qd.size == 1);
+  assert(strcmp(out->qd.items[0]->name, name) == 0);
+  assert(out->an.size == full->an.size);
+  assert(out->ns.size == full->ns.size);
+  assert(out->ar.size > 0 && out->ar.size < full->ar.size);
+  assert(out->edns.enabled && !(out->edns.flags & HSK_DNS_DO));
+
+  assert(get_u16be(&wire[6]) == out->an.size);
+  assert(get_u16be(&wire[8]) == out->ns.size);
+  assert(get_u16be(&wire[10]) == out->ar.size + 1);
+
+  // Pointers into the body moved past the question.
+  hsk_dns_rrs_t *a[3] = { &out->an, &out->ns, &out->ar };
+  hsk_dns_rrs_t *b[3] = { &full->an, &full->ns, &full->ar };
+  int s;
+
+  for (s = 0; s < 3; s++) {
+    for (i = 0; i < a[s]->size; i++) {
+      assert(strcmp(a[s]->items[i]->name, b[s]->items[i]->name) == 0);
+      assert(a[s]->items[i]->type == b[s]->items[i]->type);
+    }
+  }
+
+  for (i = 0; i < out->ns.size; i++) {
+    hsk_dns_ns_rd_t *x = out->ns.items[i]->rd;
+    hsk_dns_ns_rd_t *y = full->ns.items[i]->rd;
+    assert(strcmp(x->ns, y->ns) == 0);
+  }
+
+  free(wire);
+  hsk_dns_msg_free(out);
+  hsk_dns_msg_free(full);
+  hsk_dns_tmpl_uninit(&tmpl);
+}
+
+// Small deterministic generator, so a failing
+// name can be reproduced.
+static uint32_t
+test_dns_rand(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+// Random names mixing clean, uppercase and dirty
+// bytes, empty labels, labels past 63 bytes, names
+// past 255 bytes and more than 128 labels.
+static void
+test_dns_name_random(uint32_t *state, char *name, size_t size) {
+  static const char chars[] =
+    "abcxyz019-_ABCXYZ*.()@;\\\" \x01\x7f\x80\xfe\xff";
+
+  uint32_t r = test_dns_rand(state);
+  int labels = (r & 7) == 0 ? 100 + (r >> 8) % 60 : (r >> 8) % 8;
+  size_t len = 0;
+  int i, j;
+
+  if ((r >> 4) % 16 == 0)
+    name[len++] = '.';
+
+  for (i = 0; i < labels; i++) {
+    r = test_dns_rand(state);
+
+    int label = (r & 3) == 0 ? (r >> 2) % 72 : (r >> 2) % 12;
+
+    if (labels > 64)
+      label = 1 + (r >> 2) % 2;
+
+    for (j = 0; j < label && len < size - 2; j++) {
+      r = test_dns_rand(state);
+
+      // Mostly letters and digits.
+      if (r % 4 != 0)
+        name[len++] = chars[(r >> 2) % 13];
+      else
+        name[len++] = chars[(r >> 2) % (sizeof(chars) - 1)];
+    }
+
+    if (len >= size - 2)
+      break;
+
+    if (i + 1 < labels || test_dns_rand(state) % 4 != 0)
+      name[len++] = '.';
+  }
+
+  name[len] = '\0';
+}
+
+// The single pass must agree with each of the
+// functions it replaces.
+static void
+test_dns_name_analyze() {
+  uint32_t state = 0x9e3779b9;
+  char name[1024];
+  uint8_t labels[HSK_DNS_MAX_LABELS];
+  hsk_dns_name_info_t info;
+  int n, i;
+
+  for (n = 0; n < 100000; n++) {
+    test_dns_name_random(&state, name, sizeof(name));
+
+    hsk_dns_name_analyze(name, &info);
+
+    size_t len = strlen(name);
+    assert(info.len == len);
+    assert(info.valid == hsk_dns_name_verify(name));
+    assert(info.count == hsk_dns_label_count(name));
+    assert((info.last_dirty >= 0) == hsk_dns_name_dirty(name));
+
+    if (info.last_dirty >= 0) {
+      char c[2] = { name[info.last_dirty], '\0' };
+      assert(hsk_dns_name_dirty(c));
+      assert(!hsk_dns_name_dirty(&name[info.last_dirty + 1]));
+    }
+
+    int count = hsk_dns_label_split(name, labels, HSK_DNS_MAX_LABELS);
+    assert(count == info.count);
+
+    for (i = 0; i < count; i++)
+      assert(info.labels[i] == labels[i]);
+
+    if (len <= HSK_DNS_MAX_NAME) {
+      for (i = 0; i <= (int)len; i++) {
+        uint8_t ch = (uint8_t)name[i];
+
+        if (ch >= 'A' && ch <= 'Z')
+          ch += 0x20;
+
+        assert((uint8_t)info.lower[i] == ch);
+      }
+    }
+  }
+}
+
 void
 test_dns() {
   printf(" test_hsk_dns_name_cmp\n");
   test_hsk_dns_is_subdomain();
+
+  printf(" test_dns_name_analyze\n");
+  test_dns_name_analyze();
+
+  printf(" test_dns_cmp\n");
+  test_dns_cmp();
+
+  printf(" test_dns_pack\n");
+  test_dns_pack();
+
+  printf(" test_dns_req_read\n");
+  test_dns_req_read();
+
+  printf(" test_dns_tmpl\n");
+  test_dns_tmpl();
+
+  printf(" test_dns_tmpl_trunc\n");
+  test_dns_tmpl_trunc();
 }
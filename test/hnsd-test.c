@@ -18,12 +18,27 @@ main() {
   printf("test_base32\n");
   test_base32();
 
+  printf("test_cache\n");
+  test_cache();
+
+  printf("test_chain\n");
+  test_chain();
+
   printf("test_dns\n");
   test_dns();
 
+  printf("test_msg\n");
+  test_msg();
+
+  printf("test_proof\n");
+  test_proof();
+
   printf("test_resource\n");
   test_resource();
 
+  printf("test_tld\n");
+  test_tld();
+
   printf("ok\n");
 
   return 0;
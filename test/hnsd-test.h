@@ -4,10 +4,25 @@
 void
 test_base32();
 
+void
+test_cache();
+
+void
+test_chain();
+
 void
 test_dns();
 
+void
+test_msg();
+
+void
+test_proof();
+
 void
 test_resource();
 
+void
+test_tld();
+
 #endif
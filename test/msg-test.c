@@ -0,0 +1,274 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bio.h"
+#include "msg.h"
+#include "proof.h"
+
+static void
+test_msg_getproofs() {
+  hsk_getproofs_msg_t *msg =
+    (hsk_getproofs_msg_t *)hsk_msg_alloc(HSK_MSG_GETPROOFS);
+  assert(msg);
+
+  memset(msg->root, 0xaa, 32);
+  msg->key_count = 3;
+
+  size_t i;
+  for (i = 0; i < msg->key_count; i++)
+    memset(msg->keys[i], (int)i + 1, 32);
+
+  int size = hsk_msg_size((hsk_msg_t *)msg);
+  assert(size == 32 + 2 + 3 * 32);
+
+  uint8_t data[32 + 2 + 3 * 32];
+  assert(hsk_msg_encode((hsk_msg_t *)msg, data) == size);
+
+  hsk_getproofs_msg_t *out =
+    (hsk_getproofs_msg_t *)hsk_msg_alloc(HSK_MSG_GETPROOFS);
+  assert(out);
+
+  assert(hsk_msg_decode(data, size, (hsk_msg_t *)out));
+  assert(memcmp(out->root, msg->root, 32) == 0);
+  assert(out->key_count == msg->key_count);
+
+  for (i = 0; i < msg->key_count; i++)
+    assert(memcmp(out->keys[i], msg->keys[i], 32) == 0);
+
+  // Truncated.
+  int len;
+  for (len = 0; len < size; len++)
+    assert(!hsk_msg_decode(data, len, (hsk_msg_t *)out));
+
+  // Too many keys.
+  uint8_t *p = &data[32];
+  write_u16(&p, HSK_MSG_MAX_PROOFS + 1);
+  assert(!hsk_msg_decode(data, size, (hsk_msg_t *)out));
+
+  hsk_msg_free((hsk_msg_t *)msg);
+  hsk_msg_free((hsk_msg_t *)out);
+}
+
+// Node table of three nodes, the middle one with
+// a 9 bit prefix, and two proofs indexing into it.
+static size_t
+test_msg_proofs_build(uint8_t *data, uint16_t index) {
+  uint8_t *p = data;
+  uint8_t hash[32];
+  uint8_t key[32];
+
+  memset(hash, 0x11, 32);
+  write_bytes(&p, hash, 32);
+
+  write_u16(&p, 3);
+  write_u8(&p, 0x40);
+
+  memset(hash, 0xa0, 32);
+  write_bytes(&p, hash, 32);
+
+  write_u8(&p, 9);
+  write_u8(&p, 0xb1);
+  write_u8(&p, 0x80);
+  memset(hash, 0xa1, 32);
+  write_bytes(&p, hash, 32);
+
+  memset(hash, 0xa2, 32);
+  write_bytes(&p, hash, 32);
+
+  write_u16(&p, 2);
+
+  // Existing name, path 2, 1.
+  memset(key, 0x01, 32);
+  write_bytes(&p, key, 32);
+  write_u16(&p, (HSK_PROOF_EXISTS << 14) | 2);
+  write_u16(&p, 2);
+  write_u16(&p, 2);
+  write_u16(&p, index);
+  write_u16(&p, 3);
+  write_bytes(&p, (const uint8_t *)"abc", 3);
+
+  // Dead end, path 0.
+  memset(key, 0x02, 32);
+  write_bytes(&p, key, 32);
+  write_u16(&p, (HSK_PROOF_DEADEND << 14) | 1);
+  write_u16(&p, 1);
+  write_u16(&p, 0);
+
+  return p - data;
+}
+
+static void
+test_msg_proofs() {
+  uint8_t data[512];
+  size_t size = test_msg_proofs_build(data, 1);
+
+  hsk_proofs_msg_t *msg = (hsk_proofs_msg_t *)hsk_msg_alloc(HSK_MSG_PROOFS);
+  assert(msg);
+
+  assert(hsk_msg_decode(data, size, (hsk_msg_t *)msg));
+  assert(msg->root[0] == 0x11);
+  assert(msg->node_count == 3);
+  assert(msg->proof_count == 2);
+
+  const hsk_proof_t *proof = &msg->proofs[0];
+  assert(msg->keys[0][0] == 0x01);
+  assert(proof->type == HSK_PROOF_EXISTS);
+  assert(proof->depth == 2);
+  assert(proof->node_count == 2);
+  assert(proof->data[proof->nodes[0].node] == 0xa2);
+  assert(proof->nodes[0].prefix_size == 0);
+  assert(proof->data[proof->nodes[1].node] == 0xa1);
+  assert(proof->nodes[1].prefix_size == 9);
+  assert(proof->data[proof->nodes[1].prefix] == 0xb1);
+  assert(proof->value_size == 3);
+  assert(memcmp(proof->value, "abc", 3) == 0);
+
+  proof = &msg->proofs[1];
+  assert(msg->keys[1][0] == 0x02);
+  assert(proof->type == HSK_PROOF_DEADEND);
+  assert(proof->node_count == 1);
+  assert(proof->data[proof->nodes[0].node] == 0xa0);
+
+  // Only ever received.
+  assert(hsk_msg_size((hsk_msg_t *)msg) == -1);
+
+  hsk_msg_free((hsk_msg_t *)msg);
+
+  // Truncated.
+  size_t len;
+  for (len = 0; len < size; len++) {
+    msg = (hsk_proofs_msg_t *)hsk_msg_alloc(HSK_MSG_PROOFS);
+    assert(msg);
+    assert(!hsk_msg_decode(data, len, (hsk_msg_t *)msg));
+    hsk_msg_free((hsk_msg_t *)msg);
+  }
+
+  // Node index past the table.
+  size = test_msg_proofs_build(data, 3);
+  msg = (hsk_proofs_msg_t *)hsk_msg_alloc(HSK_MSG_PROOFS);
+  assert(msg);
+  assert(!hsk_msg_decode(data, size, (hsk_msg_t *)msg));
+  hsk_msg_free((hsk_msg_t *)msg);
+}
+
+static void
+test_msg_proofs_max_nodes() {
+  size_t max = HSK_MSG_MAX_PROOF_NODES;
+  size_t size = 32 + 2 + (max + 7) / 8 + max * 66 + 2 + 32 + 2 + 2 + 2;
+  uint8_t *data = malloc(size);
+  assert(data);
+
+  uint8_t hash[32];
+  memset(hash, 0x22, 32);
+
+  // Largest table we accept: every node has a
+  // 256 bit prefix. The proof uses the last one.
+  uint8_t *p = data;
+  write_bytes(&p, hash, 32);
+  write_u16(&p, max);
+  memset(p, 0xff, (max + 7) / 8);
+  p += (max + 7) / 8;
+
+  size_t i;
+  for (i = 0; i < max; i++) {
+    write_u8(&p, 0x81);
+    write_u8(&p, 0x00);
+    write_bytes(&p, hash, 32);
+    memset(hash, (int)(i & 0xff), 32);
+    write_bytes(&p, hash, 32);
+  }
+
+  write_u16(&p, 1);
+  write_bytes(&p, hash, 32);
+  write_u16(&p, (HSK_PROOF_DEADEND << 14) | 1);
+  write_u16(&p, 1);
+  write_u16(&p, max - 1);
+
+  assert((size_t)(p - data) == size);
+
+  hsk_proofs_msg_t *msg = (hsk_proofs_msg_t *)hsk_msg_alloc(HSK_MSG_PROOFS);
+  assert(msg);
+
+  assert(hsk_msg_decode(data, size, (hsk_msg_t *)msg));
+  assert(msg->node_count == max);
+  assert(msg->proof_count == 1);
+
+  const hsk_proof_t *proof = &msg->proofs[0];
+  assert(proof->nodes[0].prefix_size == 256);
+  assert(memcmp(&proof->data[proof->nodes[0].node], hash, 32) == 0);
+
+  // One node more is refused.
+  p = &data[32];
+  write_u16(&p, max + 1);
+  assert(!hsk_msg_decode(data, size, (hsk_msg_t *)msg));
+
+  hsk_msg_free((hsk_msg_t *)msg);
+  free(data);
+}
+
+static void
+test_msg_proof_read_shared() {
+  uint8_t table[2 * 32 + 1];
+  hsk_proof_node_t nodes[2];
+
+  table[0] = 0x00;
+  memset(&table[1], 0xc0, 32);
+  memset(&table[33], 0xc1, 32);
+
+  uint8_t *p = table;
+  size_t len = sizeof(table);
+
+  assert(hsk_proof_read_nodes(&p, &len, table, nodes, 2));
+  assert(len == 0);
+
+  uint8_t data[8];
+  p = data;
+  write_u16(&p, (HSK_PROOF_DEADEND << 14) | 2);
+  write_u16(&p, 2);
+  write_u16(&p, 1);
+  write_u16(&p, 0);
+
+  hsk_proof_t proof;
+  hsk_proof_init(&proof);
+
+  p = data;
+  len = sizeof(data);
+  assert(hsk_proof_read_shared(&p, &len, table, nodes, 2, &proof));
+  assert(len == 0);
+  assert(proof.node_count == 2);
+  assert(proof.data[proof.nodes[0].node] == 0xc1);
+  assert(proof.data[proof.nodes[1].node] == 0xc0);
+
+  // Index out of range leaves the proof empty.
+  hsk_proof_init(&proof);
+  p = data;
+  len = sizeof(data);
+  assert(!hsk_proof_read_shared(&p, &len, table, nodes, 1, &proof));
+  assert(proof.node_count == 0);
+
+  // Truncated.
+  size_t i;
+  for (i = 0; i < sizeof(data); i++) {
+    hsk_proof_init(&proof);
+    p = data;
+    len = i;
+    assert(!hsk_proof_read_shared(&p, &len, table, nodes, 2, &proof));
+  }
+}
+
+void
+test_msg() {
+  printf(" test_msg_getproofs\n");
+  test_msg_getproofs();
+
+  printf(" test_msg_proofs\n");
+  test_msg_proofs();
+
+  printf(" test_msg_proofs_max_nodes\n");
+  test_msg_proofs_max_nodes();
+
+  printf(" test_msg_proof_read_shared\n");
+  test_msg_proof_read_shared();
+}
@@ -0,0 +1,297 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "blake2b.h"
+#include "error.h"
+#include "proof.h"
+
+// Long enough to run past the cached levels.
+#define TEST_PROOF_DEPTH (HSK_PROOF_CACHE_DEPTH + 8)
+
+#define TEST_PROOF_BIT(m, i) (((m)[(i) >> 3] >> (7 - ((i) & 7))) & 1)
+
+static void
+test_proof_hash_internal(
+  const uint8_t *left,
+  const uint8_t *right,
+  uint8_t *out
+) {
+  static const uint8_t internal[1] = {0x01};
+  hsk_blake2b_ctx ctx;
+
+  assert(hsk_blake2b_init(&ctx, 32) == 0);
+  hsk_blake2b_update(&ctx, internal, 1);
+  hsk_blake2b_update(&ctx, left, 32);
+  hsk_blake2b_update(&ctx, right, 32);
+  assert(hsk_blake2b_final(&ctx, out, 32) == 0);
+}
+
+static void
+test_proof_fill(uint8_t (*sibs)[32], uint8_t salt) {
+  for (int i = 0; i < TEST_PROOF_DEPTH; i++) {
+    for (int j = 0; j < 32; j++)
+      sibs[i][j] = (uint8_t)(i * 31 + j * 7 + salt);
+  }
+}
+
+// Hashes a deadend up a path of internal nodes without
+// prefixes. `nodes[d]` ends up as the node at depth d,
+// `nodes[0]` as the root.
+static void
+test_proof_path(
+  const uint8_t *key,
+  const uint8_t (*sibs)[32],
+  uint8_t (*nodes)[32]
+) {
+  memset(nodes[TEST_PROOF_DEPTH], 0x00, 32);
+
+  for (int d = TEST_PROOF_DEPTH - 1; d >= 0; d--) {
+    if (TEST_PROOF_BIT(key, d))
+      test_proof_hash_internal(sibs[d], nodes[d + 1], nodes[d]);
+    else
+      test_proof_hash_internal(nodes[d + 1], sibs[d], nodes[d]);
+  }
+}
+
+static void
+test_proof_build(hsk_proof_t *proof, const uint8_t (*sibs)[32]) {
+  hsk_proof_init(proof);
+
+  proof->data = (const uint8_t *)sibs;
+  proof->type = HSK_PROOF_DEADEND;
+  proof->depth = TEST_PROOF_DEPTH;
+  proof->node_count = TEST_PROOF_DEPTH;
+
+  for (int i = 0; i < TEST_PROOF_DEPTH; i++) {
+    proof->nodes[i].prefix = 0;
+    proof->nodes[i].prefix_size = 0;
+    proof->nodes[i].node = (uint16_t)(i * 32);
+  }
+}
+
+static int
+test_proof_verify(
+  const uint8_t *root,
+  const uint8_t *key,
+  const uint8_t (*sibs)[32],
+  hsk_proof_cache_t *cache
+) {
+  hsk_proof_t proof;
+  bool exists = true;
+  const uint8_t *data;
+  size_t data_len;
+
+  test_proof_build(&proof, sibs);
+
+  int rc = hsk_proof_verify(root, key, &proof, cache,
+                            &exists, &data, &data_len);
+
+  if (rc == HSK_EPROOFOK)
+    assert(!exists && !data && data_len == 0);
+
+  return rc;
+}
+
+static const hsk_proof_cache_entry_t *
+test_proof_cached(const hsk_proof_cache_t *cache, const uint8_t *hash) {
+  for (int i = 0; i < HSK_PROOF_CACHE_SIZE; i++) {
+    const hsk_proof_cache_entry_t *entry = &cache->entries[i];
+
+    if (entry->valid && memcmp(entry->hash, hash, 32) == 0)
+      return entry;
+  }
+
+  return NULL;
+}
+
+static void
+test_proof_cache_tampered() {
+  uint8_t key[32];
+  uint8_t sibs[TEST_PROOF_DEPTH][32];
+  uint8_t nodes[TEST_PROOF_DEPTH + 1][32];
+  uint8_t root[32];
+
+  memset(key, 0x5a, 32);
+  test_proof_fill(sibs, 0);
+  test_proof_path(key, sibs, nodes);
+  memcpy(root, nodes[0], 32);
+
+  hsk_proof_cache_t *cache = hsk_proof_cache_alloc();
+  assert(cache);
+
+  assert(test_proof_verify(root, key, sibs, cache) == HSK_EPROOFOK);
+  assert(test_proof_cached(cache, nodes[HSK_PROOF_CACHE_DEPTH]));
+
+  // Every sibling below the deepest cached node feeds
+  // into it, so changing any of them misses the cache.
+  for (int d = HSK_PROOF_CACHE_DEPTH; d < TEST_PROOF_DEPTH; d++) {
+    sibs[d][31] ^= 1;
+    assert(test_proof_verify(root, key, sibs, cache) == HSK_EHASHMISMATCH);
+    assert(test_proof_verify(root, key, sibs, NULL) == HSK_EHASHMISMATCH);
+    sibs[d][31] ^= 1;
+  }
+
+  // Same nodes below, but reached through another
+  // path above them: the cached nodes do not apply.
+  key[1] ^= 0x80;
+
+  assert(test_proof_verify(root, key, sibs, cache) == HSK_EHASHMISMATCH);
+
+  key[1] ^= 0x80;
+
+  assert(test_proof_verify(root, key, sibs, cache) == HSK_EPROOFOK);
+
+  hsk_proof_cache_unref(cache);
+}
+
+static void
+test_proof_cache_root() {
+  uint8_t key[32];
+  uint8_t sibs_a[TEST_PROOF_DEPTH][32];
+  uint8_t sibs_b[TEST_PROOF_DEPTH][32];
+  uint8_t nodes_a[TEST_PROOF_DEPTH + 1][32];
+  uint8_t nodes_b[TEST_PROOF_DEPTH + 1][32];
+
+  memset(key, 0xa5, 32);
+  test_proof_fill(sibs_a, 0);
+  test_proof_fill(sibs_b, 1);
+  test_proof_path(key, sibs_a, nodes_a);
+  test_proof_path(key, sibs_b, nodes_b);
+
+  hsk_proof_cache_t *cache = hsk_proof_cache_alloc();
+  assert(cache);
+
+  assert(test_proof_verify(nodes_a[0], key, sibs_a, cache) == HSK_EPROOFOK);
+
+  // Nodes proven under root A say nothing about root B.
+  assert(test_proof_verify(nodes_b[0], key, sibs_a, cache)
+         == HSK_EHASHMISMATCH);
+
+  // Moving to root B drops everything cached under A.
+  assert(test_proof_verify(nodes_b[0], key, sibs_b, cache) == HSK_EPROOFOK);
+  assert(memcmp(cache->root, nodes_b[0], 32) == 0);
+
+  for (int d = 1; d <= HSK_PROOF_CACHE_DEPTH; d++) {
+    assert(!test_proof_cached(cache, nodes_a[d]));
+    assert(test_proof_cached(cache, nodes_b[d]));
+  }
+
+  assert(test_proof_verify(nodes_a[0], key, sibs_b, cache)
+         == HSK_EHASHMISMATCH);
+
+  hsk_proof_cache_unref(cache);
+}
+
+static void
+test_proof_cache_depth() {
+  uint8_t key[32];
+  uint8_t sibs[TEST_PROOF_DEPTH][32];
+  uint8_t nodes[TEST_PROOF_DEPTH + 1][32];
+
+  memset(key, 0x3c, 32);
+  test_proof_fill(sibs, 2);
+  test_proof_path(key, sibs, nodes);
+
+  hsk_proof_cache_t *cache = hsk_proof_cache_alloc();
+  assert(cache);
+
+  assert(test_proof_verify(nodes[0], key, sibs, cache) == HSK_EPROOFOK);
+
+  int count = 0;
+
+  for (int i = 0; i < HSK_PROOF_CACHE_SIZE; i++) {
+    const hsk_proof_cache_entry_t *entry = &cache->entries[i];
+
+    if (!entry->valid)
+      continue;
+
+    assert(entry->depth >= 1 && entry->depth <= HSK_PROOF_CACHE_DEPTH);
+    assert(memcmp(entry->hash, nodes[entry->depth], 32) == 0);
+
+    count += 1;
+  }
+
+  // Neither the root nor anything deeper.
+  assert(count == HSK_PROOF_CACHE_DEPTH);
+
+  for (int d = HSK_PROOF_CACHE_DEPTH + 1; d <= TEST_PROOF_DEPTH; d++)
+    assert(!test_proof_cached(cache, nodes[d]));
+
+  assert(!test_proof_cached(cache, nodes[0]));
+
+  hsk_proof_cache_unref(cache);
+}
+
+static void
+test_proof_cache_collision() {
+  uint8_t key[32];
+  uint8_t sibs[TEST_PROOF_DEPTH][32];
+  uint8_t forged[TEST_PROOF_DEPTH][32];
+  uint8_t nodes[TEST_PROOF_DEPTH + 1][32];
+  uint8_t other[TEST_PROOF_DEPTH + 1][32];
+  uint8_t root[32];
+  int depth = HSK_PROOF_CACHE_DEPTH;
+  int last = TEST_PROOF_DEPTH - 1;
+
+  memset(key, 0xc3, 32);
+  test_proof_fill(sibs, 3);
+  test_proof_path(key, sibs, nodes);
+  memcpy(root, nodes[0], 32);
+
+  hsk_proof_cache_t *cache = hsk_proof_cache_alloc();
+  assert(cache);
+
+  assert(test_proof_verify(root, key, sibs, cache) == HSK_EPROOFOK);
+
+  const hsk_proof_cache_entry_t *entry = test_proof_cached(cache, nodes[depth]);
+  assert(entry);
+
+  // Grind the bottom sibling until the deepest cached
+  // node shares its slot and leading bytes, but is not
+  // the same node.
+  memcpy(forged, sibs, sizeof(sibs));
+
+  for (uint32_t n = 1;; n++) {
+    memcpy(forged[last], &n, sizeof(n));
+    memset(other[TEST_PROOF_DEPTH], 0x00, 32);
+
+    for (int d = last; d >= depth; d--) {
+      if (TEST_PROOF_BIT(key, d))
+        test_proof_hash_internal(forged[d], other[d + 1], other[d]);
+      else
+        test_proof_hash_internal(other[d + 1], forged[d], other[d]);
+    }
+
+    if (memcmp(other[depth], nodes[depth], 2) == 0
+        && memcmp(other[depth], nodes[depth], 32) != 0) {
+      break;
+    }
+  }
+
+  // Same slot, depth, path and root, but not the node.
+  assert(test_proof_verify(root, key, (const uint8_t (*)[32])forged, cache)
+         == HSK_EHASHMISMATCH);
+
+  assert(entry->valid);
+  assert(memcmp(entry->hash, nodes[depth], 32) == 0);
+
+  assert(test_proof_verify(root, key, sibs, cache) == HSK_EPROOFOK);
+
+  hsk_proof_cache_unref(cache);
+}
+
+void
+test_proof() {
+  printf(" test_proof_cache_tampered\n");
+  test_proof_cache_tampered();
+
+  printf(" test_proof_cache_root\n");
+  test_proof_cache_root();
+
+  printf(" test_proof_cache_depth\n");
+  test_proof_cache_depth();
+
+  printf(" test_proof_cache_collision\n");
+  test_proof_cache_collision();
+}
@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dns.h"
+#include "tld-lookup.h"
+
+static void
+test_tld_index() {
+  char name[HSK_DNS_MAX_LABEL + 1];
+  int i;
+
+  for (i = 0; i < hsk_tld_count(); i++) {
+    const char *tld = hsk_tld_name(i);
+    size_t j;
+
+    assert(strlen(tld) < sizeof(name));
+
+    assert(hsk_tld_index(tld) == i);
+    assert(!hsk_tld_blacklisted(tld));
+
+    for (j = 0; tld[j]; j++)
+      name[j] = toupper((unsigned char)tld[j]);
+
+    name[j] = '\0';
+
+    assert(hsk_tld_index(name) == i);
+    assert(!hsk_tld_blacklisted(name));
+  }
+}
+
+static void
+test_tld_blacklisted() {
+  static const char *names[] = {
+    "bit", "eth", "exit", "gnu", "i2p", "onion", "tor", "zkey",
+    "BIT", "Eth", "EXIT", "gNu", "I2P", "ONION", "Tor", "zKEY"
+  };
+
+  size_t i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    assert(hsk_tld_blacklisted(names[i]));
+    assert(hsk_tld_slot(names[i]) != -1);
+    assert(hsk_tld_index(names[i]) == -1);
+  }
+}
+
+static void
+test_tld_missing() {
+  static const char *names[] = {
+    "", "example", "localhost", "comm", "oni", "onions", "c",
+    "com.", "_synth", "xn--"
+  };
+
+  size_t i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    assert(hsk_tld_slot(names[i]) == -1);
+    assert(hsk_tld_index(names[i]) == -1);
+    assert(!hsk_tld_blacklisted(names[i]));
+  }
+}
+
+void
+test_tld() {
+  printf(" test_tld_index\n");
+  test_tld_index();
+
+  printf(" test_tld_blacklisted\n");
+  test_tld_blacklisted();
+
+  printf(" test_tld_missing\n");
+  test_tld_missing();
+}